@@ -8,30 +8,68 @@
 #include "pboard.h"
 #include "kinnowfb.h"
 
-struct EBusBranch EBusBranches[EBUSBRANCHES];
+#define EBUSAREAMAX 32
+
+struct EBusPage *EBusPages;
+
+struct EBusArea *EBusAreas[EBUSAREAMAX];
+
+int EBusAreaCount = 0;
 
 extern bool Headless;
 
-void *EmptyTranslate(uint32_t address) {
-	return 0;
-}
+void EBusAddArea(struct EBusArea *area) {
+	// Map the area's pages to it. Areas can't share a page, so a device puts
+	// registers that would share one in a single area.
 
-int EmptyMemRead(uint32_t address, void *dest, uint32_t length, void *proc) {
-	return EBUSERROR;
+	if (EBusAreaCount >= EBUSAREAMAX) {
+		fprintf(stderr, "too many ebus areas\n");
+		exit(1);
+	}
+
+	EBusAreas[EBusAreaCount++] = area;
+
+	uint32_t first = area->Base >> EBUSPAGESHIFT;
+	uint32_t end = ((uint64_t)area->Base + area->Size + EBUSPAGESIZE - 1) >> EBUSPAGESHIFT;
+
+	for (uint32_t page = first; page < end; page++) {
+		if (EBusPages[page].Area) {
+			fprintf(stderr, "ebus area at %08x overlaps another\n", area->Base);
+			exit(1);
+		}
+
+		EBusPages[page].Area = area;
+	}
 }
 
-int EmptyMemWrite(uint32_t address, void *dest, uint32_t length, void *proc) {
-	return EBUSERROR;
+void EBusAddMemory(struct EBusArea *area, uint32_t base, uint32_t size, uint8_t *host, int readonly) {
+	// Let the pages of host memory that lie within the area be accessed
+	// directly. Only whole pages can be, so that an access can't run off the
+	// end of the memory; the rest still go through the area's handlers.
+
+	uint32_t first = ((uint64_t)base + EBUSPAGESIZE - 1) >> EBUSPAGESHIFT;
+	uint32_t end = ((uint64_t)base + size) >> EBUSPAGESHIFT;
+
+	host += (first << EBUSPAGESHIFT) - base;
+
+	for (uint32_t page = first; page < end; page++, host += EBUSPAGESIZE) {
+		if (EBusPages[page].Area != area) {
+			continue;
+		}
+
+		EBusPages[page].ReadHost = host;
+
+		if (!readonly) {
+			EBusPages[page].WriteHost = host;
+		}
+	}
 }
 
 int EBusInit() {
-	for (int i = 0; i < EBUSBRANCHES; i++) {
-		EBusBranches[i].Present = 0;
-		EBusBranches[i].Read = EmptyMemRead;
-		EBusBranches[i].Write = EmptyMemWrite;
-		EBusBranches[i].Translate = EmptyTranslate;
-		EBusBranches[i].Reset = 0;
-	}
+	EBusPages = calloc(EBUSPAGECOUNT, sizeof(struct EBusPage));
+
+	if (!EBusPages)
+		return -1;
 
 	if (RAMInit())
 		return -1;
@@ -48,8 +86,8 @@ int EBusInit() {
 }
 
 void EBusReset() {
-	for (int i = 0; i < EBUSBRANCHES; i++) {
-		if (EBusBranches[i].Present && EBusBranches[i].Reset)
-			EBusBranches[i].Reset();
+	for (int i = 0; i < EBusAreaCount; i++) {
+		if (EBusAreas[i]->Reset)
+			EBusAreas[i]->Reset();
 	}
-}
\ No newline at end of file
+}
@@ -9,7 +9,6 @@
 int EBusInit();
 
 #define EBUSBRANCHSIZE (128 * 1024 * 1024)
-#define EBUSBRANCHES 32
 
 enum EBusSuccess {
 	EBUSSUCCESS,
@@ -18,48 +17,63 @@ enum EBusSuccess {
 
 typedef int (*EBusWriteF)(uint32_t address, void *src, uint32_t length, void *proc);
 typedef int (*EBusReadF)(uint32_t address, void *dest, uint32_t length, void *proc);
-typedef void *(*EBusTranslateF)(uint32_t address);
 typedef void (*EBusResetF)();
 
-struct EBusBranch {
-	int Present;
+// A range of physical addresses handled by a device. The handlers are passed
+// the offset of the access within the range, and the access is known to lie
+// entirely within it.
+
+struct EBusArea {
+	uint32_t Base;
+	uint32_t Size;
 	EBusWriteF Write;
 	EBusReadF Read;
-	EBusTranslateF Translate;
 	EBusResetF Reset;
 };
 
-extern struct EBusBranch EBusBranches[EBUSBRANCHES];
+// The physical address space is mapped at 4 KB granularity. Each page refers
+// to the area that handles it, if any, and has host pointers to the start of
+// the page if it can be read or written directly. Some pages are read-only,
+// and some are smaller than a page at the end of an area, so those only go
+// through the area's handlers.
 
-static XR_ALWAYS_INLINE int EBusRead(uint32_t address, void *dest, uint32_t length, void *proc) {
-	return EBusBranches[address >> 27].Read(address & 0x7FFFFFF, dest, length, proc);
-}
+#define EBUSPAGESHIFT 12
+#define EBUSPAGESIZE (1 << EBUSPAGESHIFT)
+#define EBUSPAGECOUNT (1 << (32 - EBUSPAGESHIFT))
 
-static XR_ALWAYS_INLINE int EBusWrite(uint32_t address, void *src, uint32_t length, void *proc) {
-	return EBusBranches[address >> 27].Write(address & 0x7FFFFFF, src, length, proc);
-}
+struct EBusPage {
+	uint8_t *ReadHost;
+	uint8_t *WriteHost;
+	struct EBusArea *Area;
+};
 
-static XR_ALWAYS_INLINE void *EBusTranslate(uint32_t address) {
-	return EBusBranches[address >> 27].Translate(address & 0x7FFFFFF);
-}
+extern struct EBusPage *EBusPages;
+
+void EBusAddArea(struct EBusArea *area);
+
+void EBusAddMemory(struct EBusArea *area, uint32_t base, uint32_t size, uint8_t *host, int readonly);
 
 static XR_ALWAYS_INLINE void CopyWithLength(void *dest, void *src, uint32_t length) {
+	// The copies are done with memcpy rather than through typed pointers.
+	// Since EBusRead is inlined, the destination is often a uint32_t that the
+	// caller then masks, and a uint16_t store into it would be assumed not to
+	// alias that.
+
 	switch (length) {
 		case 1:
-			*(uint8_t*)(dest) = *(uint8_t*)(src);
+			memcpy(dest, src, 1);
 			break;
 
 		case 2:
-			*(uint16_t*)(dest) = *(uint16_t*)(src);
+			memcpy(dest, src, 2);
 			break;
 
 		case 4:
-			*(uint32_t*)(dest) = *(uint32_t*)(src);
+			memcpy(dest, src, 4);
 			break;
 
 		case 16:
-			*(uint64_t*)(dest) = *(uint64_t*)(src);
-			*(uint64_t*)(dest+8) = *(uint64_t*)(src+8);
+			memcpy(dest, src, 16);
 			break;
 
 		default:
@@ -84,6 +98,68 @@ static XR_ALWAYS_INLINE void CopyWithLengthZext(void *dest, void *src, uint32_t
 	}
 }
 
+static XR_ALWAYS_INLINE int EBusRead(uint32_t address, void *dest, uint32_t length, void *proc) {
+	struct EBusPage *page = &EBusPages[address >> EBUSPAGESHIFT];
+	uint32_t offset = address & (EBUSPAGESIZE - 1);
+
+	if (XrLikely(page->ReadHost != 0 && offset + length <= EBUSPAGESIZE)) {
+		CopyWithLength(dest, page->ReadHost + offset, length);
+
+		return EBUSSUCCESS;
+	}
+
+	// Hand it to the device.
+
+	struct EBusArea *area = page->Area;
+
+	if (!area) {
+		return EBUSERROR;
+	}
+
+	offset = address - area->Base;
+
+	if (offset + length > area->Size || offset + length < offset) {
+		return EBUSERROR;
+	}
+
+	return area->Read(offset, dest, length, proc);
+}
+
+static XR_ALWAYS_INLINE int EBusWrite(uint32_t address, void *src, uint32_t length, void *proc) {
+	struct EBusPage *page = &EBusPages[address >> EBUSPAGESHIFT];
+	uint32_t offset = address & (EBUSPAGESIZE - 1);
+
+	if (XrLikely(page->WriteHost != 0 && offset + length <= EBUSPAGESIZE)) {
+		CopyWithLength(page->WriteHost + offset, src, length);
+
+		return EBUSSUCCESS;
+	}
+
+	struct EBusArea *area = page->Area;
+
+	if (!area) {
+		return EBUSERROR;
+	}
+
+	offset = address - area->Base;
+
+	if (offset + length > area->Size || offset + length < offset) {
+		return EBUSERROR;
+	}
+
+	return area->Write(offset, src, length, proc);
+}
+
+static XR_ALWAYS_INLINE void *EBusTranslate(uint32_t address) {
+	uint8_t *host = EBusPages[address >> EBUSPAGESHIFT].ReadHost;
+
+	if (!host) {
+		return 0;
+	}
+
+	return host + (address & (EBUSPAGESIZE - 1));
+}
+
 void EBusReset();
 
 #define EBUSSLOTSTART 24
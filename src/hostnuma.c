@@ -0,0 +1,194 @@
+// Placement of the scheduling threads and the simulated RAM onto the host's
+// processors and NUMA nodes, for -pin. Each simulated NUMA node is assigned to
+// a host NUMA node; the threads that run its processors are pinned to cores of
+// that host node, and its RAM is bound to that host node's memory. This talks
+// to the kernel directly rather than pulling in libnuma.
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "hostnuma.h"
+
+#define XR_HOST_NODE_MAX 64
+#define XR_HOST_CPU_MAX 1024
+
+#define XR_HOST_MASK_BITS (8 * sizeof(unsigned long))
+#define XR_HOST_MASK_LONGS (XR_HOST_CPU_MAX / XR_HOST_MASK_BITS)
+
+// From linux/mempolicy.h.
+
+#define XR_MPOL_BIND 2
+#define XR_MPOL_MF_MOVE (1 << 1)
+
+typedef struct _XrHostNode {
+	int Id;
+	int CpuCount;
+	int NextCpu;
+	int Cpus[XR_HOST_CPU_MAX];
+} XrHostNode;
+
+bool XrPinThreads = false;
+
+XrHostNode *XrHostNodes[XR_HOST_NODE_MAX];
+
+int XrHostNodeCount = 0;
+
+#ifdef __linux__
+
+static void XrAddHostCpus(XrHostNode *node, char *list, unsigned long *allowed) {
+	// Parse a list of processors from sysfs, which looks like "0-3,8-11".
+
+	char *range = strtok(list, ",\n");
+
+	while (range) {
+		int first = 0;
+		int last = 0;
+
+		int count = sscanf(range, "%d-%d", &first, &last);
+
+		if (count == 1) {
+			last = first;
+		}
+
+		if (count >= 1) {
+			for (int cpu = first; cpu <= last && cpu < XR_HOST_CPU_MAX; cpu++) {
+				// Leave out processors we aren't allowed to run on, e.g.
+				// because of taskset or a container's cpuset.
+
+				if (allowed[cpu / XR_HOST_MASK_BITS] & (1UL << (cpu % XR_HOST_MASK_BITS))) {
+					node->Cpus[node->CpuCount++] = cpu;
+				}
+			}
+		}
+
+		range = strtok(0, ",\n");
+	}
+}
+
+#endif
+
+void XrInitializeHostNuma(void) {
+#ifdef __linux__
+	unsigned long allowed[XR_HOST_MASK_LONGS] = { 0 };
+
+	if (syscall(SYS_sched_getaffinity, 0, sizeof(allowed), allowed) < 0) {
+		memset(allowed, 0xFF, sizeof(allowed));
+	}
+
+	for (int id = 0; id < XR_HOST_NODE_MAX; id++) {
+		char path[64];
+
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+
+		FILE *file = fopen(path, "r");
+
+		if (!file) {
+			continue;
+		}
+
+		char list[4096];
+
+		if (!fgets(list, sizeof(list), file)) {
+			list[0] = 0;
+		}
+
+		fclose(file);
+
+		XrHostNode *node = malloc(sizeof(XrHostNode));
+
+		if (!node) {
+			fprintf(stderr, "failed to allocate host node\n");
+			exit(1);
+		}
+
+		node->Id = id;
+		node->CpuCount = 0;
+		node->NextCpu = 0;
+
+		XrAddHostCpus(node, list, allowed);
+
+		if (node->CpuCount == 0) {
+			// Memory-only node, or one we can't use.
+
+			free(node);
+
+			continue;
+		}
+
+		XrHostNodes[XrHostNodeCount++] = node;
+	}
+#endif
+
+	if (XrHostNodeCount == 0) {
+		fprintf(stderr, "Warning: couldn't find the host's NUMA nodes, not pinning threads\n");
+
+		XrPinThreads = false;
+	}
+}
+
+static inline XrHostNode *XrHostNodeForNode(int nodeid) {
+	// Spread the simulated nodes across the host nodes.
+
+	return XrHostNodes[nodeid % XrHostNodeCount];
+}
+
+int XrAllocateHostCpu(int nodeid) {
+	// Return the next core of the host node the simulated node maps to, so that
+	// threads pinned to the same host node get different cores until they run
+	// out.
+
+	XrHostNode *node = XrHostNodeForNode(nodeid);
+
+	return node->Cpus[node->NextCpu++ % node->CpuCount];
+}
+
+void XrPinToHostCpu(int cpu) {
+	// Pin the calling thread to the given host processor.
+
+#ifdef __linux__
+	unsigned long mask[XR_HOST_MASK_LONGS] = { 0 };
+
+	mask[cpu / XR_HOST_MASK_BITS] = 1UL << (cpu % XR_HOST_MASK_BITS);
+
+	if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) < 0) {
+		perror("Warning: couldn't pin scheduling thread");
+	}
+#endif
+}
+
+void *XrAllocateOnHostNode(size_t size, int nodeid) {
+	// Allocate memory that will be placed in the memory of the host node the
+	// simulated node maps to. The pages are bound before they're first
+	// touched, so they start out in the right place.
+
+#ifdef __linux__
+	void *addr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (addr == MAP_FAILED) {
+		return 0;
+	}
+
+	unsigned long nodemask = 1UL << XrHostNodeForNode(nodeid)->Id;
+
+	if (syscall(SYS_mbind, addr, size, XR_MPOL_BIND, &nodemask, XR_HOST_NODE_MAX + 1, XR_MPOL_MF_MOVE) < 0) {
+		perror("Warning: couldn't bind RAM to host node");
+	}
+
+	return addr;
+#else
+	return malloc(size);
+#endif
+}
@@ -0,0 +1,17 @@
+#ifndef XR_HOSTNUMA_H
+#define XR_HOSTNUMA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+extern bool XrPinThreads;
+
+extern void XrInitializeHostNuma(void);
+
+extern int XrAllocateHostCpu(int nodeid);
+
+extern void XrPinToHostCpu(int cpu);
+
+extern void *XrAllocateOnHostNode(size_t size, int nodeid);
+
+#endif // XR_HOSTNUMA_H
@@ -64,99 +64,129 @@ void KinnowCreateScreen(void) {
 				MouseMoved);
 }
 
-int KinnowWrite(uint32_t address, void *src, uint32_t length, void *proc) {
-	if ((address >= 0x3000) && (address < 0x3100)) {
-		address -= 0x3000;
+int KinnowSlotInfoWrite(uint32_t address, void *src, uint32_t length, void *proc) {
+	return EBUSERROR;
+}
 
-		KinnowRegisters[address/4] = *(uint32_t*)src;
+int KinnowSlotInfoRead(uint32_t address, void *dest, uint32_t length, void *proc) {
+	CopyWithLength(dest, &((char*)SlotInfo)[address], length);
+
+	return EBUSSUCCESS;
+}
 
-		return EBUSSUCCESS;
-	} else if (address >= 0x4000 && address < 0x4400) {
-		address -= 0x4000;
+int KinnowRegisterWrite(uint32_t address, void *src, uint32_t length, void *proc) {
+	KinnowRegisters[address/4] = *(uint32_t*)src;
 
-		KinnowPalette[address/4] = *(uint32_t*)src;
+	return EBUSSUCCESS;
+}
 
-		XrLockMutex(&KinnowMutex);
+int KinnowRegisterRead(uint32_t address, void *dest, uint32_t length, void *proc) {
+	*(uint32_t*)dest = KinnowRegisters[address/4];
 
-		IsDirty = true;
+	return EBUSSUCCESS;
+}
 
-		DirtyRectX1 = 0;
-		DirtyRectY1 = 0;
+int KinnowPaletteWrite(uint32_t address, void *src, uint32_t length, void *proc) {
+	KinnowPalette[address/4] = *(uint32_t*)src;
 
-		DirtyRectX2 = KINNOW_FRAMEBUFFER_WIDTH-1;
-		DirtyRectY2 = KINNOW_FRAMEBUFFER_HEIGHT-1;
+	XrLockMutex(&KinnowMutex);
 
-		XrUnlockMutex(&KinnowMutex);
+	IsDirty = true;
 
-		return EBUSSUCCESS;
-	} else if (address >= 0x100000) {
-		address -= 0x100000;
+	DirtyRectX1 = 0;
+	DirtyRectY1 = 0;
 
-		if (address+length > FBSize)
-			return EBUSERROR;
+	DirtyRectX2 = KINNOW_FRAMEBUFFER_WIDTH-1;
+	DirtyRectY2 = KINNOW_FRAMEBUFFER_HEIGHT-1;
 
-		uint32_t pix = address;
-		uint32_t x = pix%KINNOW_FRAMEBUFFER_WIDTH;
-		uint32_t y = pix/KINNOW_FRAMEBUFFER_WIDTH;
+	XrUnlockMutex(&KinnowMutex);
 
-		uint32_t pix1 = (address+length)-1;
-		uint32_t x1 = pix1%KINNOW_FRAMEBUFFER_WIDTH;
-		uint32_t y1 = pix1/KINNOW_FRAMEBUFFER_WIDTH;
+	return EBUSSUCCESS;
+}
 
-		XrLockMutex(&KinnowMutex);
+int KinnowPaletteRead(uint32_t address, void *dest, uint32_t length, void *proc) {
+	return EBUSERROR;
+}
 
-		IsDirty = true;
+int KinnowFBWrite(uint32_t address, void *src, uint32_t length, void *proc) {
+	uint32_t pix = address;
+	uint32_t x = pix%KINNOW_FRAMEBUFFER_WIDTH;
+	uint32_t y = pix/KINNOW_FRAMEBUFFER_WIDTH;
 
-		if (x < DirtyRectX1) {
-			DirtyRectX1 = x;
-		}
+	uint32_t pix1 = (address+length)-1;
+	uint32_t x1 = pix1%KINNOW_FRAMEBUFFER_WIDTH;
+	uint32_t y1 = pix1/KINNOW_FRAMEBUFFER_WIDTH;
 
-		if (y < DirtyRectY1) {
-			DirtyRectY1 = y;
-		}
+	XrLockMutex(&KinnowMutex);
 
-		if (x1 > DirtyRectX2) {
-			DirtyRectX2 = x1;
-		}
+	IsDirty = true;
 
-		if (y1 > DirtyRectY2) {
-			DirtyRectY2 = y1;
-		}
+	if (x < DirtyRectX1) {
+		DirtyRectX1 = x;
+	}
 
-		XrUnlockMutex(&KinnowMutex);
+	if (y < DirtyRectY1) {
+		DirtyRectY1 = y;
+	}
 
-		CopyWithLength(&KinnowFB[address], src, length);
+	if (x1 > DirtyRectX2) {
+		DirtyRectX2 = x1;
+	}
 
-		return EBUSSUCCESS;
+	if (y1 > DirtyRectY2) {
+		DirtyRectY2 = y1;
 	}
 
-	return EBUSERROR;
+	XrUnlockMutex(&KinnowMutex);
+
+	CopyWithLength(&KinnowFB[address], src, length);
+
+	return EBUSSUCCESS;
 }
 
-int KinnowRead(uint32_t address, void *dest, uint32_t length, void *proc) {
-	if (address < 0x100) { // SlotInfo
-		CopyWithLength(dest, &((char*)SlotInfo)[address], length);
+int KinnowFBRead(uint32_t address, void *dest, uint32_t length, void *proc) {
+	CopyWithLength(dest, &KinnowFB[address], length);
 
-		return EBUSSUCCESS;
-	} else if ((address >= 0x3000) && (address < 0x3100)) {
-		address -= 0x3000;
+	return EBUSSUCCESS;
+}
 
-		*(uint32_t*)dest = KinnowRegisters[address/4];
+// The board sits in the first EBus slot. The framebuffer isn't given to the
+// EBus as directly accessible memory, since writes to it have to update the
+// dirty rectangle.
 
-		return EBUSSUCCESS;
-	} else if (address >= 0x100000) {
-		address -= 0x100000;
+#define KINNOWBASE ((uint32_t)EBUSSLOTSTART * EBUSBRANCHSIZE)
 
-		if (address+length > FBSize)
-			return EBUSERROR;
+struct EBusArea KinnowSlotInfoArea = {
+	.Base = KINNOWBASE,
+	.Size = 0x100,
+	.Write = KinnowSlotInfoWrite,
+	.Read = KinnowSlotInfoRead,
+	.Reset = 0,
+};
 
-		CopyWithLength(dest, &KinnowFB[address], length);
+struct EBusArea KinnowRegisterArea = {
+	.Base = KINNOWBASE + 0x3000,
+	.Size = 0x100,
+	.Write = KinnowRegisterWrite,
+	.Read = KinnowRegisterRead,
+	.Reset = 0,
+};
 
-		return EBUSSUCCESS;
-	}
+struct EBusArea KinnowPaletteArea = {
+	.Base = KINNOWBASE + 0x4000,
+	.Size = 0x400,
+	.Write = KinnowPaletteWrite,
+	.Read = KinnowPaletteRead,
+	.Reset = 0,
+};
 
-	return EBUSERROR;
-}
+struct EBusArea KinnowFBArea = {
+	.Base = KINNOWBASE + 0x100000,
+	.Size = 0,
+	.Write = KinnowFBWrite,
+	.Read = KinnowFBRead,
+	.Reset = 0,
+};
 
 uint32_t PixelBuffer[KINNOW_FRAMEBUFFER_WIDTH*KINNOW_FRAMEBUFFER_HEIGHT];
 
@@ -220,10 +250,12 @@ int KinnowInit() {
 
 	memset(KinnowFB, 0, FBSize);
 
-	EBusBranches[24].Present = 1;
-	EBusBranches[24].Write = KinnowWrite;
-	EBusBranches[24].Read = KinnowRead;
-	EBusBranches[24].Reset = 0;
+	KinnowFBArea.Size = FBSize;
+
+	EBusAddArea(&KinnowSlotInfoArea);
+	EBusAddArea(&KinnowRegisterArea);
+	EBusAddArea(&KinnowPaletteArea);
+	EBusAddArea(&KinnowFBArea);
 
 	memset(&SlotInfo, 0, 256);
 
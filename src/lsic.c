@@ -65,6 +65,12 @@ void LsicInterruptTargeted(void *proc, int intsrc) {
 		((~lsic->Registers[LSIC_MASK_1]) & lsic->Registers[LSIC_PENDING_1] & lsic->HighIplMask);
 
 	XrUnlockInterrupt(rproc);
+
+	if (lsic->InterruptPending) {
+		// Wake the processor if it's parked in HLT.
+
+		XrWakeWork(&rproc->Schedulable);
+	}
 }
 
 void LsicInterrupt(int intsrc) {
@@ -86,7 +92,19 @@ void LsicInterrupt(int intsrc) {
 	}
 }
 
-int LsicWrite(int reg, uint32_t value) {
+static inline void LsicNoteIpi(XrProcessor *proc, XrProcessor *sender) {
+	// Processors that interrupt each other are interacting closely, so let
+	// both know, so that they run in shorter quanta for a while and take turns
+	// more often.
+
+	proc->QuantumEvents++;
+
+	if (sender) {
+		sender->QuantumEvents++;
+	}
+}
+
+int LsicWrite(int reg, uint32_t value, void *sender) {
 	int id = reg >> 3;
 	reg &= 7;
 
@@ -129,6 +147,8 @@ int LsicWrite(int reg, uint32_t value) {
 			value &= ~1; // Make sure interrupt zero can't be triggered.
 			lsic->Registers[LSIC_PENDING_0] |= value;
 
+			LsicNoteIpi(proc, sender);
+
 			// printf("ipi %d -> %d (%x -> %x)\n", XrIoMutexProcessor->Id, id, oldpend, lsic->Registers[LSIC_PENDING_0]);
 
 			break;
@@ -149,6 +169,8 @@ int LsicWrite(int reg, uint32_t value) {
 			value &= ~1; // Make sure interrupt zero can't be triggered.
 			lsic->Registers[LSIC_PENDING_1] |= value;
 
+			LsicNoteIpi(proc, sender);
+
 			break;
 
 		case LSIC_CLAIM_COMPLETE:
@@ -204,6 +226,13 @@ int LsicWrite(int reg, uint32_t value) {
 
 	XrUnlockInterrupt(proc);
 
+	if (lsic->InterruptPending) {
+		// This might have been an IPI to a processor that's parked in HLT, or
+		// unmasked an interrupt that it was waiting for.
+
+		XrWakeWork(&proc->Schedulable);
+	}
+
 	return EBUSSUCCESS;
 }
 
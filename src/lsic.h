@@ -21,7 +21,7 @@ typedef struct _Lsic {
 } Lsic;
 
 extern Lsic LsicTable[];
-extern int LsicWrite(int reg, uint32_t value);
+extern int LsicWrite(int reg, uint32_t value, void *sender);
 extern int LsicRead(int reg, uint32_t *value);
 extern void LsicReset();
 extern void LsicInterrupt(int intsrc);
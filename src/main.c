@@ -25,6 +25,7 @@
 #include "screen.h"
 #include "tty.h"
 #include "lsic.h"
+#include "hostnuma.h"
 
 XrNumaNode XrNumaNodes[XR_NODE_MAX];
 
@@ -42,6 +43,8 @@ int TickEnd = 0;
 int TickStart = 0;
 int TickAfterDraw = 0;
 
+int TimeToNextStats = 2000;
+
 void MainLoop(void) {
 #ifndef EMSCRIPTEN
 	while (!done) {
@@ -66,14 +69,36 @@ void MainLoop(void) {
 		// completion or spinlock release just because the other CPU's host
 		// thread is asleep waiting for its next timeslice.
 
-		XrScheduleAllNextFrameWork(TickAfterDraw - TickEnd);
+		if (XrTurbo) {
+			// In turbo mode the scheduler threads hand out virtual time
+			// themselves whenever they run out of work. Just make sure they
+			// get started, and keep drawing on the side.
+
+			XrSchedulerCheckIdle();
+		} else {
+			XrScheduleAllNextFrameWork(TickAfterDraw - TickEnd);
+		}
 
 #ifdef EMSCRIPTEN
 		XrSchedulerLoop(0);
 #endif
 
+		int TickLastEnd = TickEnd;
+
 		TickEnd = SDL_GetTicks();
 
+		if (XrPrintStats) {
+			TimeToNextStats -= TickEnd - TickLastEnd;
+
+			if (TimeToNextStats <= 0) {
+				// It's time to print some scheduling statistics.
+
+				XrPrintProcessorStats();
+
+				TimeToNextStats = 2000;
+			}
+		}
+
 #ifndef EMSCRIPTEN
 		int delay = 1000/FPS - (TickEnd - TickStart);
 
@@ -198,10 +223,8 @@ int main(int argc, char *argv[]) {
 				return 1;
 			}
 
-#if XR_SIMULATE_CACHES
 		} else if (strcmp(argv[i], "-cacheprint") == 0) {
 			XrPrintCache = true;
-#endif
 
 		} else if (strcmp(argv[i], "-diskprint") == 0) {
 			DKSPrint = true;
@@ -227,6 +250,56 @@ int main(int argc, char *argv[]) {
 				return 1;
 			}
 
+		} else if (strcmp(argv[i], "-iblocks") == 0) {
+			if (i+1 < argc) {
+				int iblocks = atoi(argv[i+1]);
+				if (iblocks <= XR_IBLOCK_RECLAIM) {
+					fprintf(stderr, "iblock count must be greater than %d\n", XR_IBLOCK_RECLAIM);
+					return 1;
+				}
+
+				XrIblockCount = iblocks;
+				i++;
+			} else {
+				fprintf(stderr, "no iblock count specified\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-sharediblocks") == 0) {
+			XrSharedIblocks = true;
+
+		} else if (strcmp(argv[i], "-sharedcode") == 0) {
+			XrSharedCodeStore = true;
+
+		} else if (strcmp(argv[i], "-virtualtime") == 0) {
+			XrVirtualTime = true;
+
+		} else if (strcmp(argv[i], "-turbo") == 0) {
+			XrVirtualTime = true;
+			XrTurbo = true;
+
+		} else if (strcmp(argv[i], "-gang") == 0) {
+			if (i+1 < argc) {
+				if (strcmp(argv[i+1], "system") == 0) {
+					XrGangScheduling = XR_GANG_SYSTEM;
+				} else if (strcmp(argv[i+1], "node") == 0) {
+					XrGangScheduling = XR_GANG_NODE;
+				} else {
+					fprintf(stderr, "gang must be system or node\n");
+					return 1;
+				}
+				i++;
+			} else {
+				fprintf(stderr, "no gang specified\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-pin") == 0) {
+			XrPinThreads = true;
+
+		} else if (strcmp(argv[i], "-statsprint") == 0) {
+			XrPrintStats = true;
+
 		} else if (strcmp(argv[i], "-node") == 0) {
 			if (i+3 < argc) {
 				int nodeid = atoi(argv[i+1]);
@@ -350,6 +423,10 @@ int main(int argc, char *argv[]) {
 	threads = 1;
 #endif
 
+	if (XrPinThreads) {
+		XrInitializeHostNuma();
+	}
+
 	XrInitializeScheduler(threads);
 
 	if (!Headless) {
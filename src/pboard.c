@@ -22,6 +22,11 @@ struct CitronPort CitronPorts[CITRONPORTS];
 
 bool NVRAMDirty = false;
 
+// The platform board's devices each get their own area at the top of the
+// physical address space.
+
+#define PBOARDBASE 0xF8000000
+
 int PBoardWrite(uint32_t address, void *src, uint32_t length, void *proc) {
 	if (address < 0x400) {
 		// citron
@@ -33,24 +38,7 @@ int PBoardWrite(uint32_t address, void *src, uint32_t length, void *proc) {
 		else {
 			return EBUSERROR;
 		}
-	} else if (address >= 0x7FE0000) {
-		// bootrom
-
-		return EBUSSUCCESS;
-	} else if ((address >= 0x1000) && (address < 0x2000)) {
-		// nvram
-
-		address -= 0x1000;
-
-		NVRAMDirty = true;
-
-		if (address+length > NVRAMSIZE)
-			return false;
-
-		CopyWithLength(&NVRAM[address], src, length);
-
-		return EBUSSUCCESS;
-	} else if ((address >= 0x800) && (address < 0x880)) {
+	} else if (address >= 0x800) {
 		// pboard registers
 
 		address -= 0x800;
@@ -59,22 +47,6 @@ int PBoardWrite(uint32_t address, void *src, uint32_t length, void *proc) {
 			if (address != 0)
 				PBoardRegisters[address/4] = *(uint32_t*)src;
 
-			return EBUSSUCCESS;
-		}
-	} else if ((address >= 0x30000) && (address < (0x30000 + (32 * XR_PROC_MAX)))) {
-		// LSIC registers
-
-		address -= 0x30000;
-
-		if (length == 4) {
-			return LsicWrite(address/4, *(uint32_t*)src);
-		}
-	} else if (address == 0x800000) {
-		// reset
-
-		if ((length == 4) && (*(uint32_t*)src == RESETMAGIC)) {
-			EBusReset();
-
 			return EBUSSUCCESS;
 		}
 	}
@@ -93,63 +65,75 @@ int PBoardRead(uint32_t address, void *dest, uint32_t length, void *proc) {
 		else {
 			return EBUSERROR;
 		}
-	} else if (address >= 0x7FE0000) {
-		// bootrom
+	} else if (address >= 0x800) {
+		// pboard registers
 
-		address -= 0x7FE0000;
+		address -= 0x800;
+
+		if (length == 4) {
+			*(uint32_t*)dest = PBoardRegisters[address/4];
 
-		if (address+length > ROMSIZE)
-			return false;
+			return EBUSSUCCESS;
+		}
+	}
 
-		CopyWithLength(dest, &BootROM[address], length);
+	return EBUSERROR;
+}
 
-		return EBUSSUCCESS;
-	} else if ((address >= 0x1000) && (address < 0x11000)) {
-		// nvram
+int NVRAMWrite(uint32_t address, void *src, uint32_t length, void *proc) {
+	NVRAMDirty = true;
 
-		address -= 0x1000;
+	CopyWithLength(&NVRAM[address], src, length);
 
-		if (address+length > NVRAMSIZE)
-			return false;
+	return EBUSSUCCESS;
+}
 
-		CopyWithLength(dest, &NVRAM[address], length);
+int NVRAMRead(uint32_t address, void *dest, uint32_t length, void *proc) {
+	CopyWithLength(dest, &NVRAM[address], length);
 
-		return EBUSSUCCESS;
-	} else if ((address >= 0x800) && (address < 0x880)) {
-		// pboard registers
+	return EBUSSUCCESS;
+}
 
-		address -= 0x800;
+int PBoardLsicWrite(uint32_t address, void *src, uint32_t length, void *proc) {
+	if (length == 4) {
+		return LsicWrite(address/4, *(uint32_t*)src, proc);
+	}
 
-		if (length == 4) {
-			*(uint32_t*)dest = PBoardRegisters[address/4];
+	return EBUSERROR;
+}
 
-			return EBUSSUCCESS;
-		}
-	} else if ((address >= 0x30000) && (address < (0x30000 + (32 * XR_PROC_MAX)))) {
-		// LSIC registers
+int PBoardLsicRead(uint32_t address, void *dest, uint32_t length, void *proc) {
+	if (length == 4) {
+		return LsicRead(address/4, dest);
+	}
 
-		address -= 0x30000;
+	return EBUSERROR;
+}
 
-		if (length == 4) {
-			return LsicRead(address/4, dest);
-		}
+int PBoardResetWrite(uint32_t address, void *src, uint32_t length, void *proc) {
+	if ((length == 4) && (*(uint32_t*)src == RESETMAGIC)) {
+		EBusReset();
+
+		return EBUSSUCCESS;
 	}
 
 	return EBUSERROR;
 }
 
-void *PBoardTranslate(uint32_t address) {
-	if (address >= 0x7FE0000) {
-		address -= 0x7FE0000;
+int PBoardResetRead(uint32_t address, void *dest, uint32_t length, void *proc) {
+	return EBUSERROR;
+}
 
-		if (address >= ROMSIZE) {
-			return 0;
-		}
+int ROMWrite(uint32_t address, void *src, uint32_t length, void *proc) {
+	// Writes to the boot ROM are ignored.
 
-		return &BootROM[address];
-	}
+	return EBUSSUCCESS;
+}
 
-	return 0;
+int ROMRead(uint32_t address, void *dest, uint32_t length, void *proc) {
+	CopyWithLength(dest, &BootROM[address], length);
+
+	return EBUSSUCCESS;
 }
 
 void PBoardReset() {
@@ -160,6 +144,46 @@ void PBoardReset() {
 	LsicReset();
 }
 
+struct EBusArea PBoardArea = {
+	.Base = PBOARDBASE,
+	.Size = 0x880,
+	.Write = PBoardWrite,
+	.Read = PBoardRead,
+	.Reset = PBoardReset,
+};
+
+struct EBusArea NVRAMArea = {
+	.Base = PBOARDBASE + 0x1000,
+	.Size = NVRAMSIZE,
+	.Write = NVRAMWrite,
+	.Read = NVRAMRead,
+	.Reset = 0,
+};
+
+struct EBusArea PBoardLsicArea = {
+	.Base = PBOARDBASE + 0x30000,
+	.Size = 32 * XR_PROC_MAX,
+	.Write = PBoardLsicWrite,
+	.Read = PBoardLsicRead,
+	.Reset = 0,
+};
+
+struct EBusArea PBoardResetArea = {
+	.Base = PBOARDBASE + 0x800000,
+	.Size = 4,
+	.Write = PBoardResetWrite,
+	.Read = PBoardResetRead,
+	.Reset = 0,
+};
+
+struct EBusArea ROMArea = {
+	.Base = PBOARDBASE + 0x7FE0000,
+	.Size = ROMSIZE,
+	.Write = ROMWrite,
+	.Read = ROMRead,
+	.Reset = 0,
+};
+
 FILE *nvramfile = 0;
 
 void NVRAMSave() {
@@ -220,11 +244,15 @@ bool NVRAMLoadFile(char *nvramname) {
 }
 
 int PBoardInit() {
-	EBusBranches[31].Present = 1;
-	EBusBranches[31].Write = PBoardWrite;
-	EBusBranches[31].Read = PBoardRead;
-	EBusBranches[31].Translate = PBoardTranslate;
-	EBusBranches[31].Reset = PBoardReset;
+	EBusAddArea(&PBoardArea);
+	EBusAddArea(&NVRAMArea);
+	EBusAddArea(&PBoardLsicArea);
+	EBusAddArea(&PBoardResetArea);
+	EBusAddArea(&ROMArea);
+
+	// The boot ROM can be read directly, but not written.
+
+	EBusAddMemory(&ROMArea, ROMArea.Base, ROMSIZE, BootROM, 1);
 
 	PBoardRegisters[0] = 0x00030001; // pboard version
 
@@ -9,6 +9,7 @@
 
 #include "ebus.h"
 #include "ram256.h"
+#include "hostnuma.h"
 
 uint8_t  *RAMSlots[RAMSLOTCOUNT];
 uint32_t RAMSlotSizes[RAMSLOTCOUNT];
@@ -65,70 +66,16 @@ int RAMRead(uint32_t address, void *dest, uint32_t length, void *proc) {
 	return EBUSSUCCESS;
 }
 
-void *RAMTranslate(uint32_t address) {
-	int slot = address >> 25;
-	int offset = address & (RAMSLOTSIZE-1);
-
-	if (offset >= RAMSlotSizes[slot])
-		return 0;
-
-	return &RAMSlots[slot][offset];
-}
-
-int RAMWriteExt(uint32_t address, void *src, uint32_t length, void *proc) {
-	address += EBUSBRANCHSIZE;
-
-	int slot = address >> 25;
-	int offset = address & (RAMSLOTSIZE-1);
-
-	if (offset+length > RAMSlotSizes[slot]){
-		return EBUSERROR;
-	}
-
-	CopyWithLength(&RAMSlots[slot][offset], src, length);
-
-	return EBUSSUCCESS;
-}
-
-int RAMReadExt(uint32_t address, void *dest, uint32_t length, void *proc) {
-	address += EBUSBRANCHSIZE;
-
-	int slot = address >> 25;
-	int offset = address & (RAMSLOTSIZE-1);
-
-	if (offset+length > RAMSlotSizes[slot]){
-		return EBUSERROR;
-	}
-
-	CopyWithLength(dest, &RAMSlots[slot][offset], length);
-
-	return EBUSSUCCESS;
-}
-
-void *RAMTranslateExt(uint32_t address) {
-	address += EBUSBRANCHSIZE;
-
-	int slot = address >> 25;
-	int offset = address & (RAMSLOTSIZE-1);
-
-	if (offset >= RAMSlotSizes[slot])
-		return 0;
-
-	return &RAMSlots[slot][offset];
-}
+struct EBusArea RAMArea = {
+	.Base = 0,
+	.Size = RAMMAXIMUM,
+	.Write = RAMWrite,
+	.Read = RAMRead,
+	.Reset = 0,
+};
 
 int RAMInit() {
-	EBusBranches[0].Present = 1;
-	EBusBranches[0].Write = RAMWrite;
-	EBusBranches[0].Read = RAMRead;
-	EBusBranches[0].Translate = RAMTranslate;
-	EBusBranches[0].Reset = 0;
-
-	EBusBranches[1].Present = 1;
-	EBusBranches[1].Write = RAMWriteExt;
-	EBusBranches[1].Read = RAMReadExt;
-	EBusBranches[1].Translate = RAMTranslateExt;
-	EBusBranches[1].Reset = 0;
+	EBusAddArea(&RAMArea);
 
 	for (int nodeid = 0; nodeid < XR_NODE_MAX; nodeid++) {
 		uint32_t noderam = XrNumaNodes[nodeid].RamSize;
@@ -156,10 +103,17 @@ int RAMInit() {
 
 	for (int i = 0; i < RAMSLOTCOUNT; i++) {
 		if (RAMSlotSizes[i]) {
-			RAMSlots[i] = malloc(RAMSlotSizes[i]);
+			if (XrPinThreads) {
+				RAMSlots[i] = XrAllocateOnHostNode(RAMSlotSizes[i], i / SLOTS_PER_NODE);
+			} else {
+				RAMSlots[i] = malloc(RAMSlotSizes[i]);
+			}
+
 			if (!RAMSlots[i]) {
 				return -1;
 			}
+
+			EBusAddMemory(&RAMArea, i * RAMSLOTSIZE, RAMSlotSizes[i], RAMSlots[i], 0);
 		}
 	}
 
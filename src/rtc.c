@@ -14,15 +14,54 @@
 
 struct timeval RTCCurrentTime;
 
+struct timeval RTCBootTime;
+
 uint32_t RTCIntervalMS = 0;
 
+// The total virtual time skipped while the processors were idle, which is
+// added to the host time so the guest's clock agrees with its timer ticks. In
+// turbo mode, this is all of the time that has passed since boot.
+
+uint64_t RTCSkippedMS = 0;
+
 uint32_t RTCPortA;
 
+static void RTCAddTime(uint64_t ms) {
+	RTCCurrentTime.tv_sec += ms / 1000;
+	RTCCurrentTime.tv_usec += (ms % 1000) * 1000;
+
+	if (RTCCurrentTime.tv_usec >= 1000000) {
+		RTCCurrentTime.tv_sec += 1;
+		RTCCurrentTime.tv_usec -= 1000000;
+	}
+}
+
 void RTCUpdateRealTime() {
 	// Currently the thread for CPU 0 does the RTC intervals, so we don't need
 	// any synchronization until we need to do an interrupt.
 
 	gettimeofday(&RTCCurrentTime, 0);
+
+	if (RTCSkippedMS) {
+		RTCAddTime(RTCSkippedMS);
+	}
+}
+
+void RTCUpdateVirtualTime(int behind) {
+	// The host clock isn't consulted after boot. Instead, the time is however
+	// much virtual time has been handed out, less the amount of its timeslice
+	// that CPU 0 has yet to execute.
+
+	RTCCurrentTime = RTCBootTime;
+
+	RTCAddTime(RTCSkippedMS - behind);
+}
+
+void RTCSkipTime(uint32_t ms) {
+	// Only one thread skips time at once, and the time is only read by the
+	// thread for CPU 0, which is parked while we do this.
+
+	RTCSkippedMS += ms;
 }
 
 int RTCWriteCMD(uint32_t port, uint32_t type, uint32_t value, void *proc) {
@@ -80,6 +119,8 @@ int RTCReadPortA(uint32_t port, uint32_t type, uint32_t *value, void *proc) {
 void RTCInit() {
 	gettimeofday(&RTCCurrentTime, 0);
 
+	RTCBootTime = RTCCurrentTime;
+
 	CitronPorts[0x20].Present = 1;
 	CitronPorts[0x20].ReadPort = RTCReadCMD;
 	CitronPorts[0x20].WritePort = RTCWriteCMD;
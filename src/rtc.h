@@ -10,6 +10,10 @@ void RTCInit();
 
 void RTCUpdateRealTime();
 
+void RTCUpdateVirtualTime(int behind);
+
+void RTCSkipTime(uint32_t ms);
+
 extern uint32_t RTCIntervalMS;
 
 #endif
\ No newline at end of file
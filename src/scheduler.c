@@ -1,23 +1,86 @@
+// For clock_gettime under -std=c99.
+
+#define _POSIX_C_SOURCE 199309L
+
 #include "scheduler.h"
 #include "xr.h"
+#include "hostnuma.h"
+#include "rtc.h"
 #include "pthread.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-
-ListEntry XrSchedulerWorkList;
-XrMutex XrSchedulerWorkListMutex;
+#include <stdatomic.h>
+#include <time.h>
 
 ListEntry XrSchedulerNextFrameList;
 XrMutex XrSchedulerNextFrameListMutex;
 
-XrSemaphore XrSchedulerSemaphore;
+// The number of schedulables waiting in the run queues plus the number of
+// threads running a chain of work. When it drops to zero, nothing is going to
+// run until the next frame or until something is unparked.
+
+_Atomic int XrSchedulerActive = 0;
+
+// Serializes calls to XrSkipIdleTime, and the starts of frames with them. If
+// the scheduler goes idle again while the mutex is held, the request is left
+// for the thread holding it to retry.
+
+XrMutex XrSchedulerIdleMutex;
+_Atomic int XrSchedulerIdleRequested = 0;
 
 int XrSchedulingThreadCount = 0;
 
+// The total time handed out by XrStartNextFrame, for -statsprint.
+// Work that's still running from the last frame when the next one starts
+// doesn't get that frame's time.
+
+_Atomic uint64_t XrSchedulerElapsedMs = 0;
+
+uint64_t XrHostTimeNs(void) {
+	// Return a monotonic host timestamp in nanoseconds, for statistics.
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Work that has never run on any thread is spread across them in turn.
+
+_Atomic unsigned int XrSchedulingThreadRotor = 0;
+
 struct _XrSchedulingThread {
 	pthread_t Pthread;
 	XrSchedulable *Next;
+
+	// With -pin, the simulated NUMA node whose processors the thread runs and
+	// the host processor it's pinned to. Otherwise both are -1.
+
+	int Node;
+	int HostCpu;
+
+	// Each thread has its own run queue. It takes work from the head of its
+	// own queue, and when that's empty, steals from the tail of the others'.
+
+	ListEntry WorkList;
+	XrMutex WorkListMutex;
+
+	// A thread with nothing to do sets Idle and waits on its semaphore. Whoever
+	// queues work clears Idle on the thread it wants to wake, so that each
+	// idle thread is only woken once.
+
+	XrSemaphore Semaphore;
+	_Atomic int Idle;
+
+	// Time spent waiting on the semaphore for work to show up, for
+	// -statsprint, and what it was when it was last printed.
+
+	uint64_t WaitNs;
+	uint64_t WaitCount;
+	uint64_t PrintedWaitNs;
+	uint64_t PrintedWaitCount;
 };
 
 // There can't be more scheduling threads than processors so that should be the
@@ -25,33 +88,104 @@ struct _XrSchedulingThread {
 
 XrSchedulingThread XrSchedulingThreadTable[XR_PROC_MAX];
 
-static inline XrSchedulable *XrPopSchedulerWork(XrSchedulingThread *thread) {
-	while (1) {
-		// Wait until there is work.
+// The range of threads assigned to each simulated node, with -pin.
+
+int XrNodeFirstThread[XR_NODE_MAX];
+int XrNodeThreadCount[XR_NODE_MAX];
+
+static inline XrSchedulable *XrTakeSchedulerWork(XrSchedulingThread *thread, int steal) {
+	XrLockMutex(&thread->WorkListMutex);
+
+	ListEntry *listentry = steal ? thread->WorkList.Prev : thread->WorkList.Next;
+
+	if (listentry == &thread->WorkList) {
+		XrUnlockMutex(&thread->WorkListMutex);
+
+		return 0;
+	}
+
+	RemoveEntryList(listentry);
+
+	XrUnlockMutex(&thread->WorkListMutex);
+
+	return ContainerOf(listentry, XrSchedulable, WorkEntry);
+}
+
+static inline XrSchedulable *XrFindSchedulerWork(XrSchedulingThread *thread) {
+	XrSchedulable *work = XrTakeSchedulerWork(thread, 0);
+
+	if (work) {
+		return work;
+	}
 
-		XrWaitSemaphore(&XrSchedulerSemaphore);
+	// Our own queue is empty, so try to steal from the others, starting with
+	// the next thread over so that the thieves don't all pile onto one. With
+	// -pin, look at the threads for the same node first, and only take work
+	// from another node if there's none.
 
-		XrLockMutex(&XrSchedulerWorkListMutex);
+	int id = thread - &XrSchedulingThreadTable[0];
 
-		ListEntry *listentry = XrSchedulerWorkList.Next;
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 1; i < XrSchedulingThreadCount; i++) {
+			XrSchedulingThread *victim = &XrSchedulingThreadTable[(id + i) % XrSchedulingThreadCount];
 
-		if (listentry == &XrSchedulerWorkList) {
-			// It's empty, so nevermind.
+			if ((victim->Node == thread->Node) == pass) {
+				continue;
+			}
+
+			if (victim->WorkList.Next == &victim->WorkList) {
+				// Looks empty; don't bother taking the lock.
+
+				continue;
+			}
 
-			XrUnlockMutex(&XrSchedulerWorkListMutex);
+			work = XrTakeSchedulerWork(victim, 1);
+
+			if (work) {
+				return work;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static inline XrSchedulable *XrPopSchedulerWork(XrSchedulingThread *thread) {
+	while (1) {
+		XrSchedulable *work = XrFindSchedulerWork(thread);
 
+		if (!work) {
 #ifdef EMSCRIPTEN
 			return 0;
 #else
-			continue;
-#endif
-		}
+			// Declare ourselves idle and look again, in case work was queued
+			// after we looked but before it could see that we were idle.
 
-		XrSchedulable *work = ContainerOf(listentry, XrSchedulable, WorkEntry);
+			atomic_store(&thread->Idle, 1);
+
+			work = XrFindSchedulerWork(thread);
+
+			if (!work) {
+				// Wait until there is work.
+
+				uint64_t start = XrHostTimeNs();
 
-		RemoveEntryList(listentry);
+				XrWaitSemaphore(&thread->Semaphore);
 
-		XrUnlockMutex(&XrSchedulerWorkListMutex);
+				thread->WaitNs += XrHostTimeNs() - start;
+				thread->WaitCount++;
+
+				atomic_store(&thread->Idle, 0);
+
+				continue;
+			}
+
+			// We may have been woken up anyway, in which case the semaphore
+			// will just be posted once more than it needs to be.
+
+			atomic_store(&thread->Idle, 0);
+#endif
+		}
 
 		work->PreferredThread = thread;
 
@@ -59,6 +193,29 @@ static inline XrSchedulable *XrPopSchedulerWork(XrSchedulingThread *thread) {
 	}
 }
 
+static inline void XrWakeSchedulingThread(XrSchedulingThread *target) {
+	// Wake the target thread if it's idle. Otherwise, it's busy, so wake any
+	// idle thread to come steal the work.
+
+	if (atomic_exchange(&target->Idle, 0)) {
+		XrPostSemaphore(&target->Semaphore);
+
+		return;
+	}
+
+	for (int i = 0; i < XrSchedulingThreadCount; i++) {
+		XrSchedulingThread *thread = &XrSchedulingThreadTable[i];
+
+		if (atomic_load_explicit(&thread->Idle, memory_order_relaxed) &&
+			atomic_exchange(&thread->Idle, 0)) {
+
+			XrPostSemaphore(&thread->Semaphore);
+
+			return;
+		}
+	}
+}
+
 void XrScheduleWorkForAny(XrSchedulable *work) {
 	if (work->Enqueued) {
 		return;
@@ -66,13 +223,39 @@ void XrScheduleWorkForAny(XrSchedulable *work) {
 
 	work->Enqueued = 1;
 
-	XrLockMutex(&XrSchedulerWorkListMutex);
+	atomic_fetch_add_explicit(&XrSchedulerActive, 1, memory_order_relaxed);
+
+	// Queue the work on the thread that last ran it, since its state is likely
+	// still in that host processor's cache.
+
+	XrSchedulingThread *target = work->PreferredThread;
+
+	if (work->Node >= 0 && XrNodeThreadCount[work->Node] &&
+		(!target || target->Node != work->Node)) {
+
+		// It belongs to a node with threads pinned to its host node, but it
+		// was stolen by some other thread. Send it back home.
+
+		unsigned int id = atomic_fetch_add_explicit(&XrSchedulingThreadRotor, 1, memory_order_relaxed);
+
+		target = &XrSchedulingThreadTable[XrNodeFirstThread[work->Node] + id % XrNodeThreadCount[work->Node]];
+	} else if (!target) {
+		unsigned int id = atomic_fetch_add_explicit(&XrSchedulingThreadRotor, 1, memory_order_relaxed);
 
-	InsertAtTailList(&XrSchedulerWorkList, &work->WorkEntry);
+		target = &XrSchedulingThreadTable[id % XrSchedulingThreadCount];
+	}
+
+	XrLockMutex(&target->WorkListMutex);
+
+	InsertAtTailList(&target->WorkList, &work->WorkEntry);
+
+	XrUnlockMutex(&target->WorkListMutex);
+
+	// Pairs with the idle thread setting Idle and then looking for work again.
 
-	XrUnlockMutex(&XrSchedulerWorkListMutex);
+	atomic_thread_fence(memory_order_seq_cst);
 
-	XrPostSemaphore(&XrSchedulerSemaphore);
+	XrWakeSchedulingThread(target);
 }
 
 void XrScheduleWorkForNextFrame(XrSchedulable *work, int front) {
@@ -93,6 +276,89 @@ void XrScheduleWorkForNextFrame(XrSchedulable *work, int front) {
 	XrUnlockMutex(&XrSchedulerNextFrameListMutex);
 }
 
+void XrScheduleWorkParked(XrSchedulable *work) {
+	// Put the work on the next frame list, but mark it as parked so that
+	// XrUnparkWork can pull it back off and run it early. The caller must check
+	// whatever it's waiting on again after this returns, and unpark it if that
+	// already happened, in case it happened before it was marked.
+
+	if (work->Enqueued) {
+		return;
+	}
+
+	work->Enqueued = 1;
+
+	XrLockMutex(&XrSchedulerNextFrameListMutex);
+
+	InsertAtTailList(&XrSchedulerNextFrameList, &work->WorkEntry);
+
+	work->Parked = 1;
+
+	XrUnlockMutex(&XrSchedulerNextFrameListMutex);
+
+#ifndef EMSCRIPTEN
+	atomic_thread_fence(memory_order_seq_cst);
+#endif
+}
+
+void XrUnparkWork(XrSchedulable *work) {
+	// Move parked work from the next frame list to the work list, if it's still
+	// there.
+
+	XrLockMutex(&XrSchedulerNextFrameListMutex);
+
+	if (!work->Parked) {
+		XrUnlockMutex(&XrSchedulerNextFrameListMutex);
+
+		return;
+	}
+
+	work->Parked = 0;
+
+	RemoveEntryList(&work->WorkEntry);
+
+	XrUnlockMutex(&XrSchedulerNextFrameListMutex);
+
+	work->Enqueued = 0;
+
+	XrScheduleWorkForAny(work);
+}
+
+int XrNextFrameWorkPending(void) {
+	// Return whether any work is waiting for the next frame other than parked
+	// work, i.e. whether a device has an operation in progress.
+
+	int pending = 0;
+
+	XrLockMutex(&XrSchedulerNextFrameListMutex);
+
+	ListEntry *listentry = XrSchedulerNextFrameList.Next;
+
+	while (listentry != &XrSchedulerNextFrameList) {
+		if (!ContainerOf(listentry, XrSchedulable, WorkEntry)->Parked) {
+			pending = 1;
+
+			break;
+		}
+
+		listentry = listentry->Next;
+	}
+
+	XrUnlockMutex(&XrSchedulerNextFrameListMutex);
+
+	return pending;
+}
+
+int XrOtherWorkWaiting(XrSchedulable *work) {
+	// Return whether anything is waiting in the run queue of the thread that is
+	// running the given work, i.e. whether it would be worth yielding to. This
+	// doesn't take the lock, so the answer is only a hint.
+
+	XrSchedulingThread *thread = work->PreferredThread;
+
+	return thread && thread->WorkList.Next != &thread->WorkList;
+}
+
 void XrScheduleWorkForMe(XrSchedulable *after, XrSchedulable *work) {
 	if (work->Enqueued) {
 		return;
@@ -104,6 +370,136 @@ void XrScheduleWorkForMe(XrSchedulable *after, XrSchedulable *work) {
 	after->PreferredThread->Next = work;
 }
 
+void XrInitializeGang(XrGang *gang) {
+	XrInitializeMutex(&gang->Lock);
+	InitializeList(&gang->WaitList);
+
+	gang->Members = 0;
+	gang->Arrived = 0;
+}
+
+static void XrReleaseGang(XrGang *gang) {
+	// Everyone has arrived, so start the next round. Called with the gang lock
+	// held, and returns with it released.
+
+	ListEntry list;
+	InitializeList(&list);
+
+	if (gang->WaitList.Next != &gang->WaitList) {
+		list.Next = gang->WaitList.Next;
+		list.Prev = gang->WaitList.Prev;
+
+		list.Next->Prev = &list;
+		list.Prev->Next = &list;
+
+		InitializeList(&gang->WaitList);
+	}
+
+	gang->Arrived = 0;
+
+	XrUnlockMutex(&gang->Lock);
+
+	ListEntry *listentry = list.Next;
+
+	while (listentry != &list) {
+		ListEntry *next = listentry->Next;
+
+		XrSchedulable *work = ContainerOf(listentry, XrSchedulable, WorkEntry);
+
+		work->Enqueued = 0;
+
+		XrScheduleWorkForAny(work);
+
+		listentry = next;
+	}
+}
+
+void XrJoinGang(XrSchedulable *work) {
+	// The work is about to run, so the rest of the gang should wait for it at
+	// the end of the round.
+
+	if (work->GangMember) {
+		return;
+	}
+
+	XrLockMutex(&work->Gang->Lock);
+
+	work->Gang->Members++;
+	work->GangMember = 1;
+
+	XrUnlockMutex(&work->Gang->Lock);
+}
+
+void XrLeaveGang(XrSchedulable *work) {
+	// The work has stopped running for now, e.g. because it halted or ran out
+	// of timeslice, so the rest of the gang shouldn't wait for it anymore.
+
+	if (!work->GangMember) {
+		return;
+	}
+
+	XrGang *gang = work->Gang;
+
+	XrLockMutex(&gang->Lock);
+
+	gang->Members--;
+	work->GangMember = 0;
+
+	if (gang->Arrived && gang->Arrived == gang->Members) {
+		// We were the last one they were waiting for.
+
+		XrReleaseGang(gang);
+
+		return;
+	}
+
+	XrUnlockMutex(&gang->Lock);
+}
+
+void XrArriveGang(XrSchedulable *work) {
+	// The work finished its quantum for this round. If it was the last one to,
+	// start the next round and keep running it on this thread. Otherwise, wait
+	// for the others.
+
+	XrGang *gang = work->Gang;
+
+	XrLockMutex(&gang->Lock);
+
+	if (gang->Arrived + 1 == gang->Members) {
+		XrReleaseGang(gang);
+
+		XrScheduleWorkForMe(work, work);
+
+		return;
+	}
+
+	gang->Arrived++;
+
+	work->Enqueued = 1;
+
+	InsertAtTailList(&gang->WaitList, &work->WorkEntry);
+
+	XrUnlockMutex(&gang->Lock);
+}
+
+void XrSchedulerCheckIdle(void) {
+	// Let virtual time advance if nothing is running or waiting to run. This
+	// is called whenever a thread runs out of work, and by the main loop in
+	// turbo mode, to get things started.
+
+	atomic_store(&XrSchedulerIdleRequested, 1);
+
+	while (atomic_load(&XrSchedulerIdleRequested) && XrTryLockMutex(&XrSchedulerIdleMutex)) {
+		atomic_store(&XrSchedulerIdleRequested, 0);
+
+		if (atomic_load(&XrSchedulerActive) == 0) {
+			XrSkipIdleTime();
+		}
+
+		XrUnlockMutex(&XrSchedulerIdleMutex);
+	}
+}
+
 void *XrSchedulerLoop(void *context) {
 	uintptr_t id = (uintptr_t)context;
 
@@ -112,7 +508,12 @@ void *XrSchedulerLoop(void *context) {
 
 	XrSchedulingThread *thread = &XrSchedulingThreadTable[id];
 
+	if (thread->HostCpu >= 0) {
+		XrPinToHostCpu(thread->HostCpu);
+	}
+
 	XrSchedulable *work = 0;
+	int running = 0;
 
 	while (1) {
 		if (!work) {
@@ -120,11 +521,27 @@ void *XrSchedulerLoop(void *context) {
 			thread->Next = 0;
 
 			if (!work) {
+				if (running) {
+					// Our chain of work ran out. If that was the last thing
+					// running or waiting to run, see whether virtual time can
+					// skip ahead to the next event.
+
+					running = 0;
+
+					if (atomic_fetch_sub_explicit(&XrSchedulerActive, 1, memory_order_acq_rel) == 1 && XrVirtualTime) {
+						XrSchedulerCheckIdle();
+					}
+				}
+
 				work = XrPopSchedulerWork(thread);
 
 				if (!work) {
 					return 0;
 				}
+
+				// The count for the work we popped now stands for us.
+
+				running = 1;
 			}
 		}
 
@@ -140,18 +557,62 @@ void *XrSchedulerLoop(void *context) {
 }
 
 void XrInitializeScheduler(int threads) {
-	InitializeList(&XrSchedulerWorkList);
 	InitializeList(&XrSchedulerNextFrameList);
 
-	XrInitializeSemaphore(&XrSchedulerSemaphore, 0);
-
-	XrInitializeMutex(&XrSchedulerWorkListMutex);
 	XrInitializeMutex(&XrSchedulerNextFrameListMutex);
+	XrInitializeMutex(&XrSchedulerIdleMutex);
+
+	for (int id = 0; id < threads; id++) {
+		XrSchedulingThread *thread = &XrSchedulingThreadTable[id];
+
+		InitializeList(&thread->WorkList);
+		XrInitializeMutex(&thread->WorkListMutex);
+		XrInitializeSemaphore(&thread->Semaphore, 0);
+
+		thread->Idle = 0;
+		thread->Node = -1;
+		thread->WaitNs = 0;
+		thread->WaitCount = 0;
+		thread->PrintedWaitNs = 0;
+		thread->PrintedWaitCount = 0;
+		thread->HostCpu = -1;
+	}
 
 	XrSchedulingThreadCount = threads;
 }
 
+static void XrAssignThreadNodes(void) {
+	// Divide the threads among the simulated nodes in proportion to how many
+	// processors they have, by giving each thread the node of the processor
+	// at the same fraction of the way through the list of processors.
+
+	for (int id = 0; id < XrSchedulingThreadCount; id++) {
+		XrSchedulingThread *thread = &XrSchedulingThreadTable[id];
+
+		int index = id * XrProcessorCount / XrSchedulingThreadCount;
+		int nodeid = 0;
+
+		while (index >= XrNumaNodes[nodeid].ProcessorCount) {
+			index -= XrNumaNodes[nodeid].ProcessorCount;
+			nodeid++;
+		}
+
+		if (!XrNodeThreadCount[nodeid]) {
+			XrNodeFirstThread[nodeid] = id;
+		}
+
+		XrNodeThreadCount[nodeid]++;
+
+		thread->Node = nodeid;
+		thread->HostCpu = XrAllocateHostCpu(nodeid);
+	}
+}
+
 void XrStartScheduler(void) {
+	if (XrPinThreads) {
+		XrAssignThreadNodes();
+	}
+
 	for (uintptr_t id = 0; id < XrSchedulingThreadCount; id++) {
 		XrSchedulingThread *thread = &XrSchedulingThreadTable[id];
 
@@ -168,8 +629,12 @@ void XrStartScheduler(void) {
 	}
 }
 
-void XrScheduleAllNextFrameWork(int dt) {
-	// Put all per-frame work on the work list.
+static void XrStartNextFrame(int dt, int skipped) {
+	// Put all per-frame work on the work list. The caller holds the idle mutex,
+	// so that XrSkipIdleTime doesn't look at the parked work while this is
+	// starting it. Skipped time is only added to the clock if some work was
+	// actually handed the time, since whatever unparked the rest of it ran it
+	// without.
 
 	ListEntry list;
 	InitializeList(&list);
@@ -179,6 +644,17 @@ void XrScheduleAllNextFrameWork(int dt) {
 	XrLockMutex(&XrSchedulerNextFrameListMutex);
 
 	if (XrSchedulerNextFrameList.Next != &XrSchedulerNextFrameList) {
+		// Anything parked is about to run anyway, and can't be unparked once
+		// it's off of the next frame list.
+
+		ListEntry *listentry = XrSchedulerNextFrameList.Next;
+
+		while (listentry != &XrSchedulerNextFrameList) {
+			ContainerOf(listentry, XrSchedulable, WorkEntry)->Parked = 0;
+
+			listentry = listentry->Next;
+		}
+
 		list.Next = XrSchedulerNextFrameList.Next;
 		list.Prev = XrSchedulerNextFrameList.Prev;
 
@@ -190,6 +666,16 @@ void XrScheduleAllNextFrameWork(int dt) {
 
 	XrUnlockMutex(&XrSchedulerNextFrameListMutex);
 
+	if (skipped) {
+		if (list.Next == &list) {
+			return;
+		}
+
+		RTCSkipTime(dt);
+	}
+
+	atomic_fetch_add_explicit(&XrSchedulerElapsedMs, dt, memory_order_relaxed);
+
 	// Call the start timeslice callback.
 
 	ListEntry *listentry = list.Next;
@@ -217,4 +703,48 @@ void XrScheduleAllNextFrameWork(int dt) {
 
 		listentry = next;
 	}
-}
\ No newline at end of file
+}
+
+void XrScheduleAllNextFrameWork(int dt) {
+	// Called by the main loop to start the next frame.
+
+	XrLockMutex(&XrSchedulerIdleMutex);
+
+	XrStartNextFrame(dt, 0);
+
+	XrUnlockMutex(&XrSchedulerIdleMutex);
+
+	// A thread that went idle while we held the mutex left its request for
+	// whoever held it.
+
+	if (atomic_load(&XrSchedulerIdleRequested)) {
+		XrSchedulerCheckIdle();
+	}
+}
+
+void XrScheduleSkippedFrameWork(int dt) {
+	// Called by XrSkipIdleTime, with the idle mutex held, to start a frame of
+	// dt milliseconds of virtual time early.
+
+	XrStartNextFrame(dt, 1);
+}
+
+void XrPrintSchedulerStats(void) {
+	// Print how long each scheduling thread spent waiting for work since the
+	// last time. A thread that hardly ever waits is a sign that more of them
+	// would help.
+
+	for (int i = 0; i < XrSchedulingThreadCount; i++) {
+		XrSchedulingThread *thread = &XrSchedulingThreadTable[i];
+
+		uint64_t waitns = thread->WaitNs;
+		uint64_t waitcount = thread->WaitCount;
+
+		fprintf(stderr, "thread %d: waited for work %llu times, %llu us\n", i,
+			(unsigned long long)(waitcount - thread->PrintedWaitCount),
+			(unsigned long long)(waitns - thread->PrintedWaitNs) / 1000);
+
+		thread->PrintedWaitNs = waitns;
+		thread->PrintedWaitCount = waitcount;
+	}
+}
@@ -5,6 +5,8 @@
 #include "fastmutex.h"
 #include "queue.h"
 
+#include <stdatomic.h>
+
 typedef struct _XrSchedulable XrSchedulable;
 
 typedef void (*XrSchedulableF)(XrSchedulable *schedulable);
@@ -12,6 +14,8 @@ typedef void (*XrStartTimesliceF)(XrSchedulable *schedulable, int dt);
 
 typedef struct _XrSchedulingThread XrSchedulingThread;
 
+typedef struct _XrGang XrGang;
+
 struct _XrSchedulable {
 	ListEntry WorkEntry;
 	XrSchedulable *Next;
@@ -21,6 +25,21 @@ struct _XrSchedulable {
 	void *Context;
 	int Timeslice;
 	int Enqueued;
+	volatile int Parked;
+	int Node;
+	XrGang *Gang;
+	int GangMember;
+};
+
+struct _XrGang {
+	// A set of schedulables that run in lockstep rounds. Each member that is
+	// runnable arrives at the end of its quantum, and waits on the list until
+	// the rest have arrived, at which point they all go again.
+
+	XrMutex Lock;
+	ListEntry WaitList;
+	int Members;
+	int Arrived;
 };
 
 static inline void XrInitializeSchedulable(XrSchedulable *schedulable, XrSchedulableF func, XrStartTimesliceF starttimeslice, void *context) {
@@ -31,20 +50,64 @@ static inline void XrInitializeSchedulable(XrSchedulable *schedulable, XrSchedul
 	schedulable->Next = 0;
 	schedulable->PreferredThread = 0;
 	schedulable->Enqueued = 0;
+	schedulable->Parked = 0;
+	schedulable->Node = -1;
+	schedulable->Gang = 0;
+	schedulable->GangMember = 0;
 }
 
 extern void XrInitializeScheduler(int threads);
 
 extern void XrScheduleAllNextFrameWork(int dt);
 
+extern void XrScheduleSkippedFrameWork(int dt);
+
 extern void XrScheduleWorkForAny(XrSchedulable *work);
 
 extern void XrScheduleWorkForNextFrame(XrSchedulable *work, int front);
 
 extern void XrScheduleWorkForMe(XrSchedulable *after, XrSchedulable *work);
 
+extern int XrNextFrameWorkPending(void);
+
+extern int XrOtherWorkWaiting(XrSchedulable *work);
+
+extern void XrSchedulerCheckIdle(void);
+
+extern void XrScheduleWorkParked(XrSchedulable *work);
+
+extern void XrUnparkWork(XrSchedulable *work);
+
+static inline void XrWakeWork(XrSchedulable *work) {
+	// Called after making true some condition that a parked schedulable might
+	// be waiting on. The fence pairs with the one in XrScheduleWorkParked, so
+	// that either the parker sees the condition or we see it parked.
+
+#ifndef EMSCRIPTEN
+	atomic_thread_fence(memory_order_seq_cst);
+#endif
+
+	if (work->Parked) {
+		XrUnparkWork(work);
+	}
+}
+
+extern void XrInitializeGang(XrGang *gang);
+
+extern void XrJoinGang(XrSchedulable *work);
+
+extern void XrLeaveGang(XrSchedulable *work);
+
+extern void XrArriveGang(XrSchedulable *work);
+
 extern void XrStartScheduler(void);
 
 extern void *XrSchedulerLoop(void *context);
 
+extern _Atomic uint64_t XrSchedulerElapsedMs;
+
+extern void XrPrintSchedulerStats(void);
+
+extern uint64_t XrHostTimeNs(void);
+
 #endif // XR_SCHEDULER_H
\ No newline at end of file
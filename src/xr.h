@@ -100,6 +100,11 @@
 
 #define XR_PAUSE_MAX 256
 
+// Number of times in a row a side-effect-free spin loop can go around before
+// the rest of the timeslice is skipped and yielded to another CPU.
+
+#define XR_SPIN_MAX 256
+
 #define XR_CACHE_MUTEXES 256
 
 #define XR_IC_SET_NUMBER(tag) ((tag >> XR_IC_LINE_SIZE_LOG) & (XR_IC_SETS - 1))
@@ -129,29 +134,111 @@ extern XrClaimTableEntry XrL2ClaimTable[XR_L2_CLAIM_TABLE_SIZE];
 
 #define XR_IBLOCK_DTB_CACHE_INDEX(address) ((address >> 12) & (XR_IBLOCK_DTB_CACHE_SIZE - 1))
 
+// The first loads and stores in each Iblock are also given a translation
+// cache entry of their own, whose slot number is kept in Imm8_3, so that they
+// don't collide with each other when they touch pages whose numbers share the
+// low bits. Any beyond that, and LL/SC, use the Iblock-wide caches above.
+
+#define XR_IBLOCK_INST_DTB_SLOTS 8
+#define XR_INST_DTB_NONE 255
+
 // XR_IBLOCK_INSTS should be defined as a multiple of the Icache line size,
 // because the instruction decode logic fetches lines at a time.
 
 #define XR_IBLOCK_INSTS_LOG 3
-#define XR_IBLOCK_HASH_BUCKETS 256
-#define XR_IBLOCK_COUNT 2048
+#define XR_IBLOCK_COUNT_DEFAULT 2048
 #define XR_IBLOCK_RECLAIM 32
 
 #define XR_VPN_BUCKETS 32
 #define XR_VPN_BUCKET_INDEX(pc) ((pc >> 12) & (XR_VPN_BUCKETS - 1))
 
+#define XR_PFN_BUCKETS 32
+#define XR_PFN_BUCKET_INDEX(phys) ((phys >> 12) & (XR_PFN_BUCKETS - 1))
+
 #define XR_IBLOCK_CACHEDBY_MAX 4
 
+// Limits on how far an Iblock can be extended into a trace: the number of
+// separate runs of guest code it can contain, the number of distinct virtual
+// pages those runs can reside within, and the number of guards on biased
+// branches that can exit it early. Traces are only formed when caches aren't
+// being simulated.
+
+#ifdef FASTMEMORY
+#define XR_TRACE_SEGMENTS 4
+#define XR_TRACE_PAGES 2
+#define XR_TRACE_GUARDS 4
+#else
+#define XR_TRACE_SEGMENTS 1
+#define XR_TRACE_PAGES 1
+#endif
+
+// Number of executions of a conditional branch which are profiled before
+// deciding whether it's biased enough to trace through, and the number of
+// side exits taken from a trace before it's considered a bad guess.
+
+#define XR_TRACE_PROFILE 64
+#define XR_TRACE_EXIT_LIMIT 128
+
+#define XR_BRANCH_BIAS_ENTRIES 256
+#define XR_BRANCH_BIAS_INDEX(pc) (((pc) >> 2) & (XR_BRANCH_BIAS_ENTRIES - 1))
+
+// Number of times an Iblock is dispatched before it is handed to the native
+// code tier, and the size of each processor's native code arena.
+
+#define XR_JIT_THRESHOLD 64
+#define XR_JIT_ARENA_SIZE (4 * 1024 * 1024)
+
+#ifdef XR_JIT
+#if !defined(__x86_64__) || defined(EMSCRIPTEN)
+#error "The native code tier is only supported on x86-64 hosts."
+#endif
+#endif
+
 // Don't modify this XR_IBLOCK_INSTS, modify XR_IBLOCK_INSTS_LOG.
 
 #define XR_IBLOCK_INSTS ((XR_IC_LINE_SIZE >> 2) << XR_IBLOCK_INSTS_LOG)
 #define XR_IBLOCK_INSTS_BYTES (XR_IBLOCK_INSTS * 4)
 
-#define XR_IBLOCK_HASH(pc) ((pc >> 2) & (XR_IBLOCK_HASH_BUCKETS - 1))
+// The Iblock lookup table is open-addressed with linear probing, and has at
+// least twice as many entries as there are Iblocks so that probe sequences
+// stay short. The tag of each entry is stored inline so that a probe doesn't
+// have to touch the Iblock itself.
+
+#define XR_IBLOCK_HASH(pc, asid) ((((pc) >> 2) ^ ((asid) >> 20)) * 0x9E3779B1)
+
+// The jump cache is a small direct-mapped cache of recently looked up Iblocks
+// which is consulted before the lookup table.
+
+#define XR_JUMP_CACHE_ENTRIES 1024
+#define XR_JUMP_CACHE_INDEX(pc) (((pc) >> 2) & (XR_JUMP_CACHE_ENTRIES - 1))
+
+// With the shared code store, decoded instructions are kept in a pool common
+// to all processors, so each processor only needs private instructions for the
+// Iblocks that can't be shared, and gets XR_PRIVATE_CODE_DIVISOR times fewer
+// chunks to hold them. The store itself holds XR_SHARED_CODE_FACTOR entries
+// per Iblock that any one processor may have.
+
+#define XR_PRIVATE_CODE_DIVISOR 4
+#define XR_SHARED_CODE_FACTOR 2
+
+// Private instructions are stored in chunks of a few size classes, each of
+// which is carved out of its own slab, so that short Iblocks don't take up as
+// much room as long ones.
+
+#define XR_CODE_CLASSES 4
+#define XR_CODE_CLASS_NONE 0xFF
 
 typedef struct _XrProcessor XrProcessor;
 typedef struct _XrIblock XrIblock;
 typedef struct _XrCachedInst XrCachedInst;
+typedef struct _XrSharedCode XrSharedCode;
+typedef struct _XrIblockCold XrIblockCold;
+
+typedef struct _XrIblockTableEntry {
+	uint32_t Pc;
+	uint32_t Key;
+	XrIblock *Iblock;
+} XrIblockTableEntry;
 
 #define XR_JALR_PREDICTION_TABLE_ENTRIES 8
 
@@ -167,6 +254,13 @@ typedef struct _XrVirtualPage {
 	uint32_t References;
 } XrVirtualPage;
 
+typedef struct _XrPhysicalPage {
+	ListEntry PfnHashEntry;
+	ListEntry IblockPfnList;
+	uint32_t Pfn;
+	uint32_t References;
+} XrPhysicalPage;
+
 typedef void (*XrInstImplF XR_PRESERVE_NONE)(XrProcessor *proc, XrIblock *block, XrCachedInst *inst);
 
 struct _XrCachedInst {
@@ -174,8 +268,95 @@ struct _XrCachedInst {
 	uint32_t Imm32_1;
 	uint8_t Imm8_1;
 	uint8_t Imm8_2;
+	uint8_t Imm8_3;
+
+	// Index of the corresponding guest instruction within the Iblock in the
+	// low 6 bits, and the trace segment it belongs to in the upper 2 bits.
+
+	uint8_t PcOffset;
 };
 
+#define XR_PC_OFFSET(segment, index) (((segment) << 6) | (index))
+#define XR_PC_OFFSET_SEGMENT(offset) ((offset) >> 6)
+#define XR_PC_OFFSET_INDEX(offset) ((offset) & 63)
+
+typedef struct _XrCodeBuffer {
+	// TWO extra instructions: One is reserved for if a real instruction decodes
+	// into two virtual instructions (happens for example with inline shifts),
+	// to avoid special casing if there's no room for the virtual instruction.
+	// The second is for the special linkage instruction placed at the end of a
+	// basic block that doesn't otherwise terminate naturally. Both slots are
+	// needed for the case where both of these situations occur.
+
+	XrCachedInst Insts[XR_IBLOCK_INSTS + 2];
+
+	// Links the buffer into the free list when it isn't in use.
+
+	struct _XrCodeBuffer *NextFree;
+} XrCodeBuffer;
+
+#ifdef FASTMEMORY
+
+// An entry in the shared code store. The instructions are never modified once
+// the entry is published, so any processor may execute them without locking.
+// Every Iblock that refers to the entry holds a reference on it, as does the
+// store while the entry can be found there, so an entry that is invalidated
+// isn't reused until every processor has let go of it.
+
+struct _XrSharedCode {
+	XrCodeBuffer Code;
+
+	_Atomic uint32_t References;
+
+	uint32_t PcBias[XR_TRACE_SEGMENTS];
+
+	// The PC of the conditional branch that ends the code, if it's
+	// extendable.
+
+	uint32_t ExtendPc;
+
+	uint8_t Cycles;
+	uint8_t InstCount;
+	uint8_t SegmentCount;
+	uint8_t GuardCount;
+	uint8_t Extendable;
+};
+
+// The store is an open-addressed table like the per-processor Iblock lookup
+// table, keyed by PC and the page frame and PTE flags the code was fetched
+// from.
+
+typedef struct _XrSharedCodeEntry {
+	uint32_t Pc;
+	uint32_t Key;
+	XrSharedCode *Code;
+} XrSharedCodeEntry;
+
+#endif
+
+// Links an Iblock into the lists of a virtual page that it contains code from,
+// and of the physical page frame which that code was fetched from.
+
+typedef struct _XrIblockPageLink {
+	ListEntry Entry;
+	XrVirtualPage *Vpage;
+	ListEntry PfnEntry;
+	XrPhysicalPage *Ppage;
+	XrIblock *Iblock;
+} XrIblockPageLink;
+
+#ifdef FASTMEMORY
+
+// Remembers which direction a conditional branch at a given PC was found to
+// be biased towards.
+
+typedef struct _XrBranchBias {
+	uint32_t Pc;
+	uint32_t Taken;
+} XrBranchBias;
+
+#endif
+
 #define XR_INVALID_DTB_INDEX 0xFFFFFFFF
 
 typedef struct _XrIblockDtbEntry {
@@ -184,24 +365,47 @@ typedef struct _XrIblockDtbEntry {
 	uint64_t *DtbePointer;
 } XrIblockDtbEntry;
 
+// The soft TLB is a direct-mapped cache of the translations in the DTB, indexed
+// by VPN, which is consulted when a load or store misses the Iblock's DTB
+// cache. Each entry is tagged with the ASID and VPN it was looked up with, plus
+// the user mode bit of RS, so that a hit needs no further checks. The write tag
+// is only valid if the page is writable. Entries are removed whenever the DTB
+// entry they came from is replaced or invalidated.
+
+#define XR_SOFT_TLB_SIZE_LOG 11
+#define XR_SOFT_TLB_SIZE (1 << XR_SOFT_TLB_SIZE_LOG)
+
+#define XR_SOFT_TLB_INDEX(vpn) ((vpn) & (XR_SOFT_TLB_SIZE - 1))
+
+#define XR_SOFT_TLB_INVALID 0xFFFFFFFFFFFFFFFF
+
+typedef struct _XrSoftTlbEntry {
+	uint64_t ReadTag;
+	uint64_t WriteTag;
+	XrIblockDtbEntry Entry;
+} XrSoftTlbEntry;
+
 #define XR_TRUE_PATH 0
 #define XR_FALSE_PATH 1
 
 #define XR_CACHED_PATH_MAX 2
 
-struct _XrIblock {
-#ifdef FASTMEMORY
-	XrIblockDtbEntry DtbLoadCache[XR_IBLOCK_DTB_CACHE_SIZE];
-	XrIblockDtbEntry DtbStoreCache[XR_IBLOCK_DTB_CACHE_SIZE];
-#endif
+// The bookkeeping for an Iblock that's only needed when it's created,
+// looked up in the table, or destroyed. This is kept out of line so that the
+// Iblocks themselves pack more densely into the host's caches.
 
-	ListEntry VpageEntry;
-	ListEntry HashEntry;
+struct _XrIblockCold {
 	ListEntry LruEntry;
 
-	XrVirtualPage *Vpage;
+	// Points back to the Iblock.
 
-	XrIblock *CachedPaths[XR_CACHED_PATH_MAX];
+	XrIblock *Iblock;
+
+	// Links the Iblock into the free list when it isn't in use.
+
+	XrIblock *NextFree;
+
+	XrIblockPageLink PageLinks[XR_TRACE_PAGES];
 
 	// The CachedBy array stores a list of backpointers to pointers to this
 	// block. When this block is invalidated, we can iterate this array and
@@ -211,21 +415,84 @@ struct _XrIblock {
 
 	XrIblock **CachedBy[XR_IBLOCK_CACHEDBY_MAX];
 
+#ifdef FASTMEMORY
+	XrSharedCode *Shared;
+#endif
+
 	uint32_t Pc;
+
+	// The Iblock is looked up by its PC and key. The key is normally the
+	// ASID, but with shared Iblocks it's the page frame and PTE flags that the
+	// Iblock was fetched from, in which case Asid records the address space
+	// in which that was most recently found to still be true.
+
+	uint32_t Key;
+
+	uint8_t CachedByFifoIndex;
+	uint8_t HasPtable;
+	uint8_t PageCount;
+
+	// The size class of the Iblock's private instructions, or
+	// XR_CODE_CLASS_NONE if it executes shared ones.
+
+	uint8_t CodeClass;
+};
+
+struct _XrIblock {
+	// The fields up to and including Cold are touched whenever the Iblock is
+	// executed, and fit in 64 bytes.
+
+	// The decoded instructions. These are either in a chunk private to the
+	// processor, or in an entry of the shared code store.
+
+	XrCachedInst *Insts;
+
+	XrIblock *CachedPaths[XR_CACHED_PATH_MAX];
+
+	// The PC of the instruction with index 0 in each segment, such that the PC
+	// of any instruction is PcBias[segment] + index * 4.
+
+	uint32_t PcBias[XR_TRACE_SEGMENTS];
+
 	uint32_t Asid;
 	uint8_t Cycles;
-	uint8_t CachedByFifoIndex;
+
+	// Number of instruction slots in use, including the one that terminates
+	// the basic block.
+
+	uint8_t InstCount;
+
+#ifdef FASTMEMORY
+	uint8_t SegmentCount;
+	uint8_t GuardCount;
+
+	// Set if the Iblock ends in a conditional branch that it could be extended
+	// past, in which case the branch is profiled to see if it's biased.
+
+	uint8_t Extendable;
+	uint8_t ProfileCount;
+	uint8_t TakenCount;
+	uint8_t SideExitCount;
+#endif
+
 	uint8_t PteFlags;
-	uint8_t HasPtable;
 
-	// TWO extra instructions: One is reserved for if a real instruction decodes
-	// into two virtual instructions (happens for example with inline shifts),
-	// to avoid special casing if there's no room for the virtual instruction.
-	// The second is for the special linkage instruction placed at the end of a
-	// basic block that doesn't otherwise terminate naturally. Both slots are
-	// needed for the case where both of these situations occur.
+#ifdef XR_JIT
+	uint8_t Native;
+	uint16_t Heat;
+#endif
 
-	XrCachedInst Insts[XR_IBLOCK_INSTS + 2];
+	XrIblockCold *Cold;
+
+#ifdef FASTMEMORY
+	// Cached pointers to the Iblocks at the cold targets of each guard.
+
+	XrIblock *SideExits[XR_TRACE_GUARDS];
+
+	XrIblockDtbEntry DtbLoadCache[XR_IBLOCK_DTB_CACHE_SIZE];
+	XrIblockDtbEntry DtbStoreCache[XR_IBLOCK_DTB_CACHE_SIZE];
+	XrIblockDtbEntry InstDtbCache[XR_IBLOCK_INST_DTB_SLOTS];
+#endif
 };
 
 enum XrFakeRegisters {
@@ -250,6 +517,18 @@ enum XrFakeRegisters {
 
 #endif
 
+// Running totals for -statsprint. Everything is in milliseconds of simulated
+// time, except HostNs, which is the host time spent executing the milliseconds
+// counted in MsExecuted.
+
+typedef struct _XrProcessorStats {
+	uint64_t MsRequested;
+	uint64_t MsExecuted;
+	uint64_t MsParked;
+	uint64_t MsDropped;
+	uint64_t HostNs;
+} XrProcessorStats;
+
 struct _XrProcessor {
 	uint64_t Itb[XR_ITB_SIZE];
 	uint64_t Dtb[XR_DTB_SIZE];
@@ -262,6 +541,7 @@ struct _XrProcessor {
 #ifdef FASTMEMORY
 	XrIblockDtbEntry DtbLastEntry;
 	XrClaimTableEntry L1ClaimTable[XR_L1_CLAIM_TABLE_SIZE];
+	XrSoftTlbEntry SoftTlb[XR_SOFT_TLB_SIZE];
 #else
 	uint32_t DtbLastResult;
 #endif
@@ -275,9 +555,16 @@ struct _XrProcessor {
 	XrIblock *IblockFreeList;
 	XrJalrPredictionTable *PtableFreeList;
 	XrVirtualPage *VpageFreeList;
+	XrPhysicalPage *PpageFreeList;
+	void *CodeFreeLists[XR_CODE_CLASSES];
 
 	ListEntry IblockLruList;
-	ListEntry IblockHashBuckets[XR_IBLOCK_HASH_BUCKETS];
+
+	XrIblockTableEntry *IblockTable;
+	uint32_t IblockTableMask;
+	uint32_t IblockTableShift;
+
+	XrIblockTableEntry JumpCache[XR_JUMP_CACHE_ENTRIES];
 
 #if XR_SIMULATE_CACHES
 	uint32_t IcTags[XR_IC_LINE_COUNT];
@@ -305,10 +592,21 @@ struct _XrProcessor {
 	uint32_t CyclesDone;
 	uint32_t CyclesGoal;
 	uint32_t PauseCalls;
+	uint32_t SpinCount;
 	uint32_t CyclesThisRound;
+	uint32_t QuantumCycles;
+	uint32_t QuantumEvents;
+
+	XrProcessorStats Stats;
 
 	XrSchedulable Schedulable;
 
+#ifdef XR_JIT
+	uint8_t *JitArena;
+	uint32_t JitArenaUsed;
+	uint32_t JitFlushPending;
+#endif
+
 #if XR_SIMULATE_CACHES
 	uint32_t IcReplacementIndex;
 	uint32_t DcReplacementIndex;
@@ -321,6 +619,22 @@ struct _XrProcessor {
 	uint32_t IcMissCount;
 	uint32_t IcHitCount;
 
+	uint32_t FusedBranchCount;
+	uint32_t FusedConstantCount;
+	uint32_t FusedAbsoluteCount;
+
+	uint32_t TraceGuardCount;
+	uint32_t TraceExitCount;
+
+	uint32_t OptimizedFoldCount;
+	uint32_t OptimizedDeadCount;
+	uint32_t DirectAccessCount;
+	uint32_t DtbCacheHitCount;
+	uint32_t DtbCacheMissCount;
+	uint32_t SoftTlbHitCount;
+	uint32_t SoftTlbMissCount;
+	uint32_t SpinSkipCount;
+
 	int32_t TimeToNextPrint;
 #endif
 
@@ -344,10 +658,38 @@ struct _XrProcessor {
 	uint8_t NoMore;
 
 	ListEntry VpageHashBuckets[XR_VPN_BUCKETS];
+	ListEntry PpageHashBuckets[XR_PFN_BUCKETS];
+
+#ifdef FASTMEMORY
+	XrBranchBias BranchBias[XR_BRANCH_BIAS_ENTRIES];
+#endif
+
+	// Instructions are decoded here, and then copied to a chunk of the right
+	// size once the length of the Iblock is known.
+
+	XrCodeBuffer DecodeBuffer;
 };
 
 extern uint8_t XrPrintCache;
 
+extern uint8_t XrPrintStats;
+
+extern uint32_t XrIblockCount;
+
+extern uint8_t XrSharedIblocks;
+
+extern uint8_t XrSharedCodeStore;
+
+extern uint8_t XrVirtualTime;
+
+extern uint8_t XrTurbo;
+
+#define XR_GANG_NONE 0
+#define XR_GANG_SYSTEM 1
+#define XR_GANG_NODE 2
+
+extern uint8_t XrGangScheduling;
+
 extern int XrProcessorCount;
 
 extern XrProcessor *XrProcessorTable[XR_PROC_MAX];
@@ -357,6 +699,10 @@ extern int XrExecuteFast(XrProcessor *proc, uint32_t cycles, uint32_t dt);
 
 extern void XrInitializeProcessors(void);
 
+extern void XrSkipIdleTime(void);
+
+extern void XrPrintProcessorStats(void);
+
 extern long XrProcessorFrequency;
 
 #if XR_SIMULATE_CACHES
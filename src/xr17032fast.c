@@ -87,6 +87,7 @@
 //    handling).
 //
 //
+//    DONE
 // 8. Decode with a small peephole window rather than a single instruction at a
 //    time, and collapse common idioms such as
 //
@@ -115,6 +116,7 @@
 //    other hand have a constant overhead even when shamt == 0.
 //
 //
+//    DONE
 //10. The proc->Pc += 4 that regularly appears can be replaced by an on-demand
 //    calculation of the current program counter as 
 //
@@ -122,14 +124,34 @@
 //
 //    and other appropriate calculations.
 
+#ifdef XR_JIT
+// For MAP_ANONYMOUS under -std=c99.
+
+#define _DEFAULT_SOURCE
+#endif
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <pthread.h>
 #include <sched.h>
 
+#ifdef FASTMEMORY
+#include <stdatomic.h>
+#endif
+
+#ifdef XR_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "xr.h"
 #include "lsic.h"
 #include "ebus.h"
@@ -141,6 +163,46 @@ long XrProcessorFrequency = 20000000;
 
 XrProcessor *XrProcessorTable[XR_PROC_MAX];
 
+uint8_t XrPrintCache = 0;
+
+uint8_t XrPrintStats = 0;
+
+uint32_t XrIblockCount = XR_IBLOCK_COUNT_DEFAULT;
+
+uint8_t XrSharedIblocks = 0;
+
+uint8_t XrSharedCodeStore = 0;
+
+uint8_t XrVirtualTime = 0;
+
+uint8_t XrTurbo = 0;
+
+uint8_t XrGangScheduling = XR_GANG_NONE;
+
+// The gangs that processors are put in for gang scheduling: either just the
+// first for the whole system, or one for each NUMA node.
+
+XrGang XrProcessorGangs[XR_NODE_MAX];
+
+#ifdef FASTMEMORY
+
+// The shared code store. The lock is only taken when a processor fails to find
+// an Iblock in its own cache, or when code is invalidated. The epoch is bumped
+// on every invalidation so that code decoded from memory that was modified
+// meanwhile is never published.
+
+XrSharedCodeEntry *XrSharedCodeTable;
+uint32_t XrSharedCodeTableMask;
+uint32_t XrSharedCodeTableShift;
+uint32_t XrSharedCodeSweepIndex;
+uint32_t XrSharedCodeEpoch;
+
+XrSharedCode *XrSharedCodeFreeList;
+
+XrMutex XrSharedCodeLock;
+
+#endif
+
 #if XR_SIMULATE_CACHES && !SINGLE_THREAD_MP
 
 XrMutex XrScacheMutexes[XR_CACHE_MUTEXES];
@@ -149,6 +211,25 @@ XrMutex XrScacheMutexes[XR_CACHE_MUTEXES];
 
 #define XR_STEP_MS 17 // 60Hz rounded up
 
+// The most virtual time to skip at once. This has to stay under the point
+// where XrProcessorStartTimeslice decides the threads are running behind.
+
+#define XR_VIRTUAL_SKIP_MAX (XR_STEP_MS * 32)
+
+// The amount of virtual time given to each processor at once in turbo mode.
+// This is shorter than a frame so that processors waiting on each other don't
+// have to wait as long.
+
+#define XR_TURBO_STEP_MS 4
+
+// Bounds on the number of cycles a processor executes at once in
+// XrProcessorSchedule, as a fraction and a multiple of a millisecond. The
+// quantum shrinks towards the minimum while the processor keeps getting
+// disturbed by other processors, and grows towards the maximum while it isn't.
+
+#define XR_QUANTUM_MIN_SHIFT 4
+#define XR_QUANTUM_MAX_MS 8
+
 #if DBG
 
 #define DBGPRINT(...) printf(__VA_ARGS__)
@@ -218,22 +299,26 @@ static inline uint32_t RoR(uint32_t x, uint32_t n) {
 #define DTBADDR 29
 
 static inline void XrInvalidateIblockPointers(XrIblock *iblock) {
+	XrIblockCold *cold = iblock->Cold;
+
 	for (int i = 0; i < XR_IBLOCK_CACHEDBY_MAX; i++) {
-		if (iblock->CachedBy[i] && *iblock->CachedBy[i] == iblock) {
-			*iblock->CachedBy[i] = 0;
+		if (cold->CachedBy[i] && *cold->CachedBy[i] == iblock) {
+			*cold->CachedBy[i] = 0;
 		}
 	}
 }
 
 static inline void XrCreateCachedPointerToBlock(XrIblock *iblock, XrIblock **ptr) {
-	int index = (iblock->CachedByFifoIndex++) & (XR_IBLOCK_CACHEDBY_MAX - 1);
+	XrIblockCold *cold = iblock->Cold;
+
+	int index = (cold->CachedByFifoIndex++) & (XR_IBLOCK_CACHEDBY_MAX - 1);
 
-	if (iblock->CachedBy[index] && *iblock->CachedBy[index] == iblock) {
-		*iblock->CachedBy[index] = 0;
+	if (cold->CachedBy[index] && *cold->CachedBy[index] == iblock) {
+		*cold->CachedBy[index] = 0;
 	}
 
 	*ptr = iblock;
-	iblock->CachedBy[index] = ptr;
+	cold->CachedBy[index] = ptr;
 }
 
 static inline XrJalrPredictionTable *XrAllocatePtable(XrProcessor *proc) {
@@ -258,8 +343,9 @@ static inline void XrFreePtable(XrProcessor *proc, XrJalrPredictionTable *ptable
 }
 
 static inline XrVirtualPage *XrAllocateVpage(XrProcessor *proc) {
-	// There are as many Vpages as Iblocks, so since the caller got an Iblock,
-	// we don't need to check if there are free Vpages.
+	// There are as many Vpages as there are page links in all of the Iblocks,
+	// so since the caller has a free page link, we don't need to check if there
+	// are free Vpages.
 
 	XrVirtualPage *vpage = proc->VpageFreeList;
 	proc->VpageFreeList = (void *)vpage->VpnHashEntry.Next;
@@ -274,1588 +360,1560 @@ static inline void XrFreeVpage(XrProcessor *proc, XrVirtualPage *vpage) {
 	proc->VpageFreeList = vpage;
 }
 
-static inline void XrFreeIblock(XrProcessor *proc, XrIblock *iblock) {
-	// Remove from the LRU list.
+static inline XrPhysicalPage *XrAllocatePpage(XrProcessor *proc) {
+	// There are as many Ppages as Vpages, so this can't fail either.
 
-	RemoveEntryList(&iblock->LruEntry);
+	XrPhysicalPage *ppage = proc->PpageFreeList;
+	proc->PpageFreeList = (void *)ppage->PfnHashEntry.Next;
 
-	// Remove from the hash table.
+	return ppage;
+}
 
-	RemoveEntryList(&iblock->HashEntry);
+static inline void XrFreePpage(XrProcessor *proc, XrPhysicalPage *ppage) {
+	// Insert in the free list.
 
-	// Remove from the Vpage list.
+	ppage->PfnHashEntry.Next = (void *)proc->PpageFreeList;
+	proc->PpageFreeList = ppage;
+}
 
-	RemoveEntryList(&iblock->VpageEntry);
+// The number of instruction slots in a chunk of each size class, and the
+// number of chunks of each size class in sixteenths of the number of Iblocks.
 
-	// Decrement the Vpage's reference count and delete it if this was the final
-	// Iblock within the virtual page.
+static const uint8_t XrCodeClassSlots[XR_CODE_CLASSES] = { 4, 8, 16, XR_IBLOCK_INSTS + 2 };
+static const uint8_t XrCodeClassShare[XR_CODE_CLASSES] = { 8, 4, 4, 4 };
 
-	if (--iblock->Vpage->References == 0) {
-		RemoveEntryList(&iblock->Vpage->VpnHashEntry);
+static inline XrCachedInst *XrTryAllocateCode(XrProcessor *proc, int count, int *class) {
+	// Pop a chunk from the free list of the smallest size class that has one
+	// with room for the given number of instruction slots. Returns 0 if there
+	// is none.
 
-		XrFreeVpage(proc, iblock->Vpage);
-	}
+	for (int i = 0; i < XR_CODE_CLASSES; i++) {
+		XrCachedInst *chunk = proc->CodeFreeLists[i];
 
-	// Free Ptable.
+		if (chunk && XrCodeClassSlots[i] >= count) {
+			proc->CodeFreeLists[i] = *(void **)chunk;
+			*class = i;
 
-	if (iblock->HasPtable) {
-		XrFreePtable(proc, (void *)iblock->CachedPaths[0]);
+			return chunk;
+		}
 	}
 
+	return 0;
+}
+
+static inline void XrFreeCode(XrProcessor *proc, XrCachedInst *chunk, int class) {
 	// Insert in the free list.
 
-	iblock->HashEntry.Next = (void *)proc->IblockFreeList;
-	proc->IblockFreeList = (void *)iblock;
+	*(void **)chunk = proc->CodeFreeLists[class];
+	proc->CodeFreeLists[class] = chunk;
 }
 
-static void XrPopulateIblockList(XrProcessor *proc, XrIblock *hazard) {
-	// The Iblock free list is empty. We need to repopulate by striking down
-	// some active ones from the tail of the LRU list. The hazard pointer
-	// parameter is provided to specify an Iblock which may not be reclaimed.
-	// This is usually an Iblock currently in use by a caller whose invalidation
-	// at this time would cause problems.
-	//
-	// We know that there are at least XR_IBLOCK_RECLAIM Iblocks on the LRU list
-	// because all active Iblocks are on the LRU list, all Iblocks are currently
-	// active, and there are more than XR_IBLOCK_RECLAIM total Iblocks.
-
-	// Get a pointer to the Iblock on the tail of the LRU list.
+static inline void XrInsertIblockInTable(XrProcessor *proc, XrIblock *iblock) {
+	// Insert the Iblock in the lookup table. The caller guarantees that there
+	// isn't already an Iblock with the same PC and key.
 
-	ListEntry *listentry = proc->IblockLruList.Prev;
+	XrIblockCold *cold = iblock->Cold;
 
-	for (int i = 0; i < XR_IBLOCK_RECLAIM; i++) {
-		XrIblock *iblock = ContainerOf(listentry, XrIblock, LruEntry);
+	uint32_t index = XR_IBLOCK_HASH(cold->Pc, cold->Key) >> proc->IblockTableShift;
 
-		if (hazard != iblock) {
-			// Invalidate the pointers to this Iblock.
+	while (proc->IblockTable[index].Iblock) {
+		index = (index + 1) & proc->IblockTableMask;
+	}
 
-			XrInvalidateIblockPointers(iblock);
+	XrIblockTableEntry *entry = &proc->IblockTable[index];
 
-			// Free the Iblock. Note that this doesn't modify the LRU list links
-			// so we don't need to stash them.
+	entry->Pc = cold->Pc;
+	entry->Key = cold->Key;
+	entry->Iblock = iblock;
+}
 
-			XrFreeIblock(proc, iblock);
-		}
+static inline void XrRemoveIblockFromTable(XrProcessor *proc, XrIblock *iblock) {
+	// Find the Iblock's entry in the lookup table.
 
-		// Advance to the previous Iblock.
+	uint32_t mask = proc->IblockTableMask;
+	uint32_t index = XR_IBLOCK_HASH(iblock->Cold->Pc, iblock->Cold->Key) >> proc->IblockTableShift;
 
-		listentry = listentry->Prev;
+	while (proc->IblockTable[index].Iblock != iblock) {
+		index = (index + 1) & mask;
 	}
-}
 
-static void XrInvalidateIblockCache(XrProcessor *proc) {
-	// Invalidate the entire Iblock cache for the processor.
+	// Remove it by shifting back any later entries in the same probe sequence
+	// that would no longer be reachable with a hole here, so that lookups
+	// never need tombstones.
 
-	ListEntry *listentry = proc->IblockLruList.Next;
+	uint32_t hole = index;
 
-	while (listentry != &proc->IblockLruList) {
-		XrIblock *iblock = ContainerOf(listentry, XrIblock, LruEntry);
+	while (1) {
+		index = (index + 1) & mask;
 
-		// No need to invalidate the Iblock's pointers. We're destroying all
-		// active Iblocks.
+		XrIblockTableEntry *entry = &proc->IblockTable[index];
 
-		// Free the Iblock. Note that this doesn't modify the LRU list links so
-		// we don't need to stash them.
+		if (!entry->Iblock) {
+			break;
+		}
 
-		XrFreeIblock(proc, iblock);
+		uint32_t home = XR_IBLOCK_HASH(entry->Pc, entry->Key) >> proc->IblockTableShift;
 
-		// Advance to the next Iblock.
+		// The entry can fill the hole only if its home slot doesn't lie
+		// cyclically within (hole, index].
 
-		listentry = listentry->Next;
+		if (((index - home) & mask) >= ((index - hole) & mask)) {
+			proc->IblockTable[hole] = *entry;
+			hole = index;
+		}
 	}
-}
 
-static inline void XrInvalidateVpage(XrProcessor *proc, XrVirtualPage *vpage) {
-	// Invalidate all of the Iblocks that reside within the VPN represented by
-	// the given Vpage.
+	proc->IblockTable[hole].Iblock = 0;
+}
 
-	ListEntry *listentry = vpage->IblockVpnList.Next;
+#ifdef FASTMEMORY
 
-	while (listentry != &vpage->IblockVpnList) {
-		XrIblock *iblock = ContainerOf(listentry, XrIblock, VpageEntry);
+static inline void XrFreeSharedCode(XrSharedCode *code) {
+	// Insert in the free list. The caller holds the store lock.
 
-		// Invalidate the pointers to this Iblock.
+	code->Code.NextFree = (void *)XrSharedCodeFreeList;
+	XrSharedCodeFreeList = code;
+}
 
-		XrInvalidateIblockPointers(iblock);
+static void XrReleaseSharedCode(XrSharedCode *code) {
+	// Drop a reference to the shared code. When the last one goes away, the
+	// code is no longer in the store and nobody can be executing it anymore,
+	// so it can be reused.
 
-		// Free the Iblock. Note that this doesn't modify the VPN list links so
-		// we don't need to stash them.
+	if (atomic_fetch_sub_explicit(&code->References, 1, memory_order_acq_rel) == 1) {
+		XrLockMutex(&XrSharedCodeLock);
 
-		XrFreeIblock(proc, iblock);
+		XrFreeSharedCode(code);
 
-		listentry = listentry->Next;
+		XrUnlockMutex(&XrSharedCodeLock);
 	}
 }
 
-static void XrInvalidateIblockCacheByVpn(XrProcessor *proc, uint32_t vpn) {
-	// Invalidate the Iblocks that match the given VPN.
+static void XrRemoveSharedCodeEntry(uint32_t index) {
+	// Remove the entry at the given index of the store, and drop the store's
+	// reference to its code. The caller holds the store lock.
 
-	ListEntry *listentry = proc->VpageHashBuckets[XR_VPN_BUCKET_INDEX(vpn)].Next;
+	uint32_t mask = XrSharedCodeTableMask;
+	XrSharedCode *code = XrSharedCodeTable[index].Code;
 
-	while (listentry != &proc->VpageHashBuckets[XR_VPN_BUCKET_INDEX(vpn)]) {
-		XrVirtualPage *vpage = ContainerOf(listentry, XrVirtualPage, VpnHashEntry);
+	// Shift back later entries in the same probe sequence, as for the
+	// per-processor lookup table.
 
-		if (vpage->Vpn == vpn) {
-			// Invalidate the Iblocks within this virtual page.
+	uint32_t hole = index;
 
-			XrInvalidateVpage(proc, vpage);
+	while (1) {
+		index = (index + 1) & mask;
 
-			return;
+		XrSharedCodeEntry *entry = &XrSharedCodeTable[index];
+
+		if (!entry->Code) {
+			break;
 		}
 
-		// Advance to the next virtual page.
+		uint32_t home = XR_IBLOCK_HASH(entry->Pc, entry->Key) >> XrSharedCodeTableShift;
 
-		listentry = listentry->Next;
+		if (((index - home) & mask) >= ((index - hole) & mask)) {
+			XrSharedCodeTable[hole] = *entry;
+			hole = index;
+		}
+	}
+
+	XrSharedCodeTable[hole].Code = 0;
+
+	if (atomic_fetch_sub_explicit(&code->References, 1, memory_order_acq_rel) == 1) {
+		XrFreeSharedCode(code);
 	}
 }
 
-static inline void XrInsertIblockInVpage(XrProcessor* proc, XrIblock *iblock, uint32_t pc) {
-	// Insert the Iblock in a Vpage or create a new one if this is the first
-	// one in that virtual page.
+static XrSharedCode *XrEvictSharedCode(void) {
+	// The store is full. Sweep through it looking for an entry that no Iblock
+	// refers to anymore, and evict it. The store lock is held, so the count
+	// can't be raised from 1 behind our backs. Returns 0 if all of the code
+	// in the store is in use.
 
-	XrVirtualPage *vpage;
+	uint32_t mask = XrSharedCodeTableMask;
 
-	int searches = 0;
+	for (uint32_t i = 0; i <= mask; i++) {
+		uint32_t index = XrSharedCodeSweepIndex;
+		XrSharedCode *code = XrSharedCodeTable[index].Code;
 
-	uint32_t vpn = pc & ~0xFFF;
-	uint32_t hash = XR_VPN_BUCKET_INDEX(vpn);
+		XrSharedCodeSweepIndex = (index + 1) & mask;
 
-	ListEntry *listentry = proc->VpageHashBuckets[hash].Next;
+		if (code && atomic_load_explicit(&code->References, memory_order_acquire) == 1) {
+			XrRemoveSharedCodeEntry(index);
 
-	while (listentry != &proc->VpageHashBuckets[hash]) {
-		vpage = ContainerOf(listentry, XrVirtualPage, VpnHashEntry);
+			XrSharedCodeFreeList = (void *)code->Code.NextFree;
 
-		if (vpage->Vpn == vpn) {
-			// Found it.
+			return code;
+		}
+	}
 
-			vpage->References++;
+	return 0;
+}
 
-			// Insert the Iblock in the Vpage's list.
+static XrSharedCode *XrLookupSharedCode(XrProcessor *proc, uint32_t pc, uint32_t key, uint32_t *epoch) {
+	// Look up code in the shared store, and take a reference to it if found.
+	// Also return the current epoch, which must still be current when code
+	// decoded by the caller is published.
 
-			iblock->Vpage = vpage;
-			InsertAtHeadList(&vpage->IblockVpnList, &iblock->VpageEntry);
+	XrSharedCode *code = 0;
 
-			return;
+	XrLockMutex(&XrSharedCodeLock);
+
+	*epoch = XrSharedCodeEpoch;
+
+	uint32_t index = XR_IBLOCK_HASH(pc, key) >> XrSharedCodeTableShift;
+
+	while (1) {
+		XrSharedCodeEntry *entry = &XrSharedCodeTable[index];
+
+		if (!entry->Code) {
+			break;
 		}
 
-		searches++;
-		listentry = listentry->Next;
-	}
+		if (entry->Pc == pc && entry->Key == key) {
+			code = entry->Code;
 
-	// Failed to find a Vpage, so allocate a new one.
+			// If the code ends in a branch that this processor has found to
+			// be biased, decode it again privately so that it's extended into
+			// a trace.
 
-	vpage = XrAllocateVpage(proc);
+			if (code->Extendable &&
+				proc->BranchBias[XR_BRANCH_BIAS_INDEX(code->ExtendPc)].Pc == code->ExtendPc) {
 
-	vpage->Vpn = vpn;
-	vpage->References = 1;
+				code = 0;
+			} else {
+				atomic_fetch_add_explicit(&code->References, 1, memory_order_relaxed);
+			}
 
-	// No need to initialize the Iblock list head, it was done at init time.
-	// InitializeList(&vpage->IblockVpnList);
+			break;
+		}
 
-	InsertAtHeadList(&proc->VpageHashBuckets[hash], &vpage->VpnHashEntry);
+		index = (index + 1) & XrSharedCodeTableMask;
+	}
 
-	// Insert the Iblock in the Vpage's list.
+	XrUnlockMutex(&XrSharedCodeLock);
 
-	iblock->Vpage = vpage;
-	InsertAtHeadList(&vpage->IblockVpnList, &iblock->VpageEntry);
+	return code;
 }
 
-static inline XrIblock *XrAllocateIblock(XrProcessor *proc, XrIblock *hazard) {
-	XrIblock *iblock = proc->IblockFreeList;
+static void XrAttachSharedCode(XrIblock *iblock, XrSharedCode *code) {
+	// Make the Iblock execute the shared code. The caller has already taken a
+	// reference to it on the Iblock's behalf.
 
-	if (XrUnlikely(iblock == 0)) {
-		// Populate the Iblock free list.
+	iblock->Cold->Shared = code;
+	iblock->Insts = &code->Code.Insts[0];
 
-		XrPopulateIblockList(proc, hazard);
+	iblock->Cycles = code->Cycles;
+	iblock->InstCount = code->InstCount;
+	iblock->SegmentCount = code->SegmentCount;
+	iblock->GuardCount = code->GuardCount;
+	iblock->Extendable = code->Extendable;
 
-		iblock = proc->IblockFreeList;
+	for (int i = 0; i < code->SegmentCount; i++) {
+		iblock->PcBias[i] = code->PcBias[i];
 	}
 
-	// Pop the head Iblock from the free list and return it.
+	for (int i = 0; i < code->GuardCount; i++) {
+		iblock->SideExits[i] = 0;
+	}
+}
 
-	proc->IblockFreeList = (void *)iblock->HashEntry.Next;
+static int XrPublishSharedCode(XrProcessor *proc, XrIblock *iblock, uint32_t key, uint32_t epoch, uint32_t extendpc) {
+	// Copy the freshly decoded Iblock into the shared store so that other
+	// processors don't have to decode it again, and switch the Iblock over to
+	// the shared copy so that it doesn't need private instructions. Returns 0
+	// if the store has been invalidated since the instructions were fetched,
+	// or if somebody else got there first.
 
-	return iblock;
-}
+	uint32_t pc = iblock->Cold->Pc;
 
-static inline XrIblock *XrLookupIblock(XrProcessor *proc, uint32_t pc, uint32_t asid) {
-	// Look up a cached Iblock starting at the given program counter.
+	XrLockMutex(&XrSharedCodeLock);
 
-	uint32_t hash = XR_IBLOCK_HASH(pc);
+	if (epoch != XrSharedCodeEpoch) {
+		goto out;
+	}
 
-	ListEntry *listentry = proc->IblockHashBuckets[hash].Next;
+	XrSharedCode *code = XrSharedCodeFreeList;
 
-	while (listentry != &proc->IblockHashBuckets[hash]) {
-		XrIblock *iblock = ContainerOf(listentry, XrIblock, HashEntry);
+	if (code) {
+		XrSharedCodeFreeList = (void *)code->Code.NextFree;
+	} else {
+		code = XrEvictSharedCode();
 
-		if (iblock->Pc == pc && iblock->Asid == asid) {
-			// Found it.
+		if (!code) {
+			goto out;
+		}
+	}
 
-			return iblock;
+	uint32_t index = XR_IBLOCK_HASH(pc, key) >> XrSharedCodeTableShift;
+
+	while (XrSharedCodeTable[index].Code) {
+		XrSharedCodeEntry *entry = &XrSharedCodeTable[index];
+
+		if (entry->Pc == pc && entry->Key == key) {
+			XrFreeSharedCode(code);
+
+			goto out;
 		}
 
-		listentry = listentry->Next;
+		index = (index + 1) & XrSharedCodeTableMask;
 	}
 
-	return 0;
-}
+	memcpy(&code->Code.Insts[0], iblock->Insts, iblock->InstCount * sizeof(XrCachedInst));
 
-void XrReset(XrProcessor *proc) {
-	// Set the program counter to point to the reset vector.
+	code->Cycles = iblock->Cycles;
+	code->InstCount = iblock->InstCount;
+	code->SegmentCount = iblock->SegmentCount;
+	code->GuardCount = iblock->GuardCount;
+	code->Extendable = iblock->Extendable;
+	code->ExtendPc = extendpc;
 
-	proc->Pc = 0xFFFE1000;
+	for (int i = 0; i < iblock->SegmentCount; i++) {
+		code->PcBias[i] = iblock->PcBias[i];
+	}
 
-	// Initialize the control registers that have reset-defined values.
+	// One reference for the store and one for the Iblock.
 
-	proc->Cr[RS] = 0;
-	proc->Cr[EB] = 0;
-	proc->Cr[ICACHECTRL] = (XR_IC_LINE_COUNT_LOG << 16) | (XR_IC_WAY_LOG << 8) | (XR_IC_LINE_SIZE_LOG);
-	proc->Cr[DCACHECTRL] = (XR_DC_LINE_COUNT_LOG << 16) | (XR_DC_WAY_LOG << 8) | (XR_DC_LINE_SIZE_LOG);
-	proc->Cr[WHAMI] = proc->Id;
+	atomic_store_explicit(&code->References, 2, memory_order_relaxed);
 
-	proc->Reg[XR_FAKE_ZERO_REGISTER] = 0;
+	XrSharedCodeEntry *entry = &XrSharedCodeTable[index];
 
-	// Initialize emulator support stuff.
+	entry->Pc = pc;
+	entry->Key = key;
+	entry->Code = code;
 
-	proc->ItbLastVpn = -1;
-	proc->DtbLastVpn = -1;
+	XrUnlockMutex(&XrSharedCodeLock);
 
-#if XR_SIMULATE_CACHES
-	proc->IcReplacementIndex = 0;
-	proc->DcReplacementIndex = 0;
+	iblock->Cold->Shared = code;
+	iblock->Insts = &code->Code.Insts[0];
 
-	proc->WbWriteIndex = 0;
-	proc->WbCycles = 0;
-	proc->WbFillIndex = 0;
+	return 1;
 
-	for (int i = 0; i < XR_WB_DEPTH; i++) {
-		proc->WbIndices[i] = XR_CACHE_INDEX_INVALID;
-	}
+out:
+	XrUnlockMutex(&XrSharedCodeLock);
 
-	for (int i = 0; i < XR_DC_LINE_COUNT; i++) {
-		proc->DcIndexToWbIndex[i] = XR_WB_INDEX_INVALID;
-	}
-#endif
+	return 0;
+}
 
-#ifdef PROFCPU
-	proc->IcMissCount = 0;
-	proc->IcHitCount = 0;
+static void XrInvalidateSharedCodeByPfn(uint32_t pfn) {
+	// Remove all of the code that was fetched from the given page frame from
+	// the store. Processors that are still executing it keep their references,
+	// and will drop them when they invalidate their own Iblocks.
 
-	proc->DcMissCount = 0;
-	proc->DcHitCount = 0;
+	XrLockMutex(&XrSharedCodeLock);
 
-	proc->TimeToNextPrint = 0;
-#endif
+	XrSharedCodeEpoch++;
 
-#if XR_SIMULATE_CACHE_STALLS
-	proc->StallCycles = 0;
-#endif
-	proc->PauseCalls = 0;
+	uint32_t index = 0;
 
-	proc->NmiMaskCounter = NMI_MASK_CYCLES;
-	proc->LastTbMissWasWrite = 0;
-	proc->UserBreak = 0;
-	proc->Halted = 0;
-	proc->Running = 1;
-	proc->Dispatches = 0;
-}
+	while (index <= XrSharedCodeTableMask) {
+		XrSharedCodeEntry *entry = &XrSharedCodeTable[index];
 
-static inline void XrPushMode(XrProcessor *proc) {
-	// "Push" the mode stack bits in RS.
+		if (entry->Code && (entry->Key & 0xFFFFF000) == pfn) {
+			// Don't advance, since a later entry may have been shifted back
+			// into this slot.
 
-	proc->Cr[RS] = (proc->Cr[RS] & 0xFF0000FF) | ((proc->Cr[RS] & 0xFFFF) << 8);
+			XrRemoveSharedCodeEntry(index);
+		} else {
+			index++;
+		}
+	}
+
+	XrUnlockMutex(&XrSharedCodeLock);
 }
 
-static inline void XrSetEcause(XrProcessor *proc, uint32_t exc) {
-	// Set the ECAUSE code in RS.
+static void XrInvalidateSharedCode(void) {
+	// Remove all of the code from the store.
 
-	proc->Cr[RS] = (proc->Cr[RS] & 0x0FFFFFFF) | (exc << 28);
-}
+	XrLockMutex(&XrSharedCodeLock);
 
-static inline void XrVectorException(XrProcessor *proc, uint32_t exc) {
-	// This implements stuff that is common to all exceptions.
-	// Note that it does NOT push the mode stack, save PC into EPC, or set the
-	// exception code in RS.
+	XrSharedCodeEpoch++;
 
-	if (XrUnlikely(proc->Cr[EB] == 0)) {
-		// Reset the processor.
+	for (uint32_t index = 0; index <= XrSharedCodeTableMask; index++) {
+		XrSharedCodeEntry *entry = &XrSharedCodeTable[index];
+		XrSharedCode *code = entry->Code;
 
-		XrReset(proc);
+		if (code) {
+			entry->Code = 0;
 
-		return;
+			if (atomic_fetch_sub_explicit(&code->References, 1, memory_order_acq_rel) == 1) {
+				XrFreeSharedCode(code);
+			}
+		}
 	}
 
-	DBGPRINT("exc %d\n", exc);
-	// proc->Running = false;
+	XrUnlockMutex(&XrSharedCodeLock);
+}
 
-	// Build new mode bits.
-	// Enter kernel mode and disable interrupts.
+#ifdef XR_JIT
 
-	uint32_t newmode = proc->Cr[RS] & 0xFC;
+static int XrPrivatizeIblock(XrProcessor *proc, XrIblock *iblock) {
+	// Give the Iblock a private copy of its shared code, so that the copy can
+	// be modified. Returns 0 if there's no free chunk to copy it to.
 
-	if (XrUnlikely((proc->Cr[RS] & RS_LEGACY) != 0)) {
-		// Legacy exceptions are enabled, so disable virtual addressing. This is
-		// NOT part of the "official" xr17032 architecture and is a hack to
-		// continue running AISIX in emulation.
+	XrIblockCold *cold = iblock->Cold;
+	int class;
 
-		newmode &= ~RS_MMU;
+	XrCachedInst *chunk = XrTryAllocateCode(proc, iblock->InstCount, &class);
+
+	if (!chunk) {
+		return 0;
 	}
 
-	// Redirect PC to the exception vector.
+	memcpy(chunk, iblock->Insts, iblock->InstCount * sizeof(XrCachedInst));
 
-	proc->Pc = proc->Cr[EB] | (exc << 8);
+	XrReleaseSharedCode(cold->Shared);
 
-	// Set the mode bits in RS.
+	cold->Shared = 0;
+	cold->CodeClass = class;
+	iblock->Insts = chunk;
 
-	proc->Cr[RS] = (proc->Cr[RS] & 0xFFFFFF00) | newmode;
+	return 1;
+}
 
-	// Reset the NMI mask counter.
+#endif
 
-	proc->NmiMaskCounter = NMI_MASK_CYCLES;
+#endif
 
-	// Reset the "progress", allowing more polling.
+static inline void XrFreeIblock(XrProcessor *proc, XrIblock *iblock) {
+	XrIblockCold *cold = iblock->Cold;
 
-	proc->Progress = XR_POLL_MAX;
-}
+	// Remove from the LRU list.
 
-static inline void XrBasicException(XrProcessor *proc, uint32_t exc, uint32_t pc) {
-	// "Basic" exceptions that behave the same way every time.
+	RemoveEntryList(&cold->LruEntry);
 
-	proc->Cr[EPC] = pc;
+	// Remove from the lookup table and the jump cache.
 
-	XrPushMode(proc);
-	XrSetEcause(proc, exc);
-	XrVectorException(proc, exc);
-}
+	XrRemoveIblockFromTable(proc, iblock);
 
-#ifdef FASTMEMORY
+	XrIblockTableEntry *jump = &proc->JumpCache[XR_JUMP_CACHE_INDEX(cold->Pc)];
 
-#include "xrfastaccess.inc.c"
+	if (jump->Iblock == iblock) {
+		jump->Iblock = 0;
+	}
 
-#else
+	for (int i = 0; i < cold->PageCount; i++) {
+		XrIblockPageLink *link = &cold->PageLinks[i];
 
-#include "xraccess.inc.c"
+		// Remove from the Vpage list.
 
-#endif
+		RemoveEntryList(&link->Entry);
 
-static XrIblock *XrDecodeInstructions(XrProcessor *proc, XrIblock *hazard);
+		// Decrement the Vpage's reference count and delete it if this was the
+		// final Iblock within the virtual page.
 
-XR_PRESERVE_NONE
-static void XrCheckConditions(XrProcessor *proc, XrIblock *nextblock, XrCachedInst *inst) {
-	// Check if any conditions are true that indicate we should terminate
-	// the execution chain.
+		if (--link->Vpage->References == 0) {
+			RemoveEntryList(&link->Vpage->VpnHashEntry);
 
-#if XR_SIMULATE_CACHES
-	if (proc->WbCycles) {
-		// Assume enough cycles have passed to empty the writebuffer at no
-		// charge.
+			XrFreeVpage(proc, link->Vpage);
+		}
 
-		proc->WbCycles = 0;
-		XrFlushWriteBuffer(proc);
-	}
-#endif
+		// Same for the Ppage.
 
-retry:
+		RemoveEntryList(&link->PfnEntry);
 
-	if (XrUnlikely(proc->CyclesDone >= proc->CyclesGoal)) {
-		proc->NoMore = 1;
-		return;
-	}
+		if (--link->Ppage->References == 0) {
+			RemoveEntryList(&link->Ppage->PfnHashEntry);
 
-	if (XrUnlikely(proc->Halted)) {
-		proc->NoMore = 1;
-		return;
+			XrFreePpage(proc, link->Ppage);
+		}
 	}
 
-	if (XrUnlikely(proc->PauseCalls >= XR_PAUSE_MAX)) {
-		proc->NoMore = 1;
-		return;
-	}
+	// Free Ptable.
 
-	if (XrUnlikely(proc->NmiMaskCounter != 0)) {
-		proc->NmiMaskCounter--;
+	if (cold->HasPtable) {
+		XrFreePtable(proc, (void *)iblock->CachedPaths[0]);
 	}
 
-	Lsic *lsic = &LsicTable[proc->Id];
+	// Free the instructions.
 
-	if (XrUnlikely(lsic->InterruptPending && (proc->Cr[RS] & RS_INT))) {
-		// Interrupts are enabled and there's an interrupt pending, so cause
-		// an interrupt exception.
+	if (cold->CodeClass != XR_CODE_CLASS_NONE) {
+		XrFreeCode(proc, iblock->Insts, cold->CodeClass);
+	}
 
-		// N.B. There's an assumption here that the host platform will make
-		// writes by other host cores to the interrupt pending flag visible
-		// to us in a timely manner, without needing any barriers.
+#ifdef FASTMEMORY
+	if (cold->Shared) {
+		XrReleaseSharedCode(cold->Shared);
+	}
+#endif
 
-		XrBasicException(proc, XR_EXC_INT, proc->Pc);
+	// Insert in the free list.
 
-		// Reset the poll counter so as not to penalize the processor for
-		// handling the interrupt.
+	cold->NextFree = proc->IblockFreeList;
+	proc->IblockFreeList = iblock;
+}
 
-		proc->Progress = XR_POLL_MAX;
+static void XrPopulateIblockList(XrProcessor *proc, XrIblock *hazard) {
+	// The Iblock free list is empty. We need to repopulate by striking down
+	// some active ones from the tail of the LRU list. The hazard pointer
+	// parameter is provided to specify an Iblock which may not be reclaimed.
+	// This is usually an Iblock currently in use by a caller whose invalidation
+	// at this time would cause problems.
+	//
+	// We know that there are at least XR_IBLOCK_RECLAIM Iblocks on the LRU list
+	// because all active Iblocks are on the LRU list, all Iblocks are currently
+	// active, and there are more than XR_IBLOCK_RECLAIM total Iblocks.
 
-		// Make sure we re-lookup the Iblock.
+	// Get a pointer to the Iblock on the tail of the LRU list.
 
-		nextblock = 0;
-	}
+	ListEntry *listentry = proc->IblockLruList.Prev;
 
-	if (XrUnlikely(!nextblock)) {
-		nextblock = XrDecodeInstructions(proc, 0);
+	for (int i = 0; i < XR_IBLOCK_RECLAIM; i++) {
+		XrIblock *iblock = ContainerOf(listentry, XrIblockCold, LruEntry)->Iblock;
 
-		if (XrUnlikely(!nextblock)) {
-			// An exception occurred while performing instruction fetch.
-			// Loop and let the exception handler execute.
+		if (hazard != iblock) {
+			// Invalidate the pointers to this Iblock.
 
-			proc->CyclesDone += XR_IBLOCK_INSTS;
+			XrInvalidateIblockPointers(iblock);
 
-			goto retry;
+			// Free the Iblock. Note that this doesn't modify the LRU list links
+			// so we don't need to stash them.
+
+			XrFreeIblock(proc, iblock);
 		}
-	}
 
-	// Call it directly.
+		// Advance to the previous Iblock.
 
-	XR_TAIL return nextblock->Insts[0].Func(proc, nextblock, &nextblock->Insts[0]);
+		listentry = listentry->Prev;
+	}
 }
 
-#define XR_NEXT_NO_PC() inst++; XR_TAIL return inst->Func(proc, block, inst);
-#define XR_NEXT() proc->Pc += 4; XR_NEXT_NO_PC();
-
-#define XR_DISPATCH(nextblock) \
-	proc->CyclesDone += block->Cycles; \
-	if (XrUnlikely((proc->Dispatches++ & 31) == 0)) { \
-		return; \
-	} \
-	XR_TAIL return nextblock->Insts[0].Func(proc, nextblock, &nextblock->Insts[0]);
+static void XrPopulateCodeList(XrProcessor *proc, XrIblock *hazard, int count) {
+	// There is no free chunk with room for the given number of instruction
+	// slots. Strike down some of the Iblocks that have private chunks that are
+	// big enough, starting from the tail of the LRU list. There are at least
+	// two chunks of the largest size class, all of which belong to Iblocks on
+	// the LRU list, so at least one of them isn't the hazard.
 
-#define XR_TRIVIAL_EXIT() \
-	proc->CyclesDone += block->Cycles; \
-	XR_TAIL return XrCheckConditions(proc, 0, 0);
+	ListEntry *listentry = proc->IblockLruList.Prev;
+	int reclaimed = 0;
 
-#define XR_EARLY_EXIT() \
-	proc->CyclesDone += inst - &block->Insts[0]; \
-	return;
+	while (listentry != &proc->IblockLruList && reclaimed < XR_IBLOCK_RECLAIM) {
+		XrIblock *iblock = ContainerOf(listentry, XrIblockCold, LruEntry)->Iblock;
+		int class = iblock->Cold->CodeClass;
 
-#define XR_REG_RD() proc->Reg[inst->Imm8_1]
-#define XR_REG_RA() proc->Reg[inst->Imm8_2]
-#define XR_REG_RB() proc->Reg[inst->Imm32_1]
+		// Advance to the previous Iblock first, since this one may be freed.
 
-#define XR_CURRENT_ASID() ((XrLikely(proc->Cr[RS] & RS_MMU) != 0) ? (proc->Cr[ITBTAG] & 0xFFF00000) : 0xFFFFFFFF)
+		listentry = listentry->Prev;
 
-XR_PRESERVE_NONE
-static void XrExecuteIllegalInstruction(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 1\n");
+		if (class != XR_CODE_CLASS_NONE && XrCodeClassSlots[class] >= count && hazard != iblock) {
+			XrInvalidateIblockPointers(iblock);
 
-	XrBasicException(proc, XR_EXC_INV, proc->Pc);
+			XrFreeIblock(proc, iblock);
 
-	XR_TRIVIAL_EXIT();
+			reclaimed++;
+		}
+	}
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteNor(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 2\n");
-
-	XR_REG_RD() = ~(XR_REG_RA() | XR_REG_RB());
+static void XrInvalidateIblockCache(XrProcessor *proc) {
+	// Invalidate the entire Iblock cache for the processor.
 
-	XR_NEXT();
-}
+	ListEntry *listentry = proc->IblockLruList.Next;
 
-XR_PRESERVE_NONE
-static void XrExecuteOr(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 3\n");
+	while (listentry != &proc->IblockLruList) {
+		XrIblock *iblock = ContainerOf(listentry, XrIblockCold, LruEntry)->Iblock;
 
-	XR_REG_RD() = XR_REG_RA() | XR_REG_RB();
+		// No need to invalidate the Iblock's pointers. We're destroying all
+		// active Iblocks.
 
-	XR_NEXT();
-}
+		// Free the Iblock. Note that this doesn't modify the LRU list links so
+		// we don't need to stash them.
 
-XR_PRESERVE_NONE
-static void XrExecuteXor(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 4\n");
+		XrFreeIblock(proc, iblock);
 
-	XR_REG_RD() = XR_REG_RA() ^ XR_REG_RB();
+		// Advance to the next Iblock.
 
-	XR_NEXT();
+		listentry = listentry->Next;
+	}
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteAnd(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 5\n");
+static inline void XrInvalidateVpage(XrProcessor *proc, XrVirtualPage *vpage) {
+	// Invalidate all of the Iblocks that reside within the VPN represented by
+	// the given Vpage.
 
-	XR_REG_RD() = XR_REG_RA() & XR_REG_RB();
+	ListEntry *listentry = vpage->IblockVpnList.Next;
 
-	XR_NEXT();
-}
+	while (listentry != &vpage->IblockVpnList) {
+		XrIblock *iblock = ContainerOf(listentry, XrIblockPageLink, Entry)->Iblock;
 
-XR_PRESERVE_NONE
-static void XrExecuteSltSigned(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 6\n");
+		// Invalidate the pointers to this Iblock.
 
-	if ((int32_t) XR_REG_RA() < (int32_t) XR_REG_RB()) {
-		XR_REG_RD() = 1;
-	} else {
-		XR_REG_RD() = 0;
-	}
+		XrInvalidateIblockPointers(iblock);
 
-	XR_NEXT();
-}
+		// Free the Iblock. Note that this doesn't modify the VPN list links so
+		// we don't need to stash them.
 
-XR_PRESERVE_NONE
-static void XrExecuteSlt(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 7\n");
+		XrFreeIblock(proc, iblock);
 
-	if (XR_REG_RA() < XR_REG_RB()) {
-		XR_REG_RD() = 1;
-	} else {
-		XR_REG_RD() = 0;
+		listentry = listentry->Next;
 	}
-
-	XR_NEXT();
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteSub(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 8\n");
+static void XrInvalidateIblockCacheByVpn(XrProcessor *proc, uint32_t vpn) {
+	// Invalidate the Iblocks that match the given VPN.
 
-	XR_REG_RD() = XR_REG_RA() - XR_REG_RB();
+	ListEntry *listentry = proc->VpageHashBuckets[XR_VPN_BUCKET_INDEX(vpn)].Next;
 
-	XR_NEXT();
-}
+	while (listentry != &proc->VpageHashBuckets[XR_VPN_BUCKET_INDEX(vpn)]) {
+		XrVirtualPage *vpage = ContainerOf(listentry, XrVirtualPage, VpnHashEntry);
 
-XR_PRESERVE_NONE
-static void XrExecuteAdd(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+		if (vpage->Vpn == vpn) {
+			// Invalidate the Iblocks within this virtual page.
 
-	DBGPRINT("exec 9\n");
+			XrInvalidateVpage(proc, vpage);
 
-	XR_REG_RD() = XR_REG_RA() + XR_REG_RB();
+			return;
+		}
 
-	XR_NEXT();
+		// Advance to the next virtual page.
+
+		listentry = listentry->Next;
+	}
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteLsh(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 10\n");
+static inline void XrInvalidatePpage(XrProcessor *proc, XrPhysicalPage *ppage) {
+	// Invalidate all of the Iblocks that were fetched from the page frame
+	// represented by the given Ppage.
 
-	XR_REG_RD() = XR_REG_RB() << (XR_REG_RA() & 31);
+	ListEntry *listentry = ppage->IblockPfnList.Next;
 
-	XR_NEXT();
-}
+	while (listentry != &ppage->IblockPfnList) {
+		XrIblock *iblock = ContainerOf(listentry, XrIblockPageLink, PfnEntry)->Iblock;
 
-XR_PRESERVE_NONE
-static void XrExecuteRsh(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 11\n");
+		// Invalidate the pointers to this Iblock.
 
-	XR_REG_RD() = XR_REG_RB() >> (XR_REG_RA() & 31);
+		XrInvalidateIblockPointers(iblock);
 
-	XR_NEXT();
+		// Free the Iblock. Note that this doesn't modify the PFN list links so
+		// we don't need to stash them.
+
+		XrFreeIblock(proc, iblock);
+
+		listentry = listentry->Next;
+	}
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteAsh(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 12\n");
+static void XrInvalidateIblockCacheByPfn(XrProcessor *proc, uint32_t pfn) {
+	// Invalidate the Iblocks that were fetched from the given page frame.
 
-	XR_REG_RD() = (int32_t) XR_REG_RB() >> (XR_REG_RA() & 31);
-
-	XR_NEXT();
-}
-
-XR_PRESERVE_NONE
-static void XrExecuteRor(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 13\n");
+	ListEntry *listentry = proc->PpageHashBuckets[XR_PFN_BUCKET_INDEX(pfn)].Next;
 
-	XR_REG_RD() = RoR(XR_REG_RB(), XR_REG_RA() & 31);
+	while (listentry != &proc->PpageHashBuckets[XR_PFN_BUCKET_INDEX(pfn)]) {
+		XrPhysicalPage *ppage = ContainerOf(listentry, XrPhysicalPage, PfnHashEntry);
 
-	XR_NEXT();
-}
+		if (ppage->Pfn == pfn) {
+			// Invalidate the Iblocks within this page frame.
 
-XR_PRESERVE_NONE
-static void XrExecuteStoreLongRegOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 14\n");
+			XrInvalidatePpage(proc, ppage);
 
-	int status = XrWriteLong(proc, XR_REG_RA() + XR_REG_RB(), XR_REG_RD());
+			return;
+		}
 
-	if (XrUnlikely(!status)) {
-		// An exception occurred, so perform an early exit from the basic block.
+		// Advance to the next page frame.
 
-		XR_EARLY_EXIT();
+		listentry = listentry->Next;
 	}
-
-	XR_NEXT();
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteStoreIntRegOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 15\n");
-
-	int status = XrWriteInt(proc, XR_REG_RA() + XR_REG_RB(), XR_REG_RD());
-
-	if (XrUnlikely(!status)) {
-		// An exception occurred, so perform an early exit from the basic block.
+static inline void XrInsertIblockInVpage(XrProcessor* proc, XrIblockPageLink *link, uint32_t pc) {
+	// Insert the Iblock in a Vpage or create a new one if this is the first
+	// one in that virtual page. The caller guarantees that the Iblock isn't
+	// already in this virtual page.
 
-		XR_EARLY_EXIT();
-	}
+	XrVirtualPage *vpage;
 
-	XR_NEXT();
-}
+	int searches = 0;
 
-XR_PRESERVE_NONE
-static void XrExecuteStoreByteRegOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 16\n");
+	uint32_t vpn = pc & ~0xFFF;
+	uint32_t hash = XR_VPN_BUCKET_INDEX(vpn);
 
-	int status = XrWriteByte(proc, XR_REG_RA() + XR_REG_RB(), XR_REG_RD());
+	ListEntry *listentry = proc->VpageHashBuckets[hash].Next;
 
-	if (XrUnlikely(!status)) {
-		// An exception occurred, so perform an early exit from the basic block.
+	while (listentry != &proc->VpageHashBuckets[hash]) {
+		vpage = ContainerOf(listentry, XrVirtualPage, VpnHashEntry);
 
-		XR_EARLY_EXIT();
-	}
+		if (vpage->Vpn == vpn) {
+			// Found it.
 
-	XR_NEXT();
-}
+			vpage->References++;
 
-XR_PRESERVE_NONE
-static void XrExecuteLoadLongRegOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 17\n");
+			// Insert the Iblock in the Vpage's list.
 
-	int status = XrReadLong(proc, XR_REG_RA() + XR_REG_RB(), &XR_REG_RD());
+			link->Vpage = vpage;
+			InsertAtHeadList(&vpage->IblockVpnList, &link->Entry);
 
-	if (XrUnlikely(!status)) {
-		// An exception occurred, so perform an early exit from the basic block.
+			return;
+		}
 
-		XR_EARLY_EXIT();
+		searches++;
+		listentry = listentry->Next;
 	}
 
-	XR_NEXT();
-}
+	// Failed to find a Vpage, so allocate a new one.
 
-XR_PRESERVE_NONE
-static void XrExecuteLoadIntRegOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 18\n");
+	vpage = XrAllocateVpage(proc);
 
-	int status = XrReadInt(proc, XR_REG_RA() + XR_REG_RB(), &XR_REG_RD());
+	vpage->Vpn = vpn;
+	vpage->References = 1;
 
-	if (XrUnlikely(!status)) {
-		// An exception occurred, so perform an early exit from the basic block.
+	// No need to initialize the Iblock list head, it was done at init time.
+	// InitializeList(&vpage->IblockVpnList);
 
-		XR_EARLY_EXIT();
-	}
+	InsertAtHeadList(&proc->VpageHashBuckets[hash], &vpage->VpnHashEntry);
 
-	XR_NEXT();
+	// Insert the Iblock in the Vpage's list.
+
+	link->Vpage = vpage;
+	InsertAtHeadList(&vpage->IblockVpnList, &link->Entry);
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteLoadByteRegOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 19\n");
+static inline void XrInsertIblockInPpage(XrProcessor* proc, XrIblockPageLink *link, uint32_t phys) {
+	// Insert the Iblock in a Ppage or create a new one if this is the first
+	// one fetched from that page frame. The caller guarantees that the Iblock
+	// isn't already in this page frame.
 
-	int status = XrReadByte(proc, XR_REG_RA() + XR_REG_RB(), &XR_REG_RD());
+	XrPhysicalPage *ppage;
 
-	if (XrUnlikely(!status)) {
-		// An exception occurred, so perform an early exit from the basic block.
+	uint32_t pfn = phys & ~0xFFF;
+	uint32_t hash = XR_PFN_BUCKET_INDEX(pfn);
 
-		XR_EARLY_EXIT();
-	}
+	ListEntry *listentry = proc->PpageHashBuckets[hash].Next;
 
-	XR_NEXT();
-}
+	while (listentry != &proc->PpageHashBuckets[hash]) {
+		ppage = ContainerOf(listentry, XrPhysicalPage, PfnHashEntry);
 
-XR_PRESERVE_NONE
-static void XrExecuteSys(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 20\n");
+		if (ppage->Pfn == pfn) {
+			// Found it.
 
-	XrBasicException(proc, XR_EXC_SYS, proc->Pc + 4);
+			ppage->References++;
 
-	XR_TRIVIAL_EXIT();
-}
+			link->Ppage = ppage;
+			InsertAtHeadList(&ppage->IblockPfnList, &link->PfnEntry);
 
-XR_PRESERVE_NONE
-static void XrExecuteBrk(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 21\n");
+			return;
+		}
 
-	XrBasicException(proc, XR_EXC_BRK, proc->Pc + 4);
+		listentry = listentry->Next;
+	}
 
-	XR_TRIVIAL_EXIT();
-}
+	// Failed to find a Ppage, so allocate a new one.
 
-XR_PRESERVE_NONE
-static void XrExecuteWmb(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 22\n");
+	ppage = XrAllocatePpage(proc);
 
-#if XR_SIMULATE_CACHES
-	XrFlushWriteBuffer(proc);
-#endif
+	ppage->Pfn = pfn;
+	ppage->References = 1;
 
-#if FASTMEMORY && !SINGLE_THREAD_MP
-	atomic_thread_fence(memory_order_release);
-#endif
+	InsertAtHeadList(&proc->PpageHashBuckets[hash], &ppage->PfnHashEntry);
 
-	XR_NEXT();
+	link->Ppage = ppage;
+	InsertAtHeadList(&ppage->IblockPfnList, &link->PfnEntry);
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteMb(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 22\n");
+static inline void XrLinkIblockPage(XrProcessor *proc, XrIblock *iblock, uint32_t pc, uint32_t phys) {
+	// Record that the Iblock contains code from the virtual page containing pc,
+	// which was fetched from the page frame containing phys. The caller
+	// guarantees that the Iblock has a free page link.
 
-#if XR_SIMULATE_CACHES
-	XrFlushWriteBuffer(proc);
-#endif
+	XrIblockPageLink *link = &iblock->Cold->PageLinks[iblock->Cold->PageCount++];
 
-#if FASTMEMORY && !SINGLE_THREAD_MP
-	atomic_thread_fence(memory_order_acq_rel);
-#endif
+	link->Iblock = iblock;
 
-	XR_NEXT();
+	XrInsertIblockInVpage(proc, link, pc);
+	XrInsertIblockInPpage(proc, link, phys);
 }
 
-XR_PRESERVE_NONE
-static void XrExecutePause(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 23\n");
+static inline XrIblock *XrAllocateIblock(XrProcessor *proc, XrIblock *hazard) {
+	XrIblock *iblock = proc->IblockFreeList;
 
-	if (proc->PauseCalls++ >= XR_PAUSE_MAX) {
-		// Terminate execution.
+	if (XrUnlikely(iblock == 0)) {
+		// Populate the Iblock free list.
 
-		proc->Pc += 4;
+		XrPopulateIblockList(proc, hazard);
 
-		XR_EARLY_EXIT();
+		iblock = proc->IblockFreeList;
 	}
 
-	XR_NEXT();
-}
+	// Pop the head Iblock from the free list and return it.
 
-XR_PRESERVE_NONE
-static void XrExecuteSC(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 24\n");
+	proc->IblockFreeList = iblock->Cold->NextFree;
 
-	if (XrUnlikely(!proc->Locked)) {
-		// Something happened on this processor that caused the
-		// lock to go away.
+	return iblock;
+}
 
-		XR_REG_RD() = 0;
-	} else {
-		// Store the word in a way that will atomically fail if we no longer
-		// have the cache line from LL's load. This is accomplished by passing
-		// sc=1 to XrAccess.
+static inline XrCachedInst *XrAllocateCode(XrProcessor *proc, XrIblock *hazard, int count, int *class) {
+	XrCachedInst *chunk = XrTryAllocateCode(proc, count, class);
 
-		//DBGPRINT("%d: SC %d\n", proc->Id, proc->Reg[rb]);
+	if (XrUnlikely(chunk == 0)) {
+		// Populate the free lists.
 
-		int status = XrWriteLongSc(proc, XR_REG_RA(), XR_REG_RB());
+		XrPopulateCodeList(proc, hazard, count);
 
-		if (XrUnlikely(!status)) {
-			XR_EARLY_EXIT();
-		}
-		
-		XR_REG_RD() = (status == 2) ? 0 : 1;
+		chunk = XrTryAllocateCode(proc, count, class);
 	}
 
-	XR_NEXT();
+	return chunk;
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteLL(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 25\n");
+static inline XrIblock *XrLookupIblock(XrProcessor *proc, uint32_t pc, uint32_t asid, uint32_t key) {
+	// Look up a cached Iblock starting at the given program counter. Try the
+	// jump cache first, which is always tagged with the ASID in which the
+	// Iblock was found.
 
-	int status = XrReadLongLl(proc, XR_REG_RA(), &XR_REG_RD());
+	XrIblockTableEntry *jump = &proc->JumpCache[XR_JUMP_CACHE_INDEX(pc)];
 
-	if (XrUnlikely(!status)) {
-		XR_EARLY_EXIT();
+	if (XrLikely(jump->Pc == pc && jump->Key == asid && jump->Iblock)) {
+		return jump->Iblock;
 	}
 
-	proc->Locked = 1;
-
-	XR_NEXT();
-}
-
-XR_PRESERVE_NONE
-static void XrExecuteMod(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 26\n");
+	uint32_t index = XR_IBLOCK_HASH(pc, key) >> proc->IblockTableShift;
 
-	uint32_t val = XR_REG_RB();
+	while (1) {
+		XrIblockTableEntry *entry = &proc->IblockTable[index];
 
-	if (val == 0) {
-		XR_REG_RD() = 0;
-	} else {
-		XR_REG_RD() = XR_REG_RA() % val;
-	}
+		if (entry->Pc == pc && entry->Key == key && entry->Iblock) {
+			// Found it. Remember it in the jump cache.
 
-	XR_NEXT();
-}
+			jump->Pc = pc;
+			jump->Key = asid;
+			jump->Iblock = entry->Iblock;
 
-XR_PRESERVE_NONE
-static void XrExecuteDivSigned(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 27\n");
+			return entry->Iblock;
+		}
 
-	uint32_t val = XR_REG_RB();
+		if (!entry->Iblock) {
+			return 0;
+		}
 
-	if (val == 0) {
-		XR_REG_RD() = 0;
-	} else {
-		XR_REG_RD() = (int32_t) XR_REG_RA() / (int32_t) val;
+		index = (index + 1) & proc->IblockTableMask;
 	}
-
-	XR_NEXT();
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteDiv(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 28\n");
-
-	uint32_t val = XR_REG_RB();
+#ifdef FASTMEMORY
 
-	if (val == 0) {
-		XR_REG_RD() = 0;
-	} else {
-		XR_REG_RD() = XR_REG_RA() / val;
+static void XrFlushSoftTlb(XrProcessor *proc) {
+	for (int i = 0; i < XR_SOFT_TLB_SIZE; i++) {
+		proc->SoftTlb[i].ReadTag = XR_SOFT_TLB_INVALID;
+		proc->SoftTlb[i].WriteTag = XR_SOFT_TLB_INVALID;
 	}
+}
 
-	XR_NEXT();
+static inline void XrInvalidateSoftTlbVpn(XrProcessor *proc, uint32_t vpn) {
+	XrSoftTlbEntry *softtlb = &proc->SoftTlb[XR_SOFT_TLB_INDEX(vpn)];
+
+	softtlb->ReadTag = XR_SOFT_TLB_INVALID;
+	softtlb->WriteTag = XR_SOFT_TLB_INVALID;
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteMul(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 29\n");
+static inline void XrInvalidateSoftTlbDtbe(XrProcessor *proc, uint64_t *dtbe) {
+	// The DTB entry is about to be replaced, so remove the soft TLB entry that
+	// was filled from it, if there is one.
 
-	XR_REG_RD() = XR_REG_RA() * XR_REG_RB();
+	XrSoftTlbEntry *softtlb = &proc->SoftTlb[XR_SOFT_TLB_INDEX((*dtbe >> 32) & 0xFFFFF)];
 
-	XR_NEXT();
+	if (softtlb->Entry.DtbePointer == dtbe) {
+		softtlb->ReadTag = XR_SOFT_TLB_INVALID;
+		softtlb->WriteTag = XR_SOFT_TLB_INVALID;
+	}
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteRfe(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 30\n");
+#endif
 
-	proc->Locked = 0;
+void XrReset(XrProcessor *proc) {
+	// Set the program counter to point to the reset vector.
 
-	uint32_t oldrs = proc->Cr[RS];
+	proc->Pc = 0xFFFE1000;
 
-	if (XrUnlikely((oldrs & RS_USER) != 0)) {
-		// Ope, privilege violation.
+	// Initialize the control registers that have reset-defined values.
 
-		XrBasicException(proc, XR_EXC_PRV, proc->Pc);
+	proc->Cr[RS] = 0;
+	proc->Cr[EB] = 0;
+	proc->Cr[ICACHECTRL] = (XR_IC_LINE_COUNT_LOG << 16) | (XR_IC_WAY_LOG << 8) | (XR_IC_LINE_SIZE_LOG);
+	proc->Cr[DCACHECTRL] = (XR_DC_LINE_COUNT_LOG << 16) | (XR_DC_WAY_LOG << 8) | (XR_DC_LINE_SIZE_LOG);
+	proc->Cr[WHAMI] = proc->Id;
 
-		XR_EARLY_EXIT();
-	}
+	proc->Reg[XR_FAKE_ZERO_REGISTER] = 0;
 
-	if (XrUnlikely((proc->Cr[RS] & RS_TBMISS) != 0)) {
-		proc->Pc = proc->Cr[TBPC];
-	} else {
-		proc->Pc = proc->Cr[EPC];
-	}
+	// Initialize emulator support stuff.
 
-	proc->Cr[RS] = (proc->Cr[RS] & 0xF0000000) | ((proc->Cr[RS] >> 8) & 0xFFFF);
+	proc->ItbLastVpn = -1;
+	proc->DtbLastVpn = -1;
 
-	XR_TRIVIAL_EXIT();
-}
+#ifdef FASTMEMORY
+	XrFlushSoftTlb(proc);
+#endif
 
-XR_PRESERVE_NONE
-static void XrExecuteHlt(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 31\n");
-
-	if (XrUnlikely((proc->Cr[RS] & RS_USER) != 0)) {
-		// Ope, privilege violation.
+#if XR_SIMULATE_CACHES
+	proc->IcReplacementIndex = 0;
+	proc->DcReplacementIndex = 0;
 
-		XrBasicException(proc, XR_EXC_PRV, proc->Pc);
+	proc->WbWriteIndex = 0;
+	proc->WbCycles = 0;
+	proc->WbFillIndex = 0;
 
-		XR_EARLY_EXIT();
+	for (int i = 0; i < XR_WB_DEPTH; i++) {
+		proc->WbIndices[i] = XR_CACHE_INDEX_INVALID;
 	}
 
-	proc->Halted = true;
+	for (int i = 0; i < XR_DC_LINE_COUNT; i++) {
+		proc->DcIndexToWbIndex[i] = XR_WB_INDEX_INVALID;
+	}
+#endif
 
-	proc->Pc += 4;
+#ifdef PROFCPU
+	proc->IcMissCount = 0;
+	proc->IcHitCount = 0;
 
-	XR_TRIVIAL_EXIT();
-}
+	proc->DcMissCount = 0;
+	proc->DcHitCount = 0;
 
-XR_PRESERVE_NONE
-static void XrExecuteMtcr(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 32\n");
+	proc->FusedBranchCount = 0;
+	proc->FusedConstantCount = 0;
+	proc->FusedAbsoluteCount = 0;
 
-	if (XrUnlikely((proc->Cr[RS] & RS_USER) != 0)) {
-		// Ope, privilege violation.
+	proc->TraceGuardCount = 0;
+	proc->TraceExitCount = 0;
 
-		XrBasicException(proc, XR_EXC_PRV, proc->Pc);
+	proc->OptimizedFoldCount = 0;
+	proc->OptimizedDeadCount = 0;
+	proc->DirectAccessCount = 0;
+	proc->SpinSkipCount = 0;
+	proc->DtbCacheHitCount = 0;
+	proc->DtbCacheMissCount = 0;
+	proc->SoftTlbHitCount = 0;
+	proc->SoftTlbMissCount = 0;
 
-		XR_EARLY_EXIT();
-	}
+	proc->TimeToNextPrint = 0;
+#endif
 
-	// Reset the NMI mask counter.
+#if XR_SIMULATE_CACHE_STALLS
+	proc->StallCycles = 0;
+#endif
+	proc->PauseCalls = 0;
+	proc->SpinCount = 0;
 
 	proc->NmiMaskCounter = NMI_MASK_CYCLES;
+	proc->LastTbMissWasWrite = 0;
+	proc->UserBreak = 0;
+	proc->Halted = 0;
+	proc->Running = 1;
+	proc->Dispatches = 0;
+}
 
-	uint32_t ra = inst->Imm8_1;
-	uint32_t rb = inst->Imm8_2;
+static inline void XrPushMode(XrProcessor *proc) {
+	// "Push" the mode stack bits in RS.
 
-	switch(rb) {
-		case ICACHECTRL:
-#if XR_SIMULATE_CACHES
-			if ((proc->Reg[ra] & 3) == 3) {
-				// Invalidate the entire Icache.
+	proc->Cr[RS] = (proc->Cr[RS] & 0xFF0000FF) | ((proc->Cr[RS] & 0xFFFF) << 8);
+}
 
-				for (int i = 0; i < XR_IC_LINE_COUNT; i++) {
-					proc->IcFlags[i] = XR_LINE_INVALID;
-				}
-			} else if ((proc->Reg[ra] & 3) == 2) {
-				// Invalidate a single page frame of the
-				// Icache. We can use clever math to only
-				// search the cache lines that lines within
-				// this page frame could possibly be in.
+static inline void XrSetEcause(XrProcessor *proc, uint32_t exc) {
+	// Set the ECAUSE code in RS.
 
-				uint32_t phys = proc->Reg[ra] & 0xFFFFF000;
+	proc->Cr[RS] = (proc->Cr[RS] & 0x0FFFFFFF) | (exc << 28);
+}
 
-				uint32_t lowindex = ((phys >> XR_IC_LINE_SIZE_LOG) & (XR_IC_SETS - 1)) << XR_IC_WAY_LOG;
-				uint32_t highindex = (((phys + 4096) >> XR_IC_LINE_SIZE_LOG) & (XR_IC_SETS - 1)) << XR_IC_WAY_LOG;
+static inline void XrVectorException(XrProcessor *proc, uint32_t exc) {
+	// This implements stuff that is common to all exceptions.
+	// Note that it does NOT push the mode stack, save PC into EPC, or set the
+	// exception code in RS.
 
-				for (int i = lowindex; i < highindex; i++) {
-					if ((proc->IcTags[i] & 0xFFFFF000) == phys) {
-						proc->IcFlags[i] = XR_LINE_INVALID;
-					}
-				}
-			}
-#endif
+	if (XrUnlikely(proc->Cr[EB] == 0)) {
+		// Reset the processor.
 
-			// Dump the whole Iblock cache.
+		XrReset(proc);
 
-			XrInvalidateIblockCache(proc);
+		return;
+	}
 
-			proc->Pc += 4;
+	DBGPRINT("exc %d\n", exc);
+	// proc->Running = false;
 
-			XR_EARLY_EXIT();
+	// Build new mode bits.
+	// Enter kernel mode and disable interrupts.
 
-		case DCACHECTRL:
-#if XR_SIMULATE_CACHES
-			XrFlushWriteBuffer(proc);
+	uint32_t newmode = proc->Cr[RS] & 0xFC;
 
-			if ((proc->Reg[ra] & 3) == 3) {
-				// Invalidate the entire Dcache.
+	if (XrUnlikely((proc->Cr[RS] & RS_LEGACY) != 0)) {
+		// Legacy exceptions are enabled, so disable virtual addressing. This is
+		// NOT part of the "official" xr17032 architecture and is a hack to
+		// continue running AISIX in emulation.
 
-				for (int i = 0; i < XR_DC_LINE_COUNT; i++) {
-					proc->DcFlags[i] = XR_LINE_INVALID;
-				}
-			} else if ((proc->Reg[ra] & 3) == 2) {
-				// Invalidate a single page frame of the
-				// Dcache. We can use clever math to only
-				// search the cache lines that lines within
-				// this page frame could possibly be in.
+		newmode &= ~RS_MMU;
+	}
 
-				uint32_t phys = proc->Reg[ra] & 0xFFFFF000;
+	// The handler runs in between two iterations of any spin loop that was
+	// interrupted, so those iterations aren't in a row.
 
-				uint32_t lowindex = ((phys >> XR_DC_LINE_SIZE_LOG) & (XR_DC_SETS - 1)) << XR_DC_WAY_LOG;
-				uint32_t highindex = (((phys + 4096) >> XR_DC_LINE_SIZE_LOG) & (XR_DC_SETS - 1)) << XR_DC_WAY_LOG;
+	proc->SpinCount = 0;
 
-				for (int i = lowindex; i < highindex; i++) {
-					if ((proc->DcTags[i] & 0xFFFFF000) == phys) {
-						proc->DcFlags[i] = XR_LINE_INVALID;
-					}
-				}
-			}
-#endif
+	// Redirect PC to the exception vector.
 
-			break;
+	proc->Pc = proc->Cr[EB] | (exc << 8);
 
-		case ITBCTRL:
-			if ((proc->Reg[ra] & 3) == 3) {
-				// Invalidate the entire ITB.
+	// Set the mode bits in RS.
 
-				for (int i = 0; i < XR_ITB_SIZE; i++) {
-					proc->Itb[i] = TB_INVALID_ENTRY;
-				}
-			} else if ((proc->Reg[ra] & 3) == 2) {
-				// Invalidate the entire ITB except for
-				// global and reserved entries.
+	proc->Cr[RS] = (proc->Cr[RS] & 0xFFFFFF00) | newmode;
 
-				for (int i = 4; i < XR_ITB_SIZE; i++) {
-					if ((proc->Itb[i] & PTE_GLOBAL) == 0) {
-						proc->Itb[i] = TB_INVALID_ENTRY;
-					}
-				}
-			} else if ((proc->Reg[ra] & 3) == 1) {
-				// Invalidate the entire ITB except for
-				// reserved entries.
+	// Reset the NMI mask counter.
 
-				for (int i = 4; i < XR_ITB_SIZE; i++) {
-					proc->Itb[i] = TB_INVALID_ENTRY;
-				}
-			} else if ((proc->Reg[ra] & 3) == 0) {
-				// Invalidate a single page in the ITB.
+	proc->NmiMaskCounter = NMI_MASK_CYCLES;
 
-				uint64_t vpn = (uint64_t)(proc->Reg[ra] >> 12) << 32;
+	// Reset the "progress", allowing more polling.
 
-				for (int i = 0; i < XR_ITB_SIZE; i++) {
-					if ((proc->Itb[i] & 0x000FFFFF00000000) == vpn) {
-						proc->Itb[i] = TB_INVALID_ENTRY;
-					}
-				}
+	proc->Progress = XR_POLL_MAX;
+}
 
-				// We can be a little more optimized when livalidating a single
-				// page.
+static inline void XrBasicException(XrProcessor *proc, uint32_t exc, uint32_t pc) {
+	// "Basic" exceptions that behave the same way every time.
 
-				// Only invalidate the lookup hint if it matches this VPN.
+	proc->Cr[EPC] = pc;
 
-				if (proc->ItbLastVpn == proc->Reg[ra] >> 12) {
-					proc->ItbLastVpn = -1;
-				}
+	XrPushMode(proc);
+	XrSetEcause(proc, exc);
+	XrVectorException(proc, exc);
+}
 
-				// Only invalidate the Iblocks that reside in this VPN.
+static XR_ALWAYS_INLINE int XrSearchTb(uint64_t *tb, int size, uint32_t matching) {
+	// Return the index of the first entry in the TB that matches the given
+	// ASID and VPN, or -1 if there is none. Global entries match any ASID.
 
-				proc->Pc += 4;
+#ifdef __SSE2__
+	// Compare four entries at a time. Each entry has its tag in the high half
+	// and its flags in the low half, so deinterleave the halves, clear the
+	// ASID bits of the difference for global entries, and look for zeroes.
 
-				XrInvalidateIblockCacheByVpn(proc, proc->Reg[ra] & ~0xFFF);
+	__m128i matchingvec = _mm_set1_epi32(matching);
+	__m128i globalvec = _mm_set1_epi32(PTE_GLOBAL);
+	__m128i asidvec = _mm_set1_epi32(0xFFF00000);
 
-				XR_EARLY_EXIT();
-			}
+	for (int i = 0; i < size; i += 4) {
+		__m128 first = _mm_loadu_ps((float *)&tb[i]);
+		__m128 second = _mm_loadu_ps((float *)&tb[i + 2]);
 
-			// Reset the lookup hint.
+		__m128i flags = _mm_castps_si128(_mm_shuffle_ps(first, second, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i tags = _mm_castps_si128(_mm_shuffle_ps(first, second, _MM_SHUFFLE(3, 1, 3, 1)));
 
-			proc->ItbLastVpn = -1;
+		__m128i global = _mm_cmpeq_epi32(_mm_and_si128(flags, globalvec), globalvec);
+		__m128i diff = _mm_andnot_si128(_mm_and_si128(global, asidvec), _mm_xor_si128(tags, matchingvec));
 
-			// Dump the whole Iblock cache.
+		int hits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(diff, _mm_setzero_si128())));
 
-			XrInvalidateIblockCache(proc);
+		if (hits) {
+			return i + __builtin_ctz(hits);
+		}
+	}
+#else
+	for (int i = 0; i < size; i++) {
+		uint64_t tmp = tb[i];
 
-			proc->Pc += 4;
+		uint32_t mask = (tmp & PTE_GLOBAL) ? 0xFFFFF : 0xFFFFFFFF;
 
-			XR_EARLY_EXIT();
+		if (((tmp >> 32) & mask) == (matching & mask)) {
+			return i;
+		}
+	}
+#endif
 
-		case DTBCTRL:
-			if ((proc->Reg[ra] & 3) == 3) {
-				// Invalidate the entire DTB.
+	return -1;
+}
 
-				for (int i = 0; i < XR_DTB_SIZE; i++) {
-					proc->Dtb[i] = TB_INVALID_ENTRY;
-				}
-			} else if ((proc->Reg[ra] & 3) == 2) {
-				// Invalidate the entire DTB except for
-				// global and reserved entries.
+#ifdef FASTMEMORY
 
-				for (int i = 4; i < XR_DTB_SIZE; i++) {
-					if ((proc->Dtb[i] & PTE_GLOBAL) == 0) {
-						proc->Dtb[i] = TB_INVALID_ENTRY;
-					}
-				}
-			} else if ((proc->Reg[ra] & 3) == 1) {
-				// Invalidate the entire DTB except for
-				// reserved entries.
+#include "xrfastaccess.inc.c"
 
-				for (int i = 4; i < XR_DTB_SIZE; i++) {
-					proc->Dtb[i] = TB_INVALID_ENTRY;
-				}
-			} else if ((proc->Reg[ra] & 3) == 0) {
-				// Invalidate a single page in the DTB.
+#else
 
-				uint64_t vpn = (uint64_t)(proc->Reg[ra] >> 12) << 32;
+#include "xraccess.inc.c"
 
-				for (int i = 0; i < XR_DTB_SIZE; i++) {
-					if ((proc->Dtb[i] & 0x000FFFFF00000000) == vpn) {
-						proc->Dtb[i] = TB_INVALID_ENTRY;
-					}
-				}
+#endif
 
-				// Only invalidate the lookup hint if it matches this VPN.
+static XrIblock *XrDecodeInstructions(XrProcessor *proc, XrIblock *hazard);
 
-				if (proc->DtbLastVpn == proc->Reg[ra] >> 12) {
-					proc->DtbLastVpn = -1;
-				}
+#ifdef XR_JIT
 
-				break;
-			}
+static void XrJitPromoteIblock(XrProcessor *proc, XrIblock *iblock);
 
-			// Reset the lookup hint.
+// Count down the dispatches of an Iblock until it's hot enough to be given
+// to the native code tier.
 
-			proc->DtbLastVpn = -1;
+#define XR_JIT_COUNT(nextblock) \
+	if (XrUnlikely(--(nextblock)->Heat == 0)) { \
+		XrJitPromoteIblock(proc, nextblock); \
+	}
 
-			break;
+#else
 
-		case ITBPTE:
-			// Write an entry to the ITB at ITBINDEX, and
-			// increment it.
+#define XR_JIT_COUNT(nextblock)
 
-			proc->Itb[proc->Cr[ITBINDEX]] = ((uint64_t)(proc->Cr[ITBTAG]) << 32) | proc->Reg[ra];
+#endif
 
-			//DBGPRINT("ITB[%d] = %llx\n", ControlReg[ITBINDEX], ITlb[ControlReg[ITBINDEX]]);
+XR_PRESERVE_NONE
+static void XrCheckConditions(XrProcessor *proc, XrIblock *nextblock, XrCachedInst *inst) {
+	// Check if any conditions are true that indicate we should terminate
+	// the execution chain.
 
-			proc->Cr[ITBINDEX] += 1;
+#if XR_SIMULATE_CACHES
+	if (proc->WbCycles) {
+		// Assume enough cycles have passed to empty the writebuffer at no
+		// charge.
 
-			if (proc->Cr[ITBINDEX] == XR_ITB_SIZE) {
-				// Roll over to index four.
+		proc->WbCycles = 0;
+		XrFlushWriteBuffer(proc);
+	}
+#endif
 
-				proc->Cr[ITBINDEX] = 4;
-			}
+retry:
 
-			break;
+	if (XrUnlikely(proc->CyclesDone >= proc->CyclesGoal)) {
+		proc->NoMore = 1;
+		return;
+	}
 
-		case DTBPTE:
-			// Write an entry to the DTB at DTBINDEX, and
-			// increment it.
+	if (XrUnlikely(proc->Halted)) {
+		proc->NoMore = 1;
+		return;
+	}
 
-			proc->Dtb[proc->Cr[DTBINDEX]] = ((uint64_t)(proc->Cr[DTBTAG]) << 32) | proc->Reg[ra];
+	if (XrUnlikely(proc->PauseCalls >= XR_PAUSE_MAX)) {
+		proc->NoMore = 1;
+		return;
+	}
 
-			//DBGPRINT("DTB[%d] = %llx\n", ControlReg[DTBINDEX], DTlb[ControlReg[DTBINDEX]]);
+	if (XrUnlikely(proc->NmiMaskCounter != 0)) {
+		proc->NmiMaskCounter--;
+	}
 
-			proc->Cr[DTBINDEX] += 1;
+	Lsic *lsic = &LsicTable[proc->Id];
 
-			if (proc->Cr[DTBINDEX] == XR_DTB_SIZE) {
-				// Roll over to index four.
+	if (XrUnlikely(lsic->InterruptPending && (proc->Cr[RS] & RS_INT))) {
+		// Interrupts are enabled and there's an interrupt pending, so cause
+		// an interrupt exception.
 
-				proc->Cr[DTBINDEX] = 4;
-			}
+		// N.B. There's an assumption here that the host platform will make
+		// writes by other host cores to the interrupt pending flag visible
+		// to us in a timely manner, without needing any barriers.
 
-			break;
+		XrBasicException(proc, XR_EXC_INT, proc->Pc);
 
-		case ITBINDEX:
-			proc->Cr[ITBINDEX] = proc->Reg[ra] & (XR_ITB_SIZE - 1);
-			break;
+		// Reset the poll counter so as not to penalize the processor for
+		// handling the interrupt.
 
-		case DTBINDEX:
-			proc->Cr[DTBINDEX] = proc->Reg[ra] & (XR_DTB_SIZE - 1);
-			break;
+		proc->Progress = XR_POLL_MAX;
 
-		case DTBTAG:
-			proc->Cr[DTBTAG] = proc->Reg[ra];
+		// Make sure we re-lookup the Iblock.
 
-			// Reset the lookup hint.
+		nextblock = 0;
+	}
 
-			proc->DtbLastVpn = -1;
+	if (XrUnlikely(!nextblock)) {
+		nextblock = XrDecodeInstructions(proc, 0);
 
-			break;
+		if (XrUnlikely(!nextblock)) {
+			// An exception occurred while performing instruction fetch.
+			// Loop and let the exception handler execute.
 
-		case ITBTAG:
-			proc->Cr[ITBTAG] = proc->Reg[ra];
+			proc->CyclesDone += XR_IBLOCK_INSTS;
 
-			// Reset the lookup hint.
+			goto retry;
+		}
+	}
 
-			proc->ItbLastVpn = -1;
-			
-			break;
+	XR_JIT_COUNT(nextblock);
 
-		default:
-			proc->Cr[rb] = proc->Reg[ra];
-			break;
-	}
+	// Call it directly.
 
-	XR_NEXT();
+	XR_TAIL return nextblock->Insts[0].Func(proc, nextblock, &nextblock->Insts[0]);
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteMfcr(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 33\n");
+// The program counter isn't kept up to date as straight-line code executes
+// within an Iblock. Instead, each cached instruction records the index of its
+// guest instruction within the Iblock and the trace segment it's part of, and
+// proc->Pc is computed from that only when it's actually needed: before
+// anything that might cause an exception, and whenever control leaves the
+// Iblock.
 
-	if (proc->Cr[RS] & RS_USER) {
-		// Ope, privilege violation.
+#define XR_CURRENT_PC() (block->PcBias[XR_PC_OFFSET_SEGMENT(inst->PcOffset)] + ((uint32_t)XR_PC_OFFSET_INDEX(inst->PcOffset) << 2))
+#define XR_SYNC_PC() proc->Pc = XR_CURRENT_PC();
 
-		XrBasicException(proc, XR_EXC_PRV, proc->Pc);
+#define XR_NEXT() inst++; XR_TAIL return inst->Func(proc, block, inst);
 
-		XR_EARLY_EXIT();
+// With shared Iblocks, an Iblock reached through a cached pointer might have
+// last been validated in a different address space, in which case take the
+// long way around so that its PC is translated again.
+
+#define XR_CHECK_ADDRESS_SPACE(nextblock) \
+	if (XrUnlikely(XrSharedIblocks) && XrUnlikely((nextblock)->Asid != XR_CURRENT_ASID())) { \
+		XR_TAIL return XrCheckConditions(proc, 0, 0); \
 	}
 
-	// Reset the NMI mask counter.
+#define XR_DISPATCH(nextblock) \
+	proc->CyclesDone += block->Cycles; \
+	if (XrUnlikely((proc->Dispatches++ & 31) == 0)) { \
+		return; \
+	} \
+	XR_CHECK_ADDRESS_SPACE(nextblock); \
+	XR_JIT_COUNT(nextblock); \
+	XR_TAIL return nextblock->Insts[0].Func(proc, nextblock, &nextblock->Insts[0]);
 
-	proc->NmiMaskCounter = NMI_MASK_CYCLES;
+#define XR_TRIVIAL_EXIT() \
+	proc->CyclesDone += block->Cycles; \
+	XR_TAIL return XrCheckConditions(proc, 0, 0);
 
-	proc->Reg[inst->Imm8_1] = proc->Cr[inst->Imm8_2];
+#define XR_EARLY_EXIT() \
+	XR_EARLY_EXIT_AT(XR_PC_OFFSET_INDEX(inst->PcOffset));
 
-	XR_NEXT();
-}
+// Leave the Iblock, charging for the instructions before the given index. For
+// handlers that may have freed the Iblock, and with it the instruction.
 
-XR_PRESERVE_NONE
-static void XrExecuteBpo(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 34\n");
+#define XR_EARLY_EXIT_AT(index) \
+	proc->CyclesDone += (index); \
+	return;
 
-	uint32_t rd = inst->Imm8_1;
+#define XR_REG_RD() proc->Reg[inst->Imm8_1]
+#define XR_REG_RA() proc->Reg[inst->Imm8_2]
+#define XR_REG_RB() proc->Reg[inst->Imm32_1]
 
-	XrIblock *iblock;
-	XrIblock **referrent;
+#if !XR_SIMULATE_CACHES
 
-	if (proc->Reg[rd] & 1) {
-		proc->Pc = inst->Imm32_1;
-		referrent = &block->CachedPaths[XR_TRUE_PATH];
-	} else {
-		proc->Pc += 4;
-		referrent = &block->CachedPaths[XR_FALSE_PATH];
-	}
+static int XrRecordBranchBias(XrProcessor *proc, XrIblock *block, uint32_t pc) {
+	// A profiling window has finished for the branch that terminates this
+	// Iblock. If it went the same way nearly every time, remember that so that
+	// the next decode can continue the Iblock along that direction, and return
+	// 1 to indicate that the Iblock should be thrown out to make that happen.
 
-	iblock = *referrent;
+	uint32_t taken = block->TakenCount;
 
-	if (XrUnlikely(!iblock)) {
-		iblock = XrDecodeInstructions(proc, block);
+	block->ProfileCount = 0;
+	block->TakenCount = 0;
 
-		if (XrUnlikely(!iblock)) {
-			XR_EARLY_EXIT();
-		}
+	uint32_t direction;
 
-		XrCreateCachedPointerToBlock(iblock, referrent);
+	if (taken >= XR_TRACE_PROFILE - XR_TRACE_PROFILE / 16) {
+		direction = 1;
+	} else if (taken <= XR_TRACE_PROFILE / 16) {
+		direction = 0;
+	} else {
+		return 0;
 	}
 
-	XR_DISPATCH(iblock);
-}
+	XrBranchBias *bias = &proc->BranchBias[XR_BRANCH_BIAS_INDEX(pc)];
 
-XR_PRESERVE_NONE
-static void XrExecuteBpe(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 35\n");
+	bias->Pc = pc;
+	bias->Taken = direction;
 
-	uint32_t rd = inst->Imm8_1;
+	return 1;
+}
 
-	XrIblock *iblock;
-	XrIblock **referrent;
+// Profile the direction of a conditional branch that ends an extendable
+// Iblock. If it turns out to be biased, free the Iblock and leave the chain;
+// proc->Pc has already been set to the next instruction.
 
-	if ((proc->Reg[rd] & 1) == 0) {
-		proc->Pc = inst->Imm32_1;
-		referrent = &block->CachedPaths[XR_TRUE_PATH];
-	} else {
-		proc->Pc += 4;
-		referrent = &block->CachedPaths[XR_FALSE_PATH];
+#define XR_PROFILE_BRANCH(taken, branchpc) \
+	if (XrUnlikely(block->Extendable)) { \
+		block->TakenCount += (taken); \
+		if (XrUnlikely(++block->ProfileCount == XR_TRACE_PROFILE) && \
+			XrRecordBranchBias(proc, block, (branchpc))) { \
+			proc->CyclesDone += block->Cycles; \
+			XrInvalidateIblockPointers(block); \
+			XrFreeIblock(proc, block); \
+			return; \
+		} \
 	}
 
-	iblock = *referrent;
+#else
 
-	if (XrUnlikely(!iblock)) {
-		iblock = XrDecodeInstructions(proc, block);
+#define XR_PROFILE_BRANCH(taken, branchpc)
 
-		if (XrUnlikely(!iblock)) {
-			XR_EARLY_EXIT();
-		}
+#endif
 
-		XrCreateCachedPointerToBlock(iblock, referrent);
-	}
+#define XR_CURRENT_ASID() ((XrLikely(proc->Cr[RS] & RS_MMU) != 0) ? (proc->Cr[ITBTAG] & 0xFFF00000) : 0xFFFFFFFF)
 
-	XR_DISPATCH(iblock);
+XR_PRESERVE_NONE
+static void XrExecuteIllegalInstruction(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 1\n");
+
+	XrBasicException(proc, XR_EXC_INV, XR_CURRENT_PC());
+
+	XR_TRIVIAL_EXIT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteBge(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 36\n");
+static void XrExecuteNor(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 2\n");
 
-	uint32_t rd = inst->Imm8_1;
+	XR_REG_RD() = ~(XR_REG_RA() | XR_REG_RB());
 
-	XrIblock *iblock;
-	XrIblock **referrent;
+	XR_NEXT();
+}
 
-	if ((int32_t)proc->Reg[rd] >= 0) {
-		proc->Pc = inst->Imm32_1;
-		referrent = &block->CachedPaths[XR_TRUE_PATH];
-	} else {
-		proc->Pc += 4;
-		referrent = &block->CachedPaths[XR_FALSE_PATH];
-	}
+XR_PRESERVE_NONE
+static void XrExecuteOr(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 3\n");
 
-	iblock = *referrent;
+	XR_REG_RD() = XR_REG_RA() | XR_REG_RB();
 
-	if (XrUnlikely(!iblock)) {
-		iblock = XrDecodeInstructions(proc, block);
+	XR_NEXT();
+}
 
-		if (XrUnlikely(!iblock)) {
-			XR_EARLY_EXIT();
-		}
+XR_PRESERVE_NONE
+static void XrExecuteXor(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 4\n");
 
-		XrCreateCachedPointerToBlock(iblock, referrent);
-	}
+	XR_REG_RD() = XR_REG_RA() ^ XR_REG_RB();
 
-	XR_DISPATCH(iblock);
+	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteBle(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 37\n");
+static void XrExecuteAnd(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 5\n");
 
-	uint32_t rd = inst->Imm8_1;
+	XR_REG_RD() = XR_REG_RA() & XR_REG_RB();
 
-	XrIblock *iblock;
-	XrIblock **referrent;
+	XR_NEXT();
+}
 
-	if ((int32_t)proc->Reg[rd] <= 0) {
-		proc->Pc = inst->Imm32_1;
-		referrent = &block->CachedPaths[XR_TRUE_PATH];
+XR_PRESERVE_NONE
+static void XrExecuteSltSigned(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 6\n");
+
+	if ((int32_t) XR_REG_RA() < (int32_t) XR_REG_RB()) {
+		XR_REG_RD() = 1;
 	} else {
-		proc->Pc += 4;
-		referrent = &block->CachedPaths[XR_FALSE_PATH];
+		XR_REG_RD() = 0;
 	}
 
-	iblock = *referrent;
-
-	if (XrUnlikely(!iblock)) {
-		iblock = XrDecodeInstructions(proc, block);
+	XR_NEXT();
+}
 
-		if (XrUnlikely(!iblock)) {
-			XR_EARLY_EXIT();
-		}
+XR_PRESERVE_NONE
+static void XrExecuteSlt(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 7\n");
 
-		XrCreateCachedPointerToBlock(iblock, referrent);
+	if (XR_REG_RA() < XR_REG_RB()) {
+		XR_REG_RD() = 1;
+	} else {
+		XR_REG_RD() = 0;
 	}
 
-	XR_DISPATCH(iblock);
+	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteBgt(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 38\n");
+static void XrExecuteSub(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 8\n");
 
-	uint32_t rd = inst->Imm8_1;
+	XR_REG_RD() = XR_REG_RA() - XR_REG_RB();
 
-	XrIblock *iblock;
-	XrIblock **referrent;
+	XR_NEXT();
+}
 
-	if ((int32_t)proc->Reg[rd] > 0) {
-		proc->Pc = inst->Imm32_1;
-		referrent = &block->CachedPaths[XR_TRUE_PATH];
-	} else {
-		proc->Pc += 4;
-		referrent = &block->CachedPaths[XR_FALSE_PATH];
-	}
+XR_PRESERVE_NONE
+static void XrExecuteAdd(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
 
-	iblock = *referrent;
-
-	if (XrUnlikely(!iblock)) {
-		iblock = XrDecodeInstructions(proc, block);
-
-		if (XrUnlikely(!iblock)) {
-			XR_EARLY_EXIT();
-		}
+	DBGPRINT("exec 9\n");
 
-		XrCreateCachedPointerToBlock(iblock, referrent);
-	}
+	XR_REG_RD() = XR_REG_RA() + XR_REG_RB();
 
-	XR_DISPATCH(iblock);
+	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteBlt(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 39\n");
+static void XrExecuteLsh(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 10\n");
 
-	uint32_t rd = inst->Imm8_1;
+	XR_REG_RD() = XR_REG_RB() << (XR_REG_RA() & 31);
 
-	XrIblock *iblock;
-	XrIblock **referrent;
+	XR_NEXT();
+}
 
-	if ((int32_t)proc->Reg[rd] < 0) {
-		proc->Pc = inst->Imm32_1;
-		referrent = &block->CachedPaths[XR_TRUE_PATH];
-	} else {
-		proc->Pc += 4;
-		referrent = &block->CachedPaths[XR_FALSE_PATH];
-	}
+XR_PRESERVE_NONE
+static void XrExecuteRsh(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 11\n");
 
-	iblock = *referrent;
+	XR_REG_RD() = XR_REG_RB() >> (XR_REG_RA() & 31);
 
-	if (XrUnlikely(!iblock)) {
-		iblock = XrDecodeInstructions(proc, block);
+	XR_NEXT();
+}
 
-		if (XrUnlikely(!iblock)) {
-			XR_EARLY_EXIT();
-		}
+XR_PRESERVE_NONE
+static void XrExecuteAsh(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 12\n");
 
-		XrCreateCachedPointerToBlock(iblock, referrent);
-	}
+	XR_REG_RD() = (int32_t) XR_REG_RB() >> (XR_REG_RA() & 31);
 
-	XR_DISPATCH(iblock);
+	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteBne(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 40\n");
+static void XrExecuteRor(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 13\n");
 
-	uint32_t rd = inst->Imm8_1;
+	XR_REG_RD() = RoR(XR_REG_RB(), XR_REG_RA() & 31);
 
-	XrIblock *iblock;
-	XrIblock **referrent;
+	XR_NEXT();
+}
 
-	if (proc->Reg[rd] != 0) {
-		proc->Pc = inst->Imm32_1;
-		referrent = &block->CachedPaths[XR_TRUE_PATH];
-	} else {
-		proc->Pc += 4;
-		referrent = &block->CachedPaths[XR_FALSE_PATH];
-	}
+XR_PRESERVE_NONE
+static void XrExecuteStoreLongRegOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 14\n");
 
-	iblock = *referrent;
+	XR_SYNC_PC();
 
-	if (XrUnlikely(!iblock)) {
-		iblock = XrDecodeInstructions(proc, block);
+	int status = XrWriteLong(proc, XR_REG_RA() + XR_REG_RB(), XR_REG_RD());
 
-		if (XrUnlikely(!iblock)) {
-			XR_EARLY_EXIT();
-		}
+	if (XrUnlikely(!status)) {
+		// An exception occurred, so perform an early exit from the basic block.
 
-		XrCreateCachedPointerToBlock(iblock, referrent);
+		XR_EARLY_EXIT();
 	}
 
-	XR_DISPATCH(iblock);
+	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteBeq(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 41\n");
-
-	uint32_t rd = inst->Imm8_1;
-
-	XrIblock *iblock;
-	XrIblock **referrent;
-
-	if (proc->Reg[rd] == 0) {
-		proc->Pc = inst->Imm32_1;
-		referrent = &block->CachedPaths[XR_TRUE_PATH];
-	} else {
-		proc->Pc += 4;
-		referrent = &block->CachedPaths[XR_FALSE_PATH];
-	}
+static void XrExecuteStoreIntRegOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 15\n");
 
-	iblock = *referrent;
+	XR_SYNC_PC();
 
-	if (XrUnlikely(!iblock)) {
-		iblock = XrDecodeInstructions(proc, block);
+	int status = XrWriteInt(proc, XR_REG_RA() + XR_REG_RB(), XR_REG_RD());
 
-		if (XrUnlikely(!iblock)) {
-			XR_EARLY_EXIT();
-		}
+	if (XrUnlikely(!status)) {
+		// An exception occurred, so perform an early exit from the basic block.
 
-		XrCreateCachedPointerToBlock(iblock, referrent);
+		XR_EARLY_EXIT();
 	}
 
-	XR_DISPATCH(iblock);
+	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteB(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 42\n");
-
-	proc->Pc = inst->Imm32_1;
+static void XrExecuteStoreByteRegOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 16\n");
 
-	XrIblock *iblock = block->CachedPaths[XR_TRUE_PATH];
+	XR_SYNC_PC();
 
-	if (XrUnlikely(!iblock)) {
-		iblock = XrDecodeInstructions(proc, block);
+	int status = XrWriteByte(proc, XR_REG_RA() + XR_REG_RB(), XR_REG_RD());
 
-		if (XrUnlikely(!iblock)) {
-			XR_EARLY_EXIT();
-		}
+	if (XrUnlikely(!status)) {
+		// An exception occurred, so perform an early exit from the basic block.
 
-		XrCreateCachedPointerToBlock(iblock, &block->CachedPaths[XR_TRUE_PATH]);
+		XR_EARLY_EXIT();
 	}
 
-	XR_DISPATCH(iblock);
+	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteOri(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 43\n");
-
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
-
-	proc->Reg[rd] = proc->Reg[ra] | imm;
+static void XrExecuteLoadLongRegOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 17\n");
 
-	XR_NEXT();
-}
+	XR_SYNC_PC();
 
-XR_PRESERVE_NONE
-static void XrExecuteXori(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 44\n");
+	int status = XrReadLong(proc, XR_REG_RA() + XR_REG_RB(), &XR_REG_RD());
 
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
+	if (XrUnlikely(!status)) {
+		// An exception occurred, so perform an early exit from the basic block.
 
-	proc->Reg[rd] = proc->Reg[ra] ^ imm;
+		XR_EARLY_EXIT();
+	}
 
 	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteAndi(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 45\n");
+static void XrExecuteLoadIntRegOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 18\n");
 
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
+	XR_SYNC_PC();
 
-	proc->Reg[rd] = proc->Reg[ra] & imm;
+	int status = XrReadInt(proc, XR_REG_RA() + XR_REG_RB(), &XR_REG_RD());
+
+	if (XrUnlikely(!status)) {
+		// An exception occurred, so perform an early exit from the basic block.
+
+		XR_EARLY_EXIT();
+	}
 
 	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteSltiSigned(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 46\n");
+static void XrExecuteLoadByteRegOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 19\n");
 
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
+	XR_SYNC_PC();
 
-	if ((int32_t) proc->Reg[ra] < (int32_t) imm) {
-		proc->Reg[rd] = 1;
-	} else {
-		proc->Reg[rd] = 0;
+	int status = XrReadByte(proc, XR_REG_RA() + XR_REG_RB(), &XR_REG_RD());
+
+	if (XrUnlikely(!status)) {
+		// An exception occurred, so perform an early exit from the basic block.
+
+		XR_EARLY_EXIT();
 	}
 
 	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteSlti(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 47\n");
-
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
+static void XrExecuteSys(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 20\n");
 
-	if (proc->Reg[ra] < imm) {
-		proc->Reg[rd] = 1;
-	} else {
-		proc->Reg[rd] = 0;
-	}
+	XrBasicException(proc, XR_EXC_SYS, XR_CURRENT_PC() + 4);
 
-	XR_NEXT();
+	XR_TRIVIAL_EXIT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteSubi(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 48\n");
-
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
+static void XrExecuteBrk(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 21\n");
 
-	proc->Reg[rd] = proc->Reg[ra] - imm;
+	XrBasicException(proc, XR_EXC_BRK, XR_CURRENT_PC() + 4);
 
-	XR_NEXT();
+	XR_TRIVIAL_EXIT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteAddi(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 49\n");
+static void XrExecuteWmb(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 22\n");
 
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
+#if XR_SIMULATE_CACHES
+	XrFlushWriteBuffer(proc);
+#endif
 
-	proc->Reg[rd] = proc->Reg[ra] + imm;
+#if FASTMEMORY && !SINGLE_THREAD_MP
+	atomic_thread_fence(memory_order_release);
+#endif
 
 	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteStoreLongImmOffsetImm(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 50\n");
-
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
+static void XrExecuteMb(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 22\n");
 
-	int status = XrWriteLong(proc, proc->Reg[rd] + imm, SignExt5(ra));
+#if XR_SIMULATE_CACHES
+	XrFlushWriteBuffer(proc);
+#endif
 
-	if (XrUnlikely(!status)) {
-		XR_EARLY_EXIT();
-	}
+#if FASTMEMORY && !SINGLE_THREAD_MP
+	atomic_thread_fence(memory_order_acq_rel);
+#endif
 
 	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteStoreIntImmOffsetImm(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 51\n");
+static void XrExecutePause(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 23\n");
 
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
+	if (proc->PauseCalls++ >= XR_PAUSE_MAX) {
+		// Terminate execution.
 
-	int status = XrWriteInt(proc, proc->Reg[rd] + imm, SignExt5(ra));
+		proc->Pc = XR_CURRENT_PC() + 4;
 
-	if (XrUnlikely(!status)) {
 		XR_EARLY_EXIT();
 	}
 
@@ -1863,1074 +1921,3596 @@ static void XrExecuteStoreIntImmOffsetImm(XrProcessor *proc, XrIblock *block, Xr
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteStoreByteImmOffsetImm(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 52\n");
+static void XrExecuteSC(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 24\n");
 
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
+	if (XrUnlikely(!proc->Locked)) {
+		// Something happened on this processor that caused the
+		// lock to go away.
 
-	int status = XrWriteByte(proc, proc->Reg[rd] + imm, SignExt5(ra));
+		XR_REG_RD() = 0;
 
-	if (XrUnlikely(!status)) {
-		XR_EARLY_EXIT();
+		proc->QuantumEvents++;
+	} else {
+		// Store the word in a way that will atomically fail if we no longer
+		// have the cache line from LL's load. This is accomplished by passing
+		// sc=1 to XrAccess.
+
+		//DBGPRINT("%d: SC %d\n", proc->Id, proc->Reg[rb]);
+
+		XR_SYNC_PC();
+
+		int status = XrWriteLongSc(proc, XR_REG_RA(), XR_REG_RB());
+
+		if (XrUnlikely(!status)) {
+			XR_EARLY_EXIT();
+		}
+		
+		if (status == 2) {
+			// Another processor took the cache line away.
+
+			XR_REG_RD() = 0;
+
+			proc->QuantumEvents++;
+		} else {
+			XR_REG_RD() = 1;
+		}
 	}
 
 	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteStoreLongImmOffsetReg(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 53\n");
+static void XrExecuteLL(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 25\n");
 
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
+	XR_SYNC_PC();
 
-	int status = XrWriteLong(proc, proc->Reg[rd] + imm, proc->Reg[ra]);
+	int status = XrReadLongLl(proc, XR_REG_RA(), &XR_REG_RD());
 
 	if (XrUnlikely(!status)) {
 		XR_EARLY_EXIT();
 	}
 
+	proc->Locked = 1;
+
 	XR_NEXT();
 }
 
 XR_PRESERVE_NONE
-static void XrExecuteStoreIntImmOffsetReg(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 54\n");
+static void XrExecuteMod(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 26\n");
 
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
+	uint32_t val = XR_REG_RB();
+
+	if (val == 0) {
+		XR_REG_RD() = 0;
+	} else {
+		XR_REG_RD() = XR_REG_RA() % val;
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteDivSigned(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 27\n");
+
+	uint32_t val = XR_REG_RB();
+
+	if (val == 0) {
+		XR_REG_RD() = 0;
+	} else {
+		XR_REG_RD() = (int32_t) XR_REG_RA() / (int32_t) val;
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteDiv(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 28\n");
+
+	uint32_t val = XR_REG_RB();
+
+	if (val == 0) {
+		XR_REG_RD() = 0;
+	} else {
+		XR_REG_RD() = XR_REG_RA() / val;
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteMul(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 29\n");
+
+	XR_REG_RD() = XR_REG_RA() * XR_REG_RB();
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteRfe(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 30\n");
+
+	proc->Locked = 0;
+
+	uint32_t oldrs = proc->Cr[RS];
+
+	if (XrUnlikely((oldrs & RS_USER) != 0)) {
+		// Ope, privilege violation.
+
+		XrBasicException(proc, XR_EXC_PRV, XR_CURRENT_PC());
+
+		XR_EARLY_EXIT();
+	}
+
+	if (XrUnlikely((proc->Cr[RS] & RS_TBMISS) != 0)) {
+		proc->Pc = proc->Cr[TBPC];
+	} else {
+		proc->Pc = proc->Cr[EPC];
+	}
+
+	proc->Cr[RS] = (proc->Cr[RS] & 0xF0000000) | ((proc->Cr[RS] >> 8) & 0xFFFF);
+
+	XR_TRIVIAL_EXIT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteHlt(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 31\n");
+
+	if (XrUnlikely((proc->Cr[RS] & RS_USER) != 0)) {
+		// Ope, privilege violation.
+
+		XrBasicException(proc, XR_EXC_PRV, XR_CURRENT_PC());
+
+		XR_EARLY_EXIT();
+	}
+
+	proc->Halted = true;
+
+	proc->Pc = XR_CURRENT_PC() + 4;
+
+	XR_TRIVIAL_EXIT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteMtcr(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 32\n");
+
+	if (XrUnlikely((proc->Cr[RS] & RS_USER) != 0)) {
+		// Ope, privilege violation.
+
+		XrBasicException(proc, XR_EXC_PRV, XR_CURRENT_PC());
+
+		XR_EARLY_EXIT();
+	}
+
+	// Several of the cases below leave the Iblock, after possibly having
+	// freed it, so compute the program counter and the instruction's index up
+	// front.
+
+	XR_SYNC_PC();
+
+	uint32_t index = XR_PC_OFFSET_INDEX(inst->PcOffset);
+
+	// Reset the NMI mask counter.
+
+	proc->NmiMaskCounter = NMI_MASK_CYCLES;
+
+	uint32_t ra = inst->Imm8_1;
+	uint32_t rb = inst->Imm8_2;
+
+	switch(rb) {
+		case ICACHECTRL:
+#if XR_SIMULATE_CACHES
+			if ((proc->Reg[ra] & 3) == 3) {
+				// Invalidate the entire Icache.
+
+				for (int i = 0; i < XR_IC_LINE_COUNT; i++) {
+					proc->IcFlags[i] = XR_LINE_INVALID;
+				}
+			} else if ((proc->Reg[ra] & 3) == 2) {
+				// Invalidate a single page frame of the
+				// Icache. We can use clever math to only
+				// search the cache lines that lines within
+				// this page frame could possibly be in.
+
+				uint32_t phys = proc->Reg[ra] & 0xFFFFF000;
+
+				uint32_t lowindex = ((phys >> XR_IC_LINE_SIZE_LOG) & (XR_IC_SETS - 1)) << XR_IC_WAY_LOG;
+				uint32_t highindex = (((phys + 4096) >> XR_IC_LINE_SIZE_LOG) & (XR_IC_SETS - 1)) << XR_IC_WAY_LOG;
+
+				for (int i = lowindex; i < highindex; i++) {
+					if ((proc->IcTags[i] & 0xFFFFF000) == phys) {
+						proc->IcFlags[i] = XR_LINE_INVALID;
+					}
+				}
+			}
+#endif
+
+			if ((proc->Reg[ra] & 3) == 2) {
+				// Only dump the Iblocks that were fetched from
+				// this page frame.
+
+				XrInvalidateIblockCacheByPfn(proc, proc->Reg[ra] & 0xFFFFF000);
+
+#ifdef FASTMEMORY
+				if (XrSharedCodeStore) {
+					XrInvalidateSharedCodeByPfn(proc->Reg[ra] & 0xFFFFF000);
+				}
+#endif
+			} else {
+				// Dump the whole Iblock cache.
+
+				XrInvalidateIblockCache(proc);
+
+#ifdef FASTMEMORY
+				if (XrSharedCodeStore) {
+					XrInvalidateSharedCode();
+				}
+#endif
+			}
+
+			proc->Pc += 4;
+
+			XR_EARLY_EXIT_AT(index);
+
+		case DCACHECTRL:
+#if XR_SIMULATE_CACHES
+			XrFlushWriteBuffer(proc);
+
+			if ((proc->Reg[ra] & 3) == 3) {
+				// Invalidate the entire Dcache.
+
+				for (int i = 0; i < XR_DC_LINE_COUNT; i++) {
+					proc->DcFlags[i] = XR_LINE_INVALID;
+				}
+			} else if ((proc->Reg[ra] & 3) == 2) {
+				// Invalidate a single page frame of the
+				// Dcache. We can use clever math to only
+				// search the cache lines that lines within
+				// this page frame could possibly be in.
+
+				uint32_t phys = proc->Reg[ra] & 0xFFFFF000;
+
+				uint32_t lowindex = ((phys >> XR_DC_LINE_SIZE_LOG) & (XR_DC_SETS - 1)) << XR_DC_WAY_LOG;
+				uint32_t highindex = (((phys + 4096) >> XR_DC_LINE_SIZE_LOG) & (XR_DC_SETS - 1)) << XR_DC_WAY_LOG;
+
+				for (int i = lowindex; i < highindex; i++) {
+					if ((proc->DcTags[i] & 0xFFFFF000) == phys) {
+						proc->DcFlags[i] = XR_LINE_INVALID;
+					}
+				}
+			}
+#endif
+
+			break;
+
+		case ITBCTRL:
+			if ((proc->Reg[ra] & 3) == 3) {
+				// Invalidate the entire ITB.
+
+				for (int i = 0; i < XR_ITB_SIZE; i++) {
+					proc->Itb[i] = TB_INVALID_ENTRY;
+				}
+			} else if ((proc->Reg[ra] & 3) == 2) {
+				// Invalidate the entire ITB except for
+				// global and reserved entries.
+
+				for (int i = 4; i < XR_ITB_SIZE; i++) {
+					if ((proc->Itb[i] & PTE_GLOBAL) == 0) {
+						proc->Itb[i] = TB_INVALID_ENTRY;
+					}
+				}
+			} else if ((proc->Reg[ra] & 3) == 1) {
+				// Invalidate the entire ITB except for
+				// reserved entries.
+
+				for (int i = 4; i < XR_ITB_SIZE; i++) {
+					proc->Itb[i] = TB_INVALID_ENTRY;
+				}
+			} else if ((proc->Reg[ra] & 3) == 0) {
+				// Invalidate a single page in the ITB.
+
+				uint64_t vpn = (uint64_t)(proc->Reg[ra] >> 12) << 32;
+
+				for (int i = 0; i < XR_ITB_SIZE; i++) {
+					if ((proc->Itb[i] & 0x000FFFFF00000000) == vpn) {
+						proc->Itb[i] = TB_INVALID_ENTRY;
+					}
+				}
+
+				// We can be a little more optimized when livalidating a single
+				// page.
+
+				// Only invalidate the lookup hint if it matches this VPN.
+
+				if (proc->ItbLastVpn == proc->Reg[ra] >> 12) {
+					proc->ItbLastVpn = -1;
+				}
+
+				// Only invalidate the Iblocks that reside in this VPN.
+
+				proc->Pc += 4;
+
+				XrInvalidateIblockCacheByVpn(proc, proc->Reg[ra] & ~0xFFF);
+
+				XR_EARLY_EXIT_AT(index);
+			}
+
+			// Reset the lookup hint.
+
+			proc->ItbLastVpn = -1;
+
+			// Dump the whole Iblock cache.
+
+			XrInvalidateIblockCache(proc);
+
+			proc->Pc += 4;
+
+			XR_EARLY_EXIT_AT(index);
+
+		case DTBCTRL:
+			if ((proc->Reg[ra] & 3) == 3) {
+				// Invalidate the entire DTB.
+
+				for (int i = 0; i < XR_DTB_SIZE; i++) {
+					proc->Dtb[i] = TB_INVALID_ENTRY;
+				}
+			} else if ((proc->Reg[ra] & 3) == 2) {
+				// Invalidate the entire DTB except for
+				// global and reserved entries.
+
+				for (int i = 4; i < XR_DTB_SIZE; i++) {
+					if ((proc->Dtb[i] & PTE_GLOBAL) == 0) {
+						proc->Dtb[i] = TB_INVALID_ENTRY;
+					}
+				}
+			} else if ((proc->Reg[ra] & 3) == 1) {
+				// Invalidate the entire DTB except for
+				// reserved entries.
+
+				for (int i = 4; i < XR_DTB_SIZE; i++) {
+					proc->Dtb[i] = TB_INVALID_ENTRY;
+				}
+			} else if ((proc->Reg[ra] & 3) == 0) {
+				// Invalidate a single page in the DTB.
+
+				uint64_t vpn = (uint64_t)(proc->Reg[ra] >> 12) << 32;
+
+				for (int i = 0; i < XR_DTB_SIZE; i++) {
+					if ((proc->Dtb[i] & 0x000FFFFF00000000) == vpn) {
+						proc->Dtb[i] = TB_INVALID_ENTRY;
+					}
+				}
+
+				// Only invalidate the lookup hint if it matches this VPN.
+
+				if (proc->DtbLastVpn == proc->Reg[ra] >> 12) {
+					proc->DtbLastVpn = -1;
+				}
+
+#ifdef FASTMEMORY
+				XrInvalidateSoftTlbVpn(proc, proc->Reg[ra] >> 12);
+#endif
+
+				break;
+			}
+
+			// Reset the lookup hint.
+
+			proc->DtbLastVpn = -1;
+
+#ifdef FASTMEMORY
+			XrFlushSoftTlb(proc);
+#endif
+
+			break;
+
+		case ITBPTE:
+			// Write an entry to the ITB at ITBINDEX, and
+			// increment it.
+
+			proc->Itb[proc->Cr[ITBINDEX]] = ((uint64_t)(proc->Cr[ITBTAG]) << 32) | proc->Reg[ra];
+
+			//DBGPRINT("ITB[%d] = %llx\n", ControlReg[ITBINDEX], ITlb[ControlReg[ITBINDEX]]);
+
+			proc->Cr[ITBINDEX] += 1;
+
+			if (proc->Cr[ITBINDEX] == XR_ITB_SIZE) {
+				// Roll over to index four.
+
+				proc->Cr[ITBINDEX] = 4;
+			}
+
+			break;
+
+		case DTBPTE:
+			// Write an entry to the DTB at DTBINDEX, and
+			// increment it.
+
+#ifdef FASTMEMORY
+			// Remove the old entry from the soft TLB, along with anything
+			// cached there for the new entry's VPN, which might have come
+			// from an older duplicate entry.
+
+			XrInvalidateSoftTlbDtbe(proc, &proc->Dtb[proc->Cr[DTBINDEX]]);
+			XrInvalidateSoftTlbVpn(proc, proc->Cr[DTBTAG] & 0xFFFFF);
+#endif
+
+			proc->Dtb[proc->Cr[DTBINDEX]] = ((uint64_t)(proc->Cr[DTBTAG]) << 32) | proc->Reg[ra];
+
+			//DBGPRINT("DTB[%d] = %llx\n", ControlReg[DTBINDEX], DTlb[ControlReg[DTBINDEX]]);
+
+			proc->Cr[DTBINDEX] += 1;
+
+			if (proc->Cr[DTBINDEX] == XR_DTB_SIZE) {
+				// Roll over to index four.
+
+				proc->Cr[DTBINDEX] = 4;
+			}
+
+			break;
+
+		case ITBINDEX:
+			proc->Cr[ITBINDEX] = proc->Reg[ra] & (XR_ITB_SIZE - 1);
+			break;
+
+		case DTBINDEX:
+			proc->Cr[DTBINDEX] = proc->Reg[ra] & (XR_DTB_SIZE - 1);
+			break;
+
+		case DTBTAG:
+			proc->Cr[DTBTAG] = proc->Reg[ra];
+
+			// Reset the lookup hint.
+
+			proc->DtbLastVpn = -1;
+
+			break;
+
+		case ITBTAG:
+			proc->Cr[ITBTAG] = proc->Reg[ra];
+
+			// Reset the lookup hint.
+
+			proc->ItbLastVpn = -1;
+			
+			break;
+
+		default:
+			proc->Cr[rb] = proc->Reg[ra];
+			break;
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteMfcr(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 33\n");
+
+	if (proc->Cr[RS] & RS_USER) {
+		// Ope, privilege violation.
+
+		XrBasicException(proc, XR_EXC_PRV, XR_CURRENT_PC());
+
+		XR_EARLY_EXIT();
+	}
+
+	// Reset the NMI mask counter.
+
+	proc->NmiMaskCounter = NMI_MASK_CYCLES;
+
+	proc->Reg[inst->Imm8_1] = proc->Cr[inst->Imm8_2];
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteBpo(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 34\n");
+
+	uint32_t rd = inst->Imm8_1;
+
+	XrIblock *iblock;
+	XrIblock **referrent;
+
+	if (proc->Reg[rd] & 1) {
+		proc->Pc = inst->Imm32_1;
+		referrent = &block->CachedPaths[XR_TRUE_PATH];
+	} else {
+		proc->Pc = XR_CURRENT_PC() + 4;
+		referrent = &block->CachedPaths[XR_FALSE_PATH];
+	}
+
+	XR_PROFILE_BRANCH(referrent == &block->CachedPaths[XR_TRUE_PATH], XR_CURRENT_PC());
+
+	iblock = *referrent;
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, referrent);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteBpe(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 35\n");
+
+	uint32_t rd = inst->Imm8_1;
+
+	XrIblock *iblock;
+	XrIblock **referrent;
+
+	if ((proc->Reg[rd] & 1) == 0) {
+		proc->Pc = inst->Imm32_1;
+		referrent = &block->CachedPaths[XR_TRUE_PATH];
+	} else {
+		proc->Pc = XR_CURRENT_PC() + 4;
+		referrent = &block->CachedPaths[XR_FALSE_PATH];
+	}
+
+	XR_PROFILE_BRANCH(referrent == &block->CachedPaths[XR_TRUE_PATH], XR_CURRENT_PC());
+
+	iblock = *referrent;
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, referrent);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteBge(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 36\n");
+
+	uint32_t rd = inst->Imm8_1;
+
+	XrIblock *iblock;
+	XrIblock **referrent;
+
+	if ((int32_t)proc->Reg[rd] >= 0) {
+		proc->Pc = inst->Imm32_1;
+		referrent = &block->CachedPaths[XR_TRUE_PATH];
+	} else {
+		proc->Pc = XR_CURRENT_PC() + 4;
+		referrent = &block->CachedPaths[XR_FALSE_PATH];
+	}
+
+	XR_PROFILE_BRANCH(referrent == &block->CachedPaths[XR_TRUE_PATH], XR_CURRENT_PC());
+
+	iblock = *referrent;
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, referrent);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteBle(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 37\n");
+
+	uint32_t rd = inst->Imm8_1;
+
+	XrIblock *iblock;
+	XrIblock **referrent;
+
+	if ((int32_t)proc->Reg[rd] <= 0) {
+		proc->Pc = inst->Imm32_1;
+		referrent = &block->CachedPaths[XR_TRUE_PATH];
+	} else {
+		proc->Pc = XR_CURRENT_PC() + 4;
+		referrent = &block->CachedPaths[XR_FALSE_PATH];
+	}
+
+	XR_PROFILE_BRANCH(referrent == &block->CachedPaths[XR_TRUE_PATH], XR_CURRENT_PC());
+
+	iblock = *referrent;
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, referrent);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteBgt(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 38\n");
+
+	uint32_t rd = inst->Imm8_1;
+
+	XrIblock *iblock;
+	XrIblock **referrent;
+
+	if ((int32_t)proc->Reg[rd] > 0) {
+		proc->Pc = inst->Imm32_1;
+		referrent = &block->CachedPaths[XR_TRUE_PATH];
+	} else {
+		proc->Pc = XR_CURRENT_PC() + 4;
+		referrent = &block->CachedPaths[XR_FALSE_PATH];
+	}
+
+	XR_PROFILE_BRANCH(referrent == &block->CachedPaths[XR_TRUE_PATH], XR_CURRENT_PC());
+
+	iblock = *referrent;
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, referrent);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteBlt(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 39\n");
+
+	uint32_t rd = inst->Imm8_1;
+
+	XrIblock *iblock;
+	XrIblock **referrent;
+
+	if ((int32_t)proc->Reg[rd] < 0) {
+		proc->Pc = inst->Imm32_1;
+		referrent = &block->CachedPaths[XR_TRUE_PATH];
+	} else {
+		proc->Pc = XR_CURRENT_PC() + 4;
+		referrent = &block->CachedPaths[XR_FALSE_PATH];
+	}
+
+	XR_PROFILE_BRANCH(referrent == &block->CachedPaths[XR_TRUE_PATH], XR_CURRENT_PC());
+
+	iblock = *referrent;
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, referrent);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteBne(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 40\n");
+
+	uint32_t rd = inst->Imm8_1;
+
+	XrIblock *iblock;
+	XrIblock **referrent;
+
+	if (proc->Reg[rd] != 0) {
+		proc->Pc = inst->Imm32_1;
+		referrent = &block->CachedPaths[XR_TRUE_PATH];
+	} else {
+		proc->Pc = XR_CURRENT_PC() + 4;
+		referrent = &block->CachedPaths[XR_FALSE_PATH];
+	}
+
+	XR_PROFILE_BRANCH(referrent == &block->CachedPaths[XR_TRUE_PATH], XR_CURRENT_PC());
+
+	iblock = *referrent;
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, referrent);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteBeq(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 41\n");
+
+	uint32_t rd = inst->Imm8_1;
+
+	XrIblock *iblock;
+	XrIblock **referrent;
+
+	if (proc->Reg[rd] == 0) {
+		proc->Pc = inst->Imm32_1;
+		referrent = &block->CachedPaths[XR_TRUE_PATH];
+	} else {
+		proc->Pc = XR_CURRENT_PC() + 4;
+		referrent = &block->CachedPaths[XR_FALSE_PATH];
+	}
+
+	XR_PROFILE_BRANCH(referrent == &block->CachedPaths[XR_TRUE_PATH], XR_CURRENT_PC());
+
+	iblock = *referrent;
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, referrent);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteB(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 42\n");
+
+	proc->Pc = inst->Imm32_1;
+
+	XrIblock *iblock = block->CachedPaths[XR_TRUE_PATH];
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, &block->CachedPaths[XR_TRUE_PATH]);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteOri(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 43\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	proc->Reg[rd] = proc->Reg[ra] | imm;
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteXori(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 44\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	proc->Reg[rd] = proc->Reg[ra] ^ imm;
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteAndi(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 45\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	proc->Reg[rd] = proc->Reg[ra] & imm;
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteSltiSigned(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 46\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	if ((int32_t) proc->Reg[ra] < (int32_t) imm) {
+		proc->Reg[rd] = 1;
+	} else {
+		proc->Reg[rd] = 0;
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteSlti(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 47\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	if (proc->Reg[ra] < imm) {
+		proc->Reg[rd] = 1;
+	} else {
+		proc->Reg[rd] = 0;
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteSubi(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 48\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	proc->Reg[rd] = proc->Reg[ra] - imm;
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteAddi(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 49\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	proc->Reg[rd] = proc->Reg[ra] + imm;
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteStoreLongImmOffsetImm(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 50\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	XR_SYNC_PC();
+
+	int status = XrWriteLong(proc, proc->Reg[rd] + imm, SignExt5(ra));
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteStoreIntImmOffsetImm(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 51\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	XR_SYNC_PC();
+
+	int status = XrWriteInt(proc, proc->Reg[rd] + imm, SignExt5(ra));
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteStoreByteImmOffsetImm(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 52\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	XR_SYNC_PC();
+
+	int status = XrWriteByte(proc, proc->Reg[rd] + imm, SignExt5(ra));
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteStoreLongImmOffsetReg(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 53\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	XR_SYNC_PC();
+
+	int status = XrWriteLong(proc, proc->Reg[rd] + imm, proc->Reg[ra]);
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteStoreIntImmOffsetReg(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 54\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	XR_SYNC_PC();
+
+	int status = XrWriteInt(proc, proc->Reg[rd] + imm, proc->Reg[ra]);
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteStoreByteImmOffsetReg(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 55\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+
+	XR_SYNC_PC();
+
+	int status = XrWriteByte(proc, proc->Reg[rd] + imm, proc->Reg[ra]);
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteLoadLongImmOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 56\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+	
+	XR_SYNC_PC();
+
+	int status = XrReadLong(proc, proc->Reg[ra] + imm, &proc->Reg[rd]);
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteLoadIntImmOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 57\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+	
+	XR_SYNC_PC();
+
+	int status = XrReadInt(proc, proc->Reg[ra] + imm, &proc->Reg[rd]);
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteLoadByteImmOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 58\n");
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+	uint32_t imm = inst->Imm32_1;
+	
+	XR_SYNC_PC();
+
+	int status = XrReadByte(proc, proc->Reg[ra] + imm, &proc->Reg[rd]);
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteJalr(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 59 @ %x\n", XR_CURRENT_PC());
+
+	uint32_t rd = inst->Imm8_1;
+	uint32_t ra = inst->Imm8_2;
+
+	uint32_t pc = proc->Reg[ra] + inst->Imm32_1;
+
+	proc->Reg[rd] = XR_CURRENT_PC() + 4;
+
+	proc->Pc = pc;
+
+	// This is the only time where the program counter can become unaligned, so
+	// check for that condition here.
+
+	if (XrUnlikely((pc & 3) != 0)) {
+		// Unaligned access.
+
+		proc->Cr[EBADADDR] = pc;
+		XrBasicException(proc, XR_EXC_UNA, pc);
+
+		XR_EARLY_EXIT();
+	}
+
+	XrJalrPredictionTable *ptable = (void*)block->CachedPaths[0];
+
+	if (XrUnlikely(!ptable)) {
+		ptable = XrAllocatePtable(proc);
+		block->CachedPaths[0] = (void*)ptable;
+		block->Cold->HasPtable = 1;
+	}
+
+	XrIblock *iblock;
+
+	int index = (pc >> 2) & (XR_JALR_PREDICTION_TABLE_ENTRIES - 1);
+
+	if (XrLikely(ptable->Pcs[index] == pc)) {
+		iblock = ptable->Iblocks[index];
+		if (XrLikely(iblock != 0)) {
+			goto dispatch;
+		}
+	}
+
+	iblock = XrDecodeInstructions(proc, block);
+
+	if (XrUnlikely(!iblock)) {
+		XR_EARLY_EXIT();
+	}
+
+	ptable->Pcs[index] = pc;
+
+	XrCreateCachedPointerToBlock(iblock, &ptable->Iblocks[index]);
+
+dispatch:
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteAdr(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 59 @ %x\n", XR_CURRENT_PC());
+
+	proc->Reg[inst->Imm8_1] = inst->Imm32_1;
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteJal(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 60\n");
+
+	proc->Reg[LR] = XR_CURRENT_PC() + 4;
+	proc->Pc = inst->Imm32_1;
+
+	XrIblock *iblock = block->CachedPaths[XR_TRUE_PATH];
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, &block->CachedPaths[XR_TRUE_PATH]);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteJ(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 61\n");
+
+	proc->Pc = inst->Imm32_1;
+
+	XrIblock *iblock = block->CachedPaths[XR_TRUE_PATH];
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, &block->CachedPaths[XR_TRUE_PATH]);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteVirtualLsh(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 101\n");
+
+	proc->Reg[XR_FAKE_SHIFT_SINK] = proc->Reg[inst->Imm8_1] << inst->Imm8_2;
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteVirtualRsh(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 102\n");
+
+	proc->Reg[XR_FAKE_SHIFT_SINK] = proc->Reg[inst->Imm8_1] >> inst->Imm8_2;
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteVirtualAsh(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 103\n");
+
+	proc->Reg[XR_FAKE_SHIFT_SINK] = (int32_t) proc->Reg[inst->Imm8_1] >> inst->Imm8_2;
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteVirtualRor(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 104\n");
+
+	proc->Reg[XR_FAKE_SHIFT_SINK] = RoR(proc->Reg[inst->Imm8_1], inst->Imm8_2);
+
+	XR_NEXT();
+}
+
+// Virtual instructions produced by the peephole pass in XrDecodeInstructions.
+// Each one stands in for a pair of adjacent instructions and leaves the same
+// architecturally visible state behind as the pair would have.
+
+#ifdef PROFCPU
+#define XR_COUNT_FUSED(counter) proc->counter++;
+#else
+#define XR_COUNT_FUSED(counter)
+#endif
+
+// A fused pair has the PcOffset of its first instruction. If it leaves early
+// from its second instruction, the first one has retired and is charged too.
+
+#define XR_FUSED_EARLY_EXIT() \
+	XR_EARLY_EXIT_AT(XR_PC_OFFSET_INDEX(inst->PcOffset) + 1);
+
+XR_PRESERVE_NONE
+static void XrExecuteSubBeq(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 106\n");
+
+	// SUB RD, RA, RB
+	// BEQ RD, OFFSET
+
+	XR_COUNT_FUSED(FusedBranchCount);
+
+	uint32_t result = proc->Reg[inst->Imm8_2] - proc->Reg[inst->Imm8_3];
+
+	proc->Reg[inst->Imm8_1] = result;
+
+	XrIblock *iblock;
+	XrIblock **referrent;
+
+	if (result == 0) {
+		proc->Pc = inst->Imm32_1;
+		referrent = &block->CachedPaths[XR_TRUE_PATH];
+	} else {
+		proc->Pc = XR_CURRENT_PC() + 8;
+		referrent = &block->CachedPaths[XR_FALSE_PATH];
+	}
+
+	XR_PROFILE_BRANCH(referrent == &block->CachedPaths[XR_TRUE_PATH], XR_CURRENT_PC() + 4);
+
+	iblock = *referrent;
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_FUSED_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, referrent);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteSubBne(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 107\n");
+
+	// SUB RD, RA, RB
+	// BNE RD, OFFSET
+
+	XR_COUNT_FUSED(FusedBranchCount);
+
+	uint32_t result = proc->Reg[inst->Imm8_2] - proc->Reg[inst->Imm8_3];
+
+	proc->Reg[inst->Imm8_1] = result;
+
+	XrIblock *iblock;
+	XrIblock **referrent;
+
+	if (result != 0) {
+		proc->Pc = inst->Imm32_1;
+		referrent = &block->CachedPaths[XR_TRUE_PATH];
+	} else {
+		proc->Pc = XR_CURRENT_PC() + 8;
+		referrent = &block->CachedPaths[XR_FALSE_PATH];
+	}
+
+	XR_PROFILE_BRANCH(referrent == &block->CachedPaths[XR_TRUE_PATH], XR_CURRENT_PC() + 4);
+
+	iblock = *referrent;
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_FUSED_EARLY_EXIT();
+		}
+
+		XrCreateCachedPointerToBlock(iblock, referrent);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteLoadConstant(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 108\n");
+
+	// LUI RD, ZERO, HI
+	// ORI/ADDI RD, RD, LO
+
+	XR_COUNT_FUSED(FusedConstantCount);
+
+	proc->Reg[inst->Imm8_1] = inst->Imm32_1;
+
+	XR_NEXT();
+}
+
+// The absolute forms carry the upper half loaded by the LUI in the upper 16
+// bits of Imm32_1, and the unscaled offset field of the load or store in the
+// lower 16 bits. The LUI retires before the access is performed, so that the
+// processor state is correct if the access causes an exception.
+
+#define XR_ABSOLUTE_UPPER(packed) ((packed) & 0xFFFF0000)
+#define XR_ABSOLUTE_ADDRESS(packed, shift) (((packed) & 0xFFFF0000) + (((packed) & 0xFFFF) << (shift)))
+
+XR_PRESERVE_NONE
+static void XrExecuteLoadLongAbsolute(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 109\n");
+
+	XR_COUNT_FUSED(FusedAbsoluteCount);
+
+	uint32_t packed = inst->Imm32_1;
+
+	proc->Reg[inst->Imm8_2] = XR_ABSOLUTE_UPPER(packed);
+	proc->Pc = XR_CURRENT_PC() + 4;
+
+	int status = XrReadLong(proc, XR_ABSOLUTE_ADDRESS(packed, 2), &proc->Reg[inst->Imm8_1]);
+
+	if (XrUnlikely(!status)) {
+		XR_FUSED_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteLoadIntAbsolute(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 110\n");
+
+	XR_COUNT_FUSED(FusedAbsoluteCount);
+
+	uint32_t packed = inst->Imm32_1;
+
+	proc->Reg[inst->Imm8_2] = XR_ABSOLUTE_UPPER(packed);
+	proc->Pc = XR_CURRENT_PC() + 4;
+
+	int status = XrReadInt(proc, XR_ABSOLUTE_ADDRESS(packed, 1), &proc->Reg[inst->Imm8_1]);
+
+	if (XrUnlikely(!status)) {
+		XR_FUSED_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteLoadByteAbsolute(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 111\n");
+
+	XR_COUNT_FUSED(FusedAbsoluteCount);
+
+	uint32_t packed = inst->Imm32_1;
+
+	proc->Reg[inst->Imm8_2] = XR_ABSOLUTE_UPPER(packed);
+	proc->Pc = XR_CURRENT_PC() + 4;
+
+	int status = XrReadByte(proc, XR_ABSOLUTE_ADDRESS(packed, 0), &proc->Reg[inst->Imm8_1]);
+
+	if (XrUnlikely(!status)) {
+		XR_FUSED_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteStoreLongAbsolute(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 112\n");
+
+	XR_COUNT_FUSED(FusedAbsoluteCount);
+
+	uint32_t packed = inst->Imm32_1;
+
+	proc->Reg[inst->Imm8_1] = XR_ABSOLUTE_UPPER(packed);
+	proc->Pc = XR_CURRENT_PC() + 4;
+
+	int status = XrWriteLong(proc, XR_ABSOLUTE_ADDRESS(packed, 2), proc->Reg[inst->Imm8_2]);
+
+	if (XrUnlikely(!status)) {
+		XR_FUSED_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteStoreIntAbsolute(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 113\n");
+
+	XR_COUNT_FUSED(FusedAbsoluteCount);
+
+	uint32_t packed = inst->Imm32_1;
+
+	proc->Reg[inst->Imm8_1] = XR_ABSOLUTE_UPPER(packed);
+	proc->Pc = XR_CURRENT_PC() + 4;
+
+	int status = XrWriteInt(proc, XR_ABSOLUTE_ADDRESS(packed, 1), proc->Reg[inst->Imm8_2]);
+
+	if (XrUnlikely(!status)) {
+		XR_FUSED_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteStoreByteAbsolute(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 114\n");
+
+	XR_COUNT_FUSED(FusedAbsoluteCount);
+
+	uint32_t packed = inst->Imm32_1;
+
+	proc->Reg[inst->Imm8_1] = XR_ABSOLUTE_UPPER(packed);
+	proc->Pc = XR_CURRENT_PC() + 4;
+
+	int status = XrWriteByte(proc, XR_ABSOLUTE_ADDRESS(packed, 0), proc->Reg[inst->Imm8_2]);
+
+	if (XrUnlikely(!status)) {
+		XR_FUSED_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+// Virtual instructions produced by the dataflow pass in XrOptimizeIblock. They
+// stand in for a single instruction whose operands were found to be known or
+// redundant at decode time, and leave the same state behind as it would have.
+
+XR_PRESERVE_NONE
+static void XrExecuteMove(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 116\n");
+
+	// ADDI/ORI/XORI/SUBI RD, RA, 0
+	// ADD/OR/XOR RD, RA, ZERO
+
+	proc->Reg[inst->Imm8_1] = proc->Reg[inst->Imm8_2];
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteAddiInPlace(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 117\n");
+
+	// ADDI/SUBI RD, RD, IMM
+
+	proc->Reg[inst->Imm8_1] += inst->Imm32_1;
+
+	XR_NEXT();
+}
+
+// The direct forms are loads and stores whose base register held a value that
+// was known at decode time. Imm32_1 is the full address, and Imm8_1 is the
+// destination or source register.
+
+XR_PRESERVE_NONE
+static void XrExecuteLoadLongDirect(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 118\n");
+
+	XR_COUNT_FUSED(DirectAccessCount);
+
+	XR_SYNC_PC();
+
+	int status = XrReadLong(proc, inst->Imm32_1, &proc->Reg[inst->Imm8_1]);
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteLoadIntDirect(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 119\n");
+
+	XR_COUNT_FUSED(DirectAccessCount);
+
+	XR_SYNC_PC();
+
+	int status = XrReadInt(proc, inst->Imm32_1, &proc->Reg[inst->Imm8_1]);
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteLoadByteDirect(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 120\n");
+
+	XR_COUNT_FUSED(DirectAccessCount);
+
+	XR_SYNC_PC();
+
+	int status = XrReadByte(proc, inst->Imm32_1, &proc->Reg[inst->Imm8_1]);
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteStoreLongDirect(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 121\n");
+
+	XR_COUNT_FUSED(DirectAccessCount);
+
+	XR_SYNC_PC();
+
+	int status = XrWriteLong(proc, inst->Imm32_1, proc->Reg[inst->Imm8_1]);
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteStoreIntDirect(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 122\n");
+
+	XR_COUNT_FUSED(DirectAccessCount);
+
+	XR_SYNC_PC();
+
+	int status = XrWriteInt(proc, inst->Imm32_1, proc->Reg[inst->Imm8_1]);
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteStoreByteDirect(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 123\n");
+
+	XR_COUNT_FUSED(DirectAccessCount);
+
+	XR_SYNC_PC();
+
+	int status = XrWriteByte(proc, inst->Imm32_1, proc->Reg[inst->Imm8_1]);
+
+	if (XrUnlikely(!status)) {
+		XR_EARLY_EXIT();
+	}
+
+	XR_NEXT();
+}
+
+// The conditions tested by the conditional branches, for the virtual
+// instructions that stand in for them.
+
+enum XrGuardConditions {
+	XR_GUARD_EQ,
+	XR_GUARD_NE,
+	XR_GUARD_LT,
+	XR_GUARD_GT,
+	XR_GUARD_LE,
+	XR_GUARD_GE,
+	XR_GUARD_PE,
+	XR_GUARD_PO,
+};
+
+#define XR_GUARD_EXIT_IF_TRUE 0x80
+
+static XR_ALWAYS_INLINE int XrEvaluateGuard(uint32_t condition, uint32_t value) {
+	switch (condition) {
+		case XR_GUARD_EQ:
+			return value == 0;
+
+		case XR_GUARD_NE:
+			return value != 0;
+
+		case XR_GUARD_LT:
+			return (int32_t)value < 0;
+
+		case XR_GUARD_GT:
+			return (int32_t)value > 0;
+
+		case XR_GUARD_LE:
+			return (int32_t)value <= 0;
+
+		case XR_GUARD_GE:
+			return (int32_t)value >= 0;
+
+		case XR_GUARD_PE:
+			return (value & 1) == 0;
+
+		default:
+			return value & 1;
+	}
+}
+
+#if !XR_SIMULATE_CACHES
+
+// A trace guard stands in for a biased conditional branch that an Iblock was
+// extended past. Imm8_1 is the register tested by the branch, Imm8_3 is the
+// branch condition, with XR_GUARD_EXIT_IF_TRUE set if the trace followed the
+// not-taken direction, Imm8_2 is the index of the guard's side exit, and
+// Imm32_1 is the address to continue at if the trace was the wrong guess.
+
+XR_PRESERVE_NONE
+static void XrTraceSideExit(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	// The branch went the other way from what the trace was built for. Charge
+	// the instructions executed so far, including the branch itself, and leave
+	// the trace.
+
+	XR_COUNT_FUSED(TraceExitCount);
+
+	proc->CyclesDone += XR_PC_OFFSET_INDEX(inst->PcOffset) + 1;
+	proc->Pc = inst->Imm32_1;
+
+	if (XrUnlikely(++block->SideExitCount == XR_TRACE_EXIT_LIMIT)) {
+		// The guess has been wrong often enough that it should be
+		// reconsidered. Forget the bias and throw out the trace, so that the
+		// branch is profiled afresh the next time this code is decoded.
+
+		uint32_t branchpc = XR_CURRENT_PC();
+
+		XrBranchBias *bias = &proc->BranchBias[XR_BRANCH_BIAS_INDEX(branchpc)];
+
+		if (bias->Pc == branchpc) {
+			bias->Pc = 0xFFFFFFFF;
+		}
+
+		XrInvalidateIblockPointers(block);
+		XrFreeIblock(proc, block);
+
+		return;
+	}
+
+	XrIblock **referrent = &block->SideExits[inst->Imm8_2];
+	XrIblock *iblock = *referrent;
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			return;
+		}
+
+		XrCreateCachedPointerToBlock(iblock, referrent);
+	}
+
+	if (XrUnlikely((proc->Dispatches++ & 31) == 0)) {
+		return;
+	}
+
+	XR_CHECK_ADDRESS_SPACE(iblock);
+
+	XR_JIT_COUNT(iblock);
+
+	XR_TAIL return iblock->Insts[0].Func(proc, iblock, &iblock->Insts[0]);
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteTraceGuard(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 115\n");
+
+	XR_COUNT_FUSED(TraceGuardCount);
+
+	uint32_t condition = inst->Imm8_3;
+
+	int result = XrEvaluateGuard(condition & ~XR_GUARD_EXIT_IF_TRUE, proc->Reg[inst->Imm8_1]);
+
+	if (XrUnlikely(result == ((condition & XR_GUARD_EXIT_IF_TRUE) != 0))) {
+		XR_TAIL return XrTraceSideExit(proc, block, inst);
+	}
+
+	XR_NEXT();
+}
+
+#endif
+
+// A spin branch stands in for the branch that closes a spin loop: an Iblock
+// that branches back to its own start, and does nothing on the way except for
+// loads and computations that don't depend on the previous iteration. Each
+// iteration then does exactly the same thing until some other agent changes
+// memory, so once the loop has gone around XR_SPIN_MAX times in a row, the
+// rest of the processor's slice is skipped as though it had kept spinning, and
+// its host thread is given up. Imm8_1 is the register tested by the branch,
+// Imm8_3 is the branch condition, and Imm32_1 is the start of the Iblock.
+
+XR_PRESERVE_NONE
+static void XrExecuteSpinBranch(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 124\n");
+
+	if (!XrEvaluateGuard(inst->Imm8_3, proc->Reg[inst->Imm8_1])) {
+		// The loop is done.
+
+		proc->SpinCount = 0;
+		proc->Pc = XR_CURRENT_PC() + 4;
+
+		XrIblock *iblock = block->CachedPaths[XR_FALSE_PATH];
+
+		if (XrUnlikely(!iblock)) {
+			iblock = XrDecodeInstructions(proc, block);
+
+			if (XrUnlikely(!iblock)) {
+				XR_EARLY_EXIT();
+			}
+
+			XrCreateCachedPointerToBlock(iblock, &block->CachedPaths[XR_FALSE_PATH]);
+		}
+
+		XR_DISPATCH(iblock);
+	}
+
+	proc->Pc = inst->Imm32_1;
+
+	if (XrUnlikely(++proc->SpinCount >= XR_SPIN_MAX)) {
+		// Fast-forward to the end of the slice, and make XrProcessorSchedule
+		// yield as it would for a PAUSE loop. Pending interrupts are noticed
+		// at the start of the next slice.
+
+		XR_COUNT_FUSED(SpinSkipCount);
+
+		proc->SpinCount = 0;
+		proc->CyclesDone += block->Cycles;
+
+		if (proc->CyclesDone < proc->CyclesGoal) {
+			proc->CyclesDone = proc->CyclesGoal;
+		}
+
+		proc->PauseCalls = XR_PAUSE_MAX;
+
+		return;
+	}
+
+	XR_DISPATCH(block);
+}
+
+static XrInstImplF XrVirtualShiftInstructionTable[4] = {
+	[0] = &XrExecuteVirtualLsh,
+	[1] = &XrExecuteVirtualRsh,
+	[2] = &XrExecuteVirtualAsh,
+	[3] = &XrExecuteVirtualRor
+};
+
+static XrInstImplF XrRegShiftFunctionTable[4] = {
+	[0] = &XrExecuteLsh,
+	[1] = &XrExecuteRsh,
+	[2] = &XrExecuteAsh,
+	[3] = &XrExecuteRor
+};
+
+#define XR_REDIRECT_ZERO_SRC(src) ((((proc->Cr[RS] & RS_TBMISS) == 0) && ((src) == 0)) ? XR_FAKE_ZERO_REGISTER : (src))
+
+typedef XrCachedInst *(*XrDecodeInstructionF)(XrProcessor *proc, XrCachedInst *inst, uint32_t ir, uint32_t pc);
+
+static XrCachedInst *XrDecodeIllegalInstruction(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteIllegalInstruction;
+
+	return 0;
+}
+
+static XrCachedInst *XrDecodeRfe(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteRfe;
+
+	return 0;
+}
+
+static XrCachedInst *XrDecodeHlt(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteHlt;
+
+	return 0;
+}
+
+static XrCachedInst *XrDecodeMtcr(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteMtcr;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm8_2 = (ir >> 16) & 31;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeMfcr(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteMfcr;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = (ir >> 16) & 31;
+
+	return inst + 1;
+}
+
+static XrDecodeInstructionF XrDecodeFunctions101001[16] = {
+	[0] = &XrDecodeIllegalInstruction,
+	[1] = &XrDecodeIllegalInstruction,
+	[2] = &XrDecodeIllegalInstruction,
+	[3] = &XrDecodeIllegalInstruction,
+	[4] = &XrDecodeIllegalInstruction,
+	[5] = &XrDecodeIllegalInstruction,
+	[6] = &XrDecodeIllegalInstruction,
+	[7] = &XrDecodeIllegalInstruction,
+	[8] = &XrDecodeIllegalInstruction,
+	[9] = &XrDecodeIllegalInstruction,
+	[10] = &XrDecodeIllegalInstruction,
+	[11] = &XrDecodeRfe,
+	[12] = &XrDecodeHlt,
+	[13] = &XrDecodeIllegalInstruction,
+	[14] = &XrDecodeMtcr,
+	[15] = &XrDecodeMfcr,
+};
+
+static XrCachedInst *XrDecodeSys(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteSys;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeBrk(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteBrk;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeWmb(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteWmb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeMb(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteMb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodePause(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecutePause;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeSC(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteSC;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeLL(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteLL;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+
+	return inst + 1;
+}
+
+#define XR_INSERT_SHIFT() \
+	if (((ir >> 21) & 31) != 0) { \
+		/* The inline shift amount is nonzero, so generate a virtual shift */ \
+		/* instruction before the proper one. */ \
+\
+		inst->Func = XrVirtualShiftInstructionTable[(ir >> 26) & 3]; \
+		inst->Imm8_1 = rb; \
+		inst->Imm8_2 = (ir >> 21) & 31; \
+\
+		/* Redirect the real instruction to take its RB register from the */ \
+		/* result of the virtual instruction. */ \
+\
+		rb = XR_FAKE_SHIFT_SINK; \
+\
+		inst++; \
+	}
+
+static XrCachedInst *XrDecodeMod(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteMod;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeDivSigned(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteDivSigned;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeDiv(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteDiv;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeMul(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteMul;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrDecodeInstructionF XrDecodeFunctions110001[16] = {
+	[0] = &XrDecodeSys,
+	[1] = &XrDecodeBrk,
+	[2] = &XrDecodeWmb,
+	[3] = &XrDecodeMb,
+	[4] = &XrDecodeIllegalInstruction,
+	[5] = &XrDecodeIllegalInstruction,
+	[6] = &XrDecodePause,
+	[7] = &XrDecodeIllegalInstruction,
+	[8] = &XrDecodeSC,
+	[9] = &XrDecodeLL,
+	[10] = &XrDecodeIllegalInstruction,
+	[11] = &XrDecodeMod,
+	[12] = &XrDecodeDivSigned,
+	[13] = &XrDecodeDiv,
+	[14] = &XrDecodeIllegalInstruction,
+	[15] = &XrDecodeMul,
+};
+
+static XrCachedInst *XrDecodeNor(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteNor;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeOr(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteOr;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeXor(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteXor;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeAnd(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteAnd;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeSltSigned(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteSltSigned;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeSlt(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteSlt;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeSub(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteSub;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeAdd(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteAdd;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeRegShifts(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = XrRegShiftFunctionTable[(ir >> 26) & 3];
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeStoreLongRegOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteStoreLongRegOffset;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeStoreIntRegOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteStoreIntRegOffset;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeStoreByteRegOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteStoreByteRegOffset;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeLoadLongRegOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteLoadLongRegOffset;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeLoadIntRegOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteLoadIntRegOffset;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeLoadByteRegOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+
+	XR_INSERT_SHIFT();
+
+	inst->Func = &XrExecuteLoadByteRegOffset;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = rb;
+
+	return inst + 1;
+}
+
+static XrDecodeInstructionF XrDecodeFunctions111001[16] = {
+	[0] = &XrDecodeNor,
+	[1] = &XrDecodeOr,
+	[2] = &XrDecodeXor,
+	[3] = &XrDecodeAnd,
+	[4] = &XrDecodeSltSigned,
+	[5] = &XrDecodeSlt,
+	[6] = &XrDecodeSub,
+	[7] = &XrDecodeAdd,
+	[8] = &XrDecodeRegShifts,
+	[9] = &XrDecodeStoreLongRegOffset,
+	[10] = &XrDecodeStoreIntRegOffset,
+	[11] = &XrDecodeStoreByteRegOffset,
+	[12] = &XrDecodeIllegalInstruction,
+	[13] = &XrDecodeLoadLongRegOffset,
+	[14] = &XrDecodeLoadIntRegOffset,
+	[15] = &XrDecodeLoadByteRegOffset,
+};
+
+static XrCachedInst *XrDecodeLui(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteOri;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = (ir >> 16) << 16;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeBpo(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteBpo;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+
+	return 0;
+}
+
+static XrCachedInst *XrDecodeStoreLongImmOffsetImm(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteStoreLongImmOffsetImm;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm8_2 = (ir >> 11) & 31;
+	inst->Imm32_1 = (ir >> 16) << 2;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeOri(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteOri;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = ir >> 16;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeBpe(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteBpe;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+
+	return 0;
+}
+
+static XrCachedInst *XrDecodeStoreIntImmOffsetImm(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteStoreIntImmOffsetImm;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm8_2 = (ir >> 11) & 31;
+	inst->Imm32_1 = (ir >> 16) << 1;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeXori(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteXori;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = ir >> 16;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeBge(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteBge;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+
+	return 0;
+}
+
+static XrCachedInst *XrDecodeStoreByteImmOffsetImm(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteStoreByteImmOffsetImm;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm8_2 = (ir >> 11) & 31;
+	inst->Imm32_1 = ir >> 16;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeAndi(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteAndi;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = ir >> 16;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeBle(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteBle;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+
+	return 0;
+}
+
+static XrCachedInst *XrDecodeSltiSigned(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteSltiSigned;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = SignExt16(ir >> 16);
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeBgt(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteBgt;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+
+	return 0;
+}
+
+static XrCachedInst *XrDecode101001(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	return XrDecodeFunctions101001[ir >> 28](proc, inst, ir, pc);
+}
+
+static XrCachedInst *XrDecodeStoreLongImmOffsetReg(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteStoreLongImmOffsetReg;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = (ir >> 16) << 2;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeLoadLongImmOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteLoadLongImmOffset;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = (ir >> 16) << 2;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeSlti(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteSlti;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = ir >> 16;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeBlt(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteBlt;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+
+	return 0;
+}
+
+static XrCachedInst *XrDecode110001(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	return XrDecodeFunctions110001[ir >> 28](proc, inst, ir, pc);
+}
+
+static XrCachedInst *XrDecodeStoreIntImmOffsetReg(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteStoreIntImmOffsetReg;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = (ir >> 16) << 1;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeLoadIntImmOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteLoadIntImmOffset;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = (ir >> 16) << 1;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeSubi(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteSubi;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = ir >> 16;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeBne(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteBne;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+
+	return 0;
+}
+
+static XrCachedInst *XrDecodeJalr(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteJalr;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = (ir >> 16) << 2;
+
+	return 0;
+}
+
+static XrCachedInst *XrDecodeAdr(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteAdr;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm32_1 = pc + (ir & 0xFFFF0000);
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecode111001(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	return XrDecodeFunctions111001[ir >> 28](proc, inst, ir, pc);
+}
+
+static XrCachedInst *XrDecodeStoreByteImmOffsetReg(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteStoreByteImmOffsetReg;
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = ir >> 16;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeLoadByteImmOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteLoadByteImmOffset;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = ir >> 16;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeAddi(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteAddi;
+	inst->Imm8_1 = (ir >> 6) & 31;
+	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+	inst->Imm32_1 = ir >> 16;
+
+	return inst + 1;
+}
+
+static XrCachedInst *XrDecodeBeq(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+
+	if (inst->Imm8_1 == XR_FAKE_ZERO_REGISTER) {
+		// This is a BEQ, ZERO, XXX instruction.
+		// This is the canonical unconditional branch, generated by the B
+		// pseudo-instruction. We can optimize this a bit.
 
-	int status = XrWriteInt(proc, proc->Reg[rd] + imm, proc->Reg[ra]);
+		inst->Func = &XrExecuteB;
 
-	if (XrUnlikely(!status)) {
-		XR_EARLY_EXIT();
+		return 0;
 	}
 
-	XR_NEXT();
-}
-
-XR_PRESERVE_NONE
-static void XrExecuteStoreByteImmOffsetReg(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 55\n");
+	inst->Func = &XrExecuteBeq;
 
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
+	return 0;
+}
 
-	int status = XrWriteByte(proc, proc->Reg[rd] + imm, proc->Reg[ra]);
+static XrDecodeInstructionF XrDecodeLowSix[64] = {
+	[0] = &XrDecodeIllegalInstruction,
+	[1] = &XrDecodeIllegalInstruction,
+	[2] = &XrDecodeIllegalInstruction,
+	[3] = &XrDecodeIllegalInstruction,
+	[4] = &XrDecodeLui,
+	[5] = &XrDecodeBpo,
+	[6] = &XrDecodeIllegalInstruction,
+	[7] = &XrDecodeIllegalInstruction,
+	[8] = &XrDecodeIllegalInstruction,
+	[9] = &XrDecodeIllegalInstruction,
+	[10] = &XrDecodeStoreLongImmOffsetImm,
+	[11] = &XrDecodeIllegalInstruction,
+	[12] = &XrDecodeOri,
+	[13] = &XrDecodeBpe,
+	[14] = &XrDecodeIllegalInstruction,
+	[15] = &XrDecodeIllegalInstruction,
+	[16] = &XrDecodeIllegalInstruction,
+	[17] = &XrDecodeIllegalInstruction,
+	[18] = &XrDecodeStoreIntImmOffsetImm,
+	[19] = &XrDecodeIllegalInstruction,
+	[20] = &XrDecodeXori,
+	[21] = &XrDecodeBge,
+	[22] = &XrDecodeIllegalInstruction,
+	[23] = &XrDecodeIllegalInstruction,
+	[24] = &XrDecodeIllegalInstruction,
+	[25] = &XrDecodeIllegalInstruction,
+	[26] = &XrDecodeStoreByteImmOffsetImm,
+	[27] = &XrDecodeIllegalInstruction,
+	[28] = &XrDecodeAndi,
+	[29] = &XrDecodeBle,
+	[30] = &XrDecodeIllegalInstruction,
+	[31] = &XrDecodeIllegalInstruction,
+	[32] = &XrDecodeIllegalInstruction,
+	[33] = &XrDecodeIllegalInstruction,
+	[34] = &XrDecodeIllegalInstruction,
+	[35] = &XrDecodeIllegalInstruction,
+	[36] = &XrDecodeSltiSigned,
+	[37] = &XrDecodeBgt,
+	[38] = &XrDecodeIllegalInstruction,
+	[39] = &XrDecodeIllegalInstruction,
+	[40] = &XrDecodeIllegalInstruction,
+	[41] = &XrDecode101001,
+	[42] = &XrDecodeStoreLongImmOffsetReg,
+	[43] = &XrDecodeLoadLongImmOffset,
+	[44] = &XrDecodeSlti,
+	[45] = &XrDecodeBlt,
+	[46] = &XrDecodeIllegalInstruction,
+	[47] = &XrDecodeIllegalInstruction,
+	[48] = &XrDecodeAdr,
+	[49] = &XrDecode110001,
+	[50] = &XrDecodeStoreIntImmOffsetReg,
+	[51] = &XrDecodeLoadIntImmOffset,
+	[52] = &XrDecodeSubi,
+	[53] = &XrDecodeBne,
+	[54] = &XrDecodeIllegalInstruction,
+	[55] = &XrDecodeIllegalInstruction,
+	[56] = &XrDecodeJalr,
+	[57] = &XrDecode111001,
+	[58] = &XrDecodeStoreByteImmOffsetReg,
+	[59] = &XrDecodeLoadByteImmOffset,
+	[60] = &XrDecodeAddi,
+	[61] = &XrDecodeBeq,
+	[62] = &XrDecodeIllegalInstruction,
+	[63] = &XrDecodeIllegalInstruction,
+};
 
-	if (XrUnlikely(!status)) {
-		XR_EARLY_EXIT();
-	}
+static XrCachedInst *XrDecodeJal(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteJal;
+	inst->Imm32_1 = (pc & 0x80000000) | ((ir >> 3) << 2);
 
-	XR_NEXT();
+	return 0;
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteLoadLongImmOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 56\n");
-
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
-	
-	int status = XrReadLong(proc, proc->Reg[ra] + imm, &proc->Reg[rd]);
+static XrCachedInst *XrDecodeJ(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	inst->Func = &XrExecuteJ;
+	inst->Imm32_1 = (pc & 0x80000000) | ((ir >> 3) << 2);
 
-	if (XrUnlikely(!status)) {
-		XR_EARLY_EXIT();
-	}
+	return 0;
+}
 
-	XR_NEXT();
+static XrCachedInst *XrDecodeMajor(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
+	return XrDecodeLowSix[ir & 63](proc, inst, ir, pc);
 }
 
+static XrDecodeInstructionF XrDecodeLowThree[8] = {
+	[0] = &XrDecodeMajor,
+	[1] = &XrDecodeMajor,
+	[2] = &XrDecodeMajor,
+	[3] = &XrDecodeMajor,
+	[4] = &XrDecodeMajor,
+	[5] = &XrDecodeMajor,
+	[6] = &XrDecodeJ,
+	[7] = &XrDecodeJal,
+};
+
 XR_PRESERVE_NONE
-static void XrExecuteLoadIntImmOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 57\n");
+static void XrSpecialLinkageInstruction(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 0\n");
 
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
-	
-	int status = XrReadInt(proc, proc->Reg[ra] + imm, &proc->Reg[rd]);
+	// This instruction is placed at the end of a basic block that didn't
+	// terminate in a natural way (with a branch or illegal instruction).
+	// It just directs the outer loop to look up the next block. Its PcOffset
+	// is that of the guest instruction following the block.
 
-	if (XrUnlikely(!status)) {
-		XR_EARLY_EXIT();
-	}
+	XR_SYNC_PC();
 
-	XR_NEXT();
-}
+	XrIblock *iblock = block->CachedPaths[XR_TRUE_PATH];
 
-XR_PRESERVE_NONE
-static void XrExecuteLoadByteImmOffset(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 58\n");
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
 
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-	uint32_t imm = inst->Imm32_1;
-	
-	int status = XrReadByte(proc, proc->Reg[ra] + imm, &proc->Reg[rd]);
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT();
+		}
 
-	if (XrUnlikely(!status)) {
-		XR_EARLY_EXIT();
+		XrCreateCachedPointerToBlock(iblock, &block->CachedPaths[XR_TRUE_PATH]);
 	}
 
-	XR_NEXT();
+	XR_DISPATCH(iblock);
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteJalr(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 59 @ %x\n", proc->Pc);
-
-	uint32_t rd = inst->Imm8_1;
-	uint32_t ra = inst->Imm8_2;
-
-	uint32_t pc = proc->Reg[ra] + inst->Imm32_1;
+// Table of the loads and stores that can absorb a preceding LUI of their base
+// register, along with the shift that was applied to their offset field.
 
-	proc->Reg[rd] = proc->Pc + 4;
+typedef struct _XrAbsoluteForm {
+	XrInstImplF Original;
+	XrInstImplF Absolute;
+	uint8_t Shift;
+	uint8_t IsStore;
+} XrAbsoluteForm;
 
-	proc->Pc = pc;
+static XrAbsoluteForm XrAbsoluteForms[6] = {
+	{ &XrExecuteLoadLongImmOffset, &XrExecuteLoadLongAbsolute, 2, 0 },
+	{ &XrExecuteLoadIntImmOffset, &XrExecuteLoadIntAbsolute, 1, 0 },
+	{ &XrExecuteLoadByteImmOffset, &XrExecuteLoadByteAbsolute, 0, 0 },
+	{ &XrExecuteStoreLongImmOffsetReg, &XrExecuteStoreLongAbsolute, 2, 1 },
+	{ &XrExecuteStoreIntImmOffsetReg, &XrExecuteStoreIntAbsolute, 1, 1 },
+	{ &XrExecuteStoreByteImmOffsetReg, &XrExecuteStoreByteAbsolute, 0, 1 },
+};
 
-	// This is the only time where the program counter can become unaligned, so
-	// check for that condition here.
+static int XrFuseInstructions(XrCachedInst *prev, XrCachedInst *inst) {
+	// Peephole over the two most recently decoded instructions. If they form
+	// a recognized idiom, rewrite the earlier slot into a virtual instruction
+	// that does the work of both, and return 1 to indicate that the later slot
+	// should be discarded.
 
-	if (XrUnlikely((pc & 3) != 0)) {
-		// Unaligned access.
+	if (prev->Func == &XrExecuteSub) {
+		// SUB RD, RA, RB followed by BEQ/BNE RD becomes a compare-and-branch.
+		// The subtraction result is still written to RD since we can't tell
+		// whether anyone will look at it.
 
-		proc->Cr[EBADADDR] = pc;
-		XrBasicException(proc, XR_EXC_UNA, pc);
+		if (inst->Imm8_1 != prev->Imm8_1) {
+			return 0;
+		}
 
-		XR_EARLY_EXIT();
-	}
+		if (inst->Func == &XrExecuteBeq) {
+			prev->Func = &XrExecuteSubBeq;
+		} else if (inst->Func == &XrExecuteBne) {
+			prev->Func = &XrExecuteSubBne;
+		} else {
+			return 0;
+		}
 
-	XrJalrPredictionTable *ptable = (void*)block->CachedPaths[0];
+		prev->Imm8_3 = prev->Imm32_1;
+		prev->Imm32_1 = inst->Imm32_1;
 
-	if (XrUnlikely(!ptable)) {
-		ptable = XrAllocatePtable(proc);
-		block->CachedPaths[0] = (void*)ptable;
-		block->HasPtable = 1;
+		return 1;
 	}
 
-	XrIblock *iblock;
-
-	int index = (pc >> 2) & (XR_JALR_PREDICTION_TABLE_ENTRIES - 1);
-
-	if (XrLikely(ptable->Pcs[index] == pc)) {
-		iblock = ptable->Iblocks[index];
-		if (XrLikely(iblock != 0)) {
-			goto dispatch;
-		}
-	}
+	// Everything else begins with a LUI RD, ZERO, HI, which was decoded as an
+	// ORI from the fake zero register. Note that in a TB miss handler the zero
+	// source isn't redirected, so none of this happens there.
 
-	iblock = XrDecodeInstructions(proc, block);
+	if (prev->Func != &XrExecuteOri ||
+		prev->Imm8_2 != XR_FAKE_ZERO_REGISTER ||
+		(prev->Imm32_1 & 0xFFFF) != 0) {
 
-	if (XrUnlikely(!iblock)) {
-		XR_EARLY_EXIT();
+		return 0;
 	}
 
-	ptable->Pcs[index] = pc;
+	uint32_t rd = prev->Imm8_1;
+	uint32_t upper = prev->Imm32_1;
 
-	XrCreateCachedPointerToBlock(iblock, &ptable->Iblocks[index]);
+	if (inst->Func == &XrExecuteOri || inst->Func == &XrExecuteAddi) {
+		// ORI/ADDI RD, RD, LO completes the constant.
 
-dispatch:
+		if (inst->Imm8_1 != rd || inst->Imm8_2 != rd) {
+			return 0;
+		}
 
-	XR_DISPATCH(iblock);
-}
+		prev->Func = &XrExecuteLoadConstant;
 
-XR_PRESERVE_NONE
-static void XrExecuteAdr(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 59 @ %x\n", proc->Pc);
+		if (inst->Func == &XrExecuteOri) {
+			prev->Imm32_1 = upper | inst->Imm32_1;
+		} else {
+			prev->Imm32_1 = upper + inst->Imm32_1;
+		}
 
-	proc->Reg[inst->Imm8_1] = inst->Imm32_1;
+		return 1;
+	}
 
-	XR_NEXT();
-}
+	for (int i = 0; i < 6; i++) {
+		XrAbsoluteForm *form = &XrAbsoluteForms[i];
 
-XR_PRESERVE_NONE
-static void XrExecuteJal(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 60\n");
+		if (inst->Func != form->Original) {
+			continue;
+		}
 
-	proc->Reg[LR] = proc->Pc + 4;
-	proc->Pc = inst->Imm32_1;
+		// The base register is RD for stores and RA for loads.
 
-	XrIblock *iblock = block->CachedPaths[XR_TRUE_PATH];
+		if (form->IsStore) {
+			if (inst->Imm8_1 != rd) {
+				return 0;
+			}
 
-	if (XrUnlikely(!iblock)) {
-		iblock = XrDecodeInstructions(proc, block);
+			prev->Imm8_1 = rd;
+			prev->Imm8_2 = inst->Imm8_2;
+		} else {
+			if (inst->Imm8_2 != rd) {
+				return 0;
+			}
 
-		if (XrUnlikely(!iblock)) {
-			XR_EARLY_EXIT();
+			prev->Imm8_1 = inst->Imm8_1;
+			prev->Imm8_2 = rd;
 		}
 
-		XrCreateCachedPointerToBlock(iblock, &block->CachedPaths[XR_TRUE_PATH]);
+		prev->Func = form->Absolute;
+		prev->Imm32_1 = upper | (inst->Imm32_1 >> form->Shift);
+
+		return 1;
 	}
 
-	XR_DISPATCH(iblock);
+	return 0;
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteJ(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 61\n");
-
-	proc->Pc = inst->Imm32_1;
+// The dataflow pass in XrOptimizeIblock needs to know which registers each
+// cached instruction reads and writes, whether it can leave the Iblock early
+// (by causing an exception or taking a side exit), and how to compute its
+// result if its operands are known. Instructions without a form here are
+// treated as reading every register and clobbering everything known.
+
+enum XrFlowKinds {
+	XR_FLOW_REG,            // RD = RA op RB
+	XR_FLOW_IMM,            // RD = RA op IMM
+	XR_FLOW_SHIFT,          // SINK = RD op IMM8_2
+	XR_FLOW_CONST,          // RD = IMM
+	XR_FLOW_MOVE,           // RD = RA
+	XR_FLOW_LOAD,           // RD = [RA + IMM]
+	XR_FLOW_LOAD_REG,       // RD = [RA + RB]
+	XR_FLOW_LOAD_DIRECT,    // RD = [IMM]
+	XR_FLOW_LOAD_ABSOLUTE,  // RA = UPPER, RD = [ADDRESS]
+	XR_FLOW_STORE,          // [RD + IMM] = RA
+	XR_FLOW_STORE_IMM,      // [RD + IMM] = SMALL
+	XR_FLOW_STORE_REG,      // [RA + RB] = RD
+	XR_FLOW_STORE_DIRECT,   // [IMM] = RD
+	XR_FLOW_STORE_ABSOLUTE, // RD = UPPER, [ADDRESS] = RA
+	XR_FLOW_GUARD,          // Exit on RD
+};
 
-	XrIblock *iblock = block->CachedPaths[XR_TRUE_PATH];
+enum XrFlowOps {
+	XR_FLOW_NONE,
+	XR_FLOW_ADD,
+	XR_FLOW_SUB,
+	XR_FLOW_OR,
+	XR_FLOW_AND,
+	XR_FLOW_XOR,
+	XR_FLOW_NOR,
+	XR_FLOW_SLT,
+	XR_FLOW_SLTS,
+	XR_FLOW_MUL,
+	XR_FLOW_DIV,
+	XR_FLOW_DIVS,
+	XR_FLOW_MOD,
+	XR_FLOW_LSH,
+	XR_FLOW_RSH,
+	XR_FLOW_ASH,
+	XR_FLOW_ROR,
+};
 
-	if (XrUnlikely(!iblock)) {
-		iblock = XrDecodeInstructions(proc, block);
+typedef struct _XrFlowForm {
+	XrInstImplF Func;
+	uint8_t Kind;
+	uint8_t Op;
+
+	// For register ALU instructions, the equivalent taking an immediate RB.
+	// For loads and stores, the equivalent taking a full address.
+
+	XrInstImplF Alternate;
+} XrFlowForm;
+
+static XrFlowForm XrFlowForms[] = {
+	{ &XrExecuteAdd, XR_FLOW_REG, XR_FLOW_ADD, &XrExecuteAddi },
+	{ &XrExecuteSub, XR_FLOW_REG, XR_FLOW_SUB, &XrExecuteSubi },
+	{ &XrExecuteOr, XR_FLOW_REG, XR_FLOW_OR, &XrExecuteOri },
+	{ &XrExecuteAnd, XR_FLOW_REG, XR_FLOW_AND, &XrExecuteAndi },
+	{ &XrExecuteXor, XR_FLOW_REG, XR_FLOW_XOR, &XrExecuteXori },
+	{ &XrExecuteSlt, XR_FLOW_REG, XR_FLOW_SLT, &XrExecuteSlti },
+	{ &XrExecuteSltSigned, XR_FLOW_REG, XR_FLOW_SLTS, &XrExecuteSltiSigned },
+	{ &XrExecuteNor, XR_FLOW_REG, XR_FLOW_NOR, 0 },
+	{ &XrExecuteMul, XR_FLOW_REG, XR_FLOW_MUL, 0 },
+	{ &XrExecuteDiv, XR_FLOW_REG, XR_FLOW_DIV, 0 },
+	{ &XrExecuteDivSigned, XR_FLOW_REG, XR_FLOW_DIVS, 0 },
+	{ &XrExecuteMod, XR_FLOW_REG, XR_FLOW_MOD, 0 },
+	{ &XrExecuteLsh, XR_FLOW_REG, XR_FLOW_LSH, 0 },
+	{ &XrExecuteRsh, XR_FLOW_REG, XR_FLOW_RSH, 0 },
+	{ &XrExecuteAsh, XR_FLOW_REG, XR_FLOW_ASH, 0 },
+	{ &XrExecuteRor, XR_FLOW_REG, XR_FLOW_ROR, 0 },
+
+	{ &XrExecuteAddi, XR_FLOW_IMM, XR_FLOW_ADD, 0 },
+	{ &XrExecuteSubi, XR_FLOW_IMM, XR_FLOW_SUB, 0 },
+	{ &XrExecuteOri, XR_FLOW_IMM, XR_FLOW_OR, 0 },
+	{ &XrExecuteAndi, XR_FLOW_IMM, XR_FLOW_AND, 0 },
+	{ &XrExecuteXori, XR_FLOW_IMM, XR_FLOW_XOR, 0 },
+	{ &XrExecuteSlti, XR_FLOW_IMM, XR_FLOW_SLT, 0 },
+	{ &XrExecuteSltiSigned, XR_FLOW_IMM, XR_FLOW_SLTS, 0 },
+	{ &XrExecuteAddiInPlace, XR_FLOW_IMM, XR_FLOW_ADD, 0 },
+
+	{ &XrExecuteVirtualLsh, XR_FLOW_SHIFT, XR_FLOW_LSH, 0 },
+	{ &XrExecuteVirtualRsh, XR_FLOW_SHIFT, XR_FLOW_RSH, 0 },
+	{ &XrExecuteVirtualAsh, XR_FLOW_SHIFT, XR_FLOW_ASH, 0 },
+	{ &XrExecuteVirtualRor, XR_FLOW_SHIFT, XR_FLOW_ROR, 0 },
+
+	{ &XrExecuteAdr, XR_FLOW_CONST, XR_FLOW_NONE, 0 },
+	{ &XrExecuteLoadConstant, XR_FLOW_CONST, XR_FLOW_NONE, 0 },
+	{ &XrExecuteMove, XR_FLOW_MOVE, XR_FLOW_NONE, 0 },
+
+	{ &XrExecuteLoadLongImmOffset, XR_FLOW_LOAD, XR_FLOW_NONE, &XrExecuteLoadLongDirect },
+	{ &XrExecuteLoadIntImmOffset, XR_FLOW_LOAD, XR_FLOW_NONE, &XrExecuteLoadIntDirect },
+	{ &XrExecuteLoadByteImmOffset, XR_FLOW_LOAD, XR_FLOW_NONE, &XrExecuteLoadByteDirect },
+	{ &XrExecuteLoadLongRegOffset, XR_FLOW_LOAD_REG, XR_FLOW_NONE, &XrExecuteLoadLongDirect },
+	{ &XrExecuteLoadIntRegOffset, XR_FLOW_LOAD_REG, XR_FLOW_NONE, &XrExecuteLoadIntDirect },
+	{ &XrExecuteLoadByteRegOffset, XR_FLOW_LOAD_REG, XR_FLOW_NONE, &XrExecuteLoadByteDirect },
+	{ &XrExecuteLoadLongDirect, XR_FLOW_LOAD_DIRECT, XR_FLOW_NONE, 0 },
+	{ &XrExecuteLoadIntDirect, XR_FLOW_LOAD_DIRECT, XR_FLOW_NONE, 0 },
+	{ &XrExecuteLoadByteDirect, XR_FLOW_LOAD_DIRECT, XR_FLOW_NONE, 0 },
+	{ &XrExecuteLoadLongAbsolute, XR_FLOW_LOAD_ABSOLUTE, XR_FLOW_NONE, 0 },
+	{ &XrExecuteLoadIntAbsolute, XR_FLOW_LOAD_ABSOLUTE, XR_FLOW_NONE, 0 },
+	{ &XrExecuteLoadByteAbsolute, XR_FLOW_LOAD_ABSOLUTE, XR_FLOW_NONE, 0 },
+
+	{ &XrExecuteStoreLongImmOffsetReg, XR_FLOW_STORE, XR_FLOW_NONE, &XrExecuteStoreLongDirect },
+	{ &XrExecuteStoreIntImmOffsetReg, XR_FLOW_STORE, XR_FLOW_NONE, &XrExecuteStoreIntDirect },
+	{ &XrExecuteStoreByteImmOffsetReg, XR_FLOW_STORE, XR_FLOW_NONE, &XrExecuteStoreByteDirect },
+	{ &XrExecuteStoreLongImmOffsetImm, XR_FLOW_STORE_IMM, XR_FLOW_NONE, 0 },
+	{ &XrExecuteStoreIntImmOffsetImm, XR_FLOW_STORE_IMM, XR_FLOW_NONE, 0 },
+	{ &XrExecuteStoreByteImmOffsetImm, XR_FLOW_STORE_IMM, XR_FLOW_NONE, 0 },
+	{ &XrExecuteStoreLongRegOffset, XR_FLOW_STORE_REG, XR_FLOW_NONE, &XrExecuteStoreLongDirect },
+	{ &XrExecuteStoreIntRegOffset, XR_FLOW_STORE_REG, XR_FLOW_NONE, &XrExecuteStoreIntDirect },
+	{ &XrExecuteStoreByteRegOffset, XR_FLOW_STORE_REG, XR_FLOW_NONE, &XrExecuteStoreByteDirect },
+	{ &XrExecuteStoreLongDirect, XR_FLOW_STORE_DIRECT, XR_FLOW_NONE, 0 },
+	{ &XrExecuteStoreIntDirect, XR_FLOW_STORE_DIRECT, XR_FLOW_NONE, 0 },
+	{ &XrExecuteStoreByteDirect, XR_FLOW_STORE_DIRECT, XR_FLOW_NONE, 0 },
+	{ &XrExecuteStoreLongAbsolute, XR_FLOW_STORE_ABSOLUTE, XR_FLOW_NONE, 0 },
+	{ &XrExecuteStoreIntAbsolute, XR_FLOW_STORE_ABSOLUTE, XR_FLOW_NONE, 0 },
+	{ &XrExecuteStoreByteAbsolute, XR_FLOW_STORE_ABSOLUTE, XR_FLOW_NONE, 0 },
 
-		if (XrUnlikely(!iblock)) {
-			XR_EARLY_EXIT();
-		}
+#if !XR_SIMULATE_CACHES
+	{ &XrExecuteTraceGuard, XR_FLOW_GUARD, XR_FLOW_NONE, 0 },
+#endif
+};
 
-		XrCreateCachedPointerToBlock(iblock, &block->CachedPaths[XR_TRUE_PATH]);
-	}
+#define XR_FLOW_FORM_COUNT (sizeof(XrFlowForms) / sizeof(XrFlowForms[0]))
 
-	XR_DISPATCH(iblock);
-}
+#define XR_FLOW_BIT(reg) (1ull << (reg))
 
-XR_PRESERVE_NONE
-static void XrExecuteVirtualLsh(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 101\n");
+// Every register that might be looked at after the Iblock exits, or when it
+// leaves early. Outside of a TB miss handler, sources are all redirected to
+// the fake zero register, so the real zero register is never among them.
 
-	proc->Reg[XR_FAKE_SHIFT_SINK] = proc->Reg[inst->Imm8_1] << inst->Imm8_2;
+#define XR_FLOW_ALL (((1ull << XR_REG_MAX) - 1) & ~XR_FLOW_BIT(0))
 
-	XR_NEXT_NO_PC();
-}
+// The forms are looked up for every decoded instruction, which has to be cheap
+// since some guests decode constantly, so they're hashed by handler address.
 
-XR_PRESERVE_NONE
-static void XrExecuteVirtualRsh(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 102\n");
+#define XR_FLOW_HASH_SIZE 256
 
-	proc->Reg[XR_FAKE_SHIFT_SINK] = proc->Reg[inst->Imm8_1] >> inst->Imm8_2;
+#define XR_FLOW_HASH(func) (((uintptr_t)(func) * 0x9E3779B97F4A7C15ull) >> 56)
 
-	XR_NEXT_NO_PC();
-}
+static XrFlowForm *XrFlowFormHash[XR_FLOW_HASH_SIZE];
 
-XR_PRESERVE_NONE
-static void XrExecuteVirtualAsh(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 103\n");
+static void XrInitializeFlowForms(void) {
+	for (int i = 0; i < XR_FLOW_FORM_COUNT; i++) {
+		uint32_t index = XR_FLOW_HASH(XrFlowForms[i].Func);
 
-	proc->Reg[XR_FAKE_SHIFT_SINK] = (int32_t) proc->Reg[inst->Imm8_1] >> inst->Imm8_2;
+		while (XrFlowFormHash[index]) {
+			index = (index + 1) & (XR_FLOW_HASH_SIZE - 1);
+		}
 
-	XR_NEXT_NO_PC();
+		XrFlowFormHash[index] = &XrFlowForms[i];
+	}
 }
 
-XR_PRESERVE_NONE
-static void XrExecuteVirtualRor(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 104\n");
+static inline XrFlowForm *XrFindFlowForm(XrInstImplF func) {
+	uint32_t index = XR_FLOW_HASH(func);
 
-	proc->Reg[XR_FAKE_SHIFT_SINK] = RoR(proc->Reg[inst->Imm8_1], inst->Imm8_2);
+	while (1) {
+		XrFlowForm *form = XrFlowFormHash[index];
+
+		if (!form || form->Func == func) {
+			return form;
+		}
 
-	XR_NEXT_NO_PC();
+		index = (index + 1) & (XR_FLOW_HASH_SIZE - 1);
+	}
 }
 
-static XrInstImplF XrVirtualShiftInstructionTable[4] = {
-	[0] = &XrExecuteVirtualLsh,
-	[1] = &XrExecuteVirtualRsh,
-	[2] = &XrExecuteVirtualAsh,
-	[3] = &XrExecuteVirtualRor
-};
+static int XrFlowEvaluate(uint32_t op, uint32_t a, uint32_t b, uint32_t *result) {
+	// Compute the result of the operation the same way as the instruction
+	// would. Returns 0 if the result shouldn't be computed at decode time.
 
-static XrInstImplF XrRegShiftFunctionTable[4] = {
-	[0] = &XrExecuteLsh,
-	[1] = &XrExecuteRsh,
-	[2] = &XrExecuteAsh,
-	[3] = &XrExecuteRor
-};
+	switch (op) {
+		case XR_FLOW_ADD:
+			*result = a + b;
+			return 1;
 
-#define XR_REDIRECT_ZERO_SRC(src) ((((proc->Cr[RS] & RS_TBMISS) == 0) && ((src) == 0)) ? XR_FAKE_ZERO_REGISTER : (src))
+		case XR_FLOW_SUB:
+			*result = a - b;
+			return 1;
 
-typedef XrCachedInst *(*XrDecodeInstructionF)(XrProcessor *proc, XrCachedInst *inst, uint32_t ir, uint32_t pc);
+		case XR_FLOW_OR:
+			*result = a | b;
+			return 1;
 
-static XrCachedInst *XrDecodeIllegalInstruction(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteIllegalInstruction;
+		case XR_FLOW_AND:
+			*result = a & b;
+			return 1;
 
-	return 0;
-}
+		case XR_FLOW_XOR:
+			*result = a ^ b;
+			return 1;
 
-static XrCachedInst *XrDecodeRfe(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteRfe;
+		case XR_FLOW_NOR:
+			*result = ~(a | b);
+			return 1;
 
-	return 0;
-}
+		case XR_FLOW_SLT:
+			*result = a < b;
+			return 1;
 
-static XrCachedInst *XrDecodeHlt(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteHlt;
+		case XR_FLOW_SLTS:
+			*result = (int32_t) a < (int32_t) b;
+			return 1;
 
-	return 0;
-}
+		case XR_FLOW_MUL:
+			*result = a * b;
+			return 1;
 
-static XrCachedInst *XrDecodeMtcr(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteMtcr;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm8_2 = (ir >> 16) & 31;
+		case XR_FLOW_DIV:
+			*result = b ? a / b : 0;
+			return 1;
 
-	return inst + 1;
-}
+		case XR_FLOW_DIVS:
+			if (a == 0x80000000 && b == 0xFFFFFFFF) {
+				// Leave the host's opinion on this to run time.
 
-static XrCachedInst *XrDecodeMfcr(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteMfcr;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = (ir >> 16) & 31;
+				return 0;
+			}
 
-	return inst + 1;
-}
+			*result = b ? (uint32_t) ((int32_t) a / (int32_t) b) : 0;
+			return 1;
 
-static XrDecodeInstructionF XrDecodeFunctions101001[16] = {
-	[0] = &XrDecodeIllegalInstruction,
-	[1] = &XrDecodeIllegalInstruction,
-	[2] = &XrDecodeIllegalInstruction,
-	[3] = &XrDecodeIllegalInstruction,
-	[4] = &XrDecodeIllegalInstruction,
-	[5] = &XrDecodeIllegalInstruction,
-	[6] = &XrDecodeIllegalInstruction,
-	[7] = &XrDecodeIllegalInstruction,
-	[8] = &XrDecodeIllegalInstruction,
-	[9] = &XrDecodeIllegalInstruction,
-	[10] = &XrDecodeIllegalInstruction,
-	[11] = &XrDecodeRfe,
-	[12] = &XrDecodeHlt,
-	[13] = &XrDecodeIllegalInstruction,
-	[14] = &XrDecodeMtcr,
-	[15] = &XrDecodeMfcr,
-};
+		case XR_FLOW_MOD:
+			*result = b ? a % b : 0;
+			return 1;
 
-static XrCachedInst *XrDecodeSys(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteSys;
+		// The shifts take the amount from A and the value from B.
 
-	return inst + 1;
-}
+		case XR_FLOW_LSH:
+			*result = b << (a & 31);
+			return 1;
 
-static XrCachedInst *XrDecodeBrk(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteBrk;
+		case XR_FLOW_RSH:
+			*result = b >> (a & 31);
+			return 1;
 
-	return inst + 1;
-}
+		case XR_FLOW_ASH:
+			*result = (int32_t) b >> (a & 31);
+			return 1;
 
-static XrCachedInst *XrDecodeWmb(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteWmb;
+		case XR_FLOW_ROR:
+			*result = RoR(b, a & 31);
+			return 1;
+	}
 
-	return inst + 1;
+	return 0;
 }
 
-static XrCachedInst *XrDecodeMb(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteMb;
-
-	return inst + 1;
-}
+// Which operand fields of each kind of instruction name registers that it reads
+// or writes, and whether it might leave the Iblock early.
+
+#define XR_FLOW_FIELD_1    1 // Imm8_1
+#define XR_FLOW_FIELD_2    2 // Imm8_2
+#define XR_FLOW_FIELD_3    4 // Imm32_1
+#define XR_FLOW_FIELD_SINK 8 // The fake shift sink
+
+typedef struct _XrFlowOperandForm {
+	uint8_t Reads;
+	uint8_t Writes;
+	uint8_t Exits;
+} XrFlowOperandForm;
+
+static XrFlowOperandForm XrFlowOperandForms[] = {
+	[XR_FLOW_REG] = { XR_FLOW_FIELD_2 | XR_FLOW_FIELD_3, XR_FLOW_FIELD_1, 0 },
+	[XR_FLOW_IMM] = { XR_FLOW_FIELD_2, XR_FLOW_FIELD_1, 0 },
+	[XR_FLOW_SHIFT] = { XR_FLOW_FIELD_1, XR_FLOW_FIELD_SINK, 0 },
+	[XR_FLOW_CONST] = { 0, XR_FLOW_FIELD_1, 0 },
+	[XR_FLOW_MOVE] = { XR_FLOW_FIELD_2, XR_FLOW_FIELD_1, 0 },
+	[XR_FLOW_LOAD] = { XR_FLOW_FIELD_2, XR_FLOW_FIELD_1, 1 },
+	[XR_FLOW_LOAD_REG] = { XR_FLOW_FIELD_2 | XR_FLOW_FIELD_3, XR_FLOW_FIELD_1, 1 },
+	[XR_FLOW_LOAD_DIRECT] = { 0, XR_FLOW_FIELD_1, 1 },
+	[XR_FLOW_LOAD_ABSOLUTE] = { 0, XR_FLOW_FIELD_1 | XR_FLOW_FIELD_2, 1 },
+	[XR_FLOW_STORE] = { XR_FLOW_FIELD_1 | XR_FLOW_FIELD_2, 0, 1 },
+	[XR_FLOW_STORE_IMM] = { XR_FLOW_FIELD_1, 0, 1 },
+	[XR_FLOW_STORE_REG] = { XR_FLOW_FIELD_1 | XR_FLOW_FIELD_2 | XR_FLOW_FIELD_3, 0, 1 },
+	[XR_FLOW_STORE_DIRECT] = { XR_FLOW_FIELD_1, 0, 1 },
+	[XR_FLOW_STORE_ABSOLUTE] = { XR_FLOW_FIELD_2, XR_FLOW_FIELD_1, 1 },
+	[XR_FLOW_GUARD] = { XR_FLOW_FIELD_1, 0, 1 },
+};
 
-static XrCachedInst *XrDecodePause(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecutePause;
+static inline uint64_t XrFlowRegisters(XrCachedInst *inst, uint32_t fields) {
+	// Imm32_1 is only looked at if it names a register, but it's masked so
+	// that the shift is defined either way.
 
-	return inst + 1;
-}
+	uint64_t regs = 0;
 
-static XrCachedInst *XrDecodeSC(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteSC;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+	regs |= (fields & XR_FLOW_FIELD_1) ? XR_FLOW_BIT(inst->Imm8_1) : 0;
+	regs |= (fields & XR_FLOW_FIELD_2) ? XR_FLOW_BIT(inst->Imm8_2) : 0;
+	regs |= (fields & XR_FLOW_FIELD_3) ? XR_FLOW_BIT(inst->Imm32_1 & 63) : 0;
+	regs |= (fields & XR_FLOW_FIELD_SINK) ? XR_FLOW_BIT(XR_FAKE_SHIFT_SINK) : 0;
 
-	return inst + 1;
+	return regs;
 }
 
-static XrCachedInst *XrDecodeLL(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteLL;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
+static void XrOptimizeIblock(XrProcessor *proc, XrIblock *iblock) {
+	// Dataflow pass over a freshly decoded Iblock. A forward walk propagates
+	// register values that are known at decode time, folding instructions
+	// whose operands are all known into constant loads, loads and stores with
+	// a known base into direct accesses, and specializing instructions on
+	// patterns such as a zero immediate or RD == RA. A backward walk then
+	// drops writes that are overwritten or unused before the Iblock exits.
+	//
+	// The architecturally visible state has to be exact wherever the Iblock
+	// can be left early. So every register is considered live before an
+	// instruction that can cause an exception or take a side exit, and writes
+	// are only dropped from the stretches of plain arithmetic in between.
+	// Removed slots are squeezed out, but each remaining slot keeps its own
+	// PcOffset, and the Iblock's cycle count is left alone, so PC recovery
+	// and instruction accounting are unaffected.
 
-	return inst + 1;
-}
+	int count = iblock->InstCount;
+	XrCachedInst *insts = iblock->Insts;
 
-#define XR_INSERT_SHIFT() \
-	if (((ir >> 21) & 31) != 0) { \
-		/* The inline shift amount is nonzero, so generate a virtual shift */ \
-		/* instruction before the proper one. */ \
-\
-		inst->Func = XrVirtualShiftInstructionTable[(ir >> 26) & 3]; \
-		inst->Imm8_1 = rb; \
-		inst->Imm8_2 = (ir >> 21) & 31; \
-\
-		/* Redirect the real instruction to take its RB register from the */ \
-		/* result of the virtual instruction. */ \
-\
-		rb = XR_FAKE_SHIFT_SINK; \
-\
-		inst++; \
-	}
+	// The registers each slot needs and provides, as seen by the backward
+	// walk. A slot that might leave the Iblock needs everything and provides
+	// nothing.
 
-static XrCachedInst *XrDecodeMod(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+	uint64_t needs[XR_IBLOCK_INSTS + 2];
+	uint64_t provides[XR_IBLOCK_INSTS + 2];
 
-	XR_INSERT_SHIFT();
+	int removed = 0;
 
-	inst->Func = &XrExecuteMod;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+	uint64_t known = XR_FLOW_BIT(XR_FAKE_ZERO_REGISTER);
+	uint32_t values[XR_REG_MAX];
 
-	return inst + 1;
-}
+	values[XR_FAKE_ZERO_REGISTER] = 0;
 
-static XrCachedInst *XrDecodeDivSigned(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+	for (int i = 0; i < count; i++) {
+		XrCachedInst *inst = &insts[i];
+		XrFlowForm *form = XrFindFlowForm(inst->Func);
 
-	XR_INSERT_SHIFT();
+		if (!form) {
+			// Unknown effects.
 
-	inst->Func = &XrExecuteDivSigned;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+			needs[i] = XR_FLOW_ALL;
+			provides[i] = 0;
 
-	return inst + 1;
-}
+			known = XR_FLOW_BIT(XR_FAKE_ZERO_REGISTER);
 
-static XrCachedInst *XrDecodeDiv(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+			continue;
+		}
 
-	XR_INSERT_SHIFT();
+		XrInstImplF func = inst->Func;
+		uint32_t rd = inst->Imm8_1;
+		uint32_t ra = inst->Imm8_2;
+		uint32_t rb = inst->Imm32_1;
+		uint32_t result;
+		int folded = 0;
 
-	inst->Func = &XrExecuteDiv;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+		switch (form->Kind) {
+			case XR_FLOW_REG:
+				if ((known & XR_FLOW_BIT(ra)) && (known & XR_FLOW_BIT(rb)) &&
+					XrFlowEvaluate(form->Op, values[ra], values[rb], &result)) {
 
-	return inst + 1;
-}
+					folded = 1;
 
-static XrCachedInst *XrDecodeMul(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+					break;
+				}
 
-	XR_INSERT_SHIFT();
+				if (!form->Alternate) {
+					break;
+				}
 
-	inst->Func = &XrExecuteMul;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+				if (known & XR_FLOW_BIT(rb)) {
+					// Switch to the immediate form.
 
-	return inst + 1;
-}
+					inst->Func = form->Alternate;
+					inst->Imm32_1 = values[rb];
 
-static XrDecodeInstructionF XrDecodeFunctions110001[16] = {
-	[0] = &XrDecodeSys,
-	[1] = &XrDecodeBrk,
-	[2] = &XrDecodeWmb,
-	[3] = &XrDecodeMb,
-	[4] = &XrDecodeIllegalInstruction,
-	[5] = &XrDecodeIllegalInstruction,
-	[6] = &XrDecodePause,
-	[7] = &XrDecodeIllegalInstruction,
-	[8] = &XrDecodeSC,
-	[9] = &XrDecodeLL,
-	[10] = &XrDecodeIllegalInstruction,
-	[11] = &XrDecodeMod,
-	[12] = &XrDecodeDivSigned,
-	[13] = &XrDecodeDiv,
-	[14] = &XrDecodeIllegalInstruction,
-	[15] = &XrDecodeMul,
-};
+				} else if ((known & XR_FLOW_BIT(ra)) &&
+					(form->Op == XR_FLOW_ADD || form->Op == XR_FLOW_OR ||
+					form->Op == XR_FLOW_AND || form->Op == XR_FLOW_XOR)) {
 
-static XrCachedInst *XrDecodeNor(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+					// Commute, then switch to the immediate form.
 
-	XR_INSERT_SHIFT();
+					inst->Func = form->Alternate;
+					inst->Imm8_2 = rb;
+					inst->Imm32_1 = values[ra];
 
-	inst->Func = &XrExecuteNor;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+				} else {
+					break;
+				}
 
-	return inst + 1;
-}
+				ra = inst->Imm8_2;
 
-static XrCachedInst *XrDecodeOr(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+				// Fall through to look for specializations of the immediate
+				// form.
 
-	XR_INSERT_SHIFT();
+			case XR_FLOW_IMM: {
+				// The immediate form has the same operation as the register
+				// form.
 
-	inst->Func = &XrExecuteOr;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+				uint32_t op = form->Op;
+				uint32_t imm = inst->Imm32_1;
 
-	return inst + 1;
-}
+				if ((known & XR_FLOW_BIT(ra)) &&
+					XrFlowEvaluate(op, values[ra], imm, &result)) {
 
-static XrCachedInst *XrDecodeXor(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+					folded = 1;
 
-	XR_INSERT_SHIFT();
+				} else if (imm == 0 && (op == XR_FLOW_ADD || op == XR_FLOW_SUB ||
+					op == XR_FLOW_OR || op == XR_FLOW_XOR)) {
 
-	inst->Func = &XrExecuteXor;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+					inst->Func = &XrExecuteMove;
+					inst->Imm32_1 = 0;
 
-	return inst + 1;
-}
+				} else if (imm == 0 && op == XR_FLOW_AND) {
+					result = 0;
+					folded = 1;
 
-static XrCachedInst *XrDecodeAnd(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+				} else if (rd == ra && (op == XR_FLOW_ADD || op == XR_FLOW_SUB)) {
+					// RA is left equal to RD so that the JIT can still take
+					// this for an ADDI.
 
-	XR_INSERT_SHIFT();
+					inst->Func = &XrExecuteAddiInPlace;
 
-	inst->Func = &XrExecuteAnd;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+					if (op == XR_FLOW_SUB) {
+						inst->Imm32_1 = -imm;
+					}
+				}
 
-	return inst + 1;
-}
+				break;
+			}
 
-static XrCachedInst *XrDecodeSltSigned(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+			case XR_FLOW_SHIFT:
+				// The shifted value goes to the sink, and the amount is
+				// constant.
 
-	XR_INSERT_SHIFT();
+				if (known & XR_FLOW_BIT(rd)) {
+					XrFlowEvaluate(form->Op, ra, values[rd], &result);
 
-	inst->Func = &XrExecuteSltSigned;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+					rd = XR_FAKE_SHIFT_SINK;
+					folded = 1;
+				}
 
-	return inst + 1;
-}
+				break;
 
-static XrCachedInst *XrDecodeSlt(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+			case XR_FLOW_MOVE:
+				if (known & XR_FLOW_BIT(ra)) {
+					result = values[ra];
+					folded = 1;
+				}
 
-	XR_INSERT_SHIFT();
+				break;
 
-	inst->Func = &XrExecuteSlt;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+			case XR_FLOW_LOAD:
+				if (known & XR_FLOW_BIT(ra)) {
+					inst->Func = form->Alternate;
+					inst->Imm32_1 = values[ra] + rb;
+				}
 
-	return inst + 1;
-}
+				break;
 
-static XrCachedInst *XrDecodeSub(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+			case XR_FLOW_LOAD_REG:
+				if ((known & XR_FLOW_BIT(ra)) && (known & XR_FLOW_BIT(rb))) {
+					inst->Func = form->Alternate;
+					inst->Imm32_1 = values[ra] + values[rb];
+				}
 
-	XR_INSERT_SHIFT();
+				break;
 
-	inst->Func = &XrExecuteSub;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+			case XR_FLOW_STORE:
+				if (known & XR_FLOW_BIT(rd)) {
+					inst->Func = form->Alternate;
+					inst->Imm8_1 = ra;
+					inst->Imm32_1 = values[rd] + rb;
+				}
+
+				break;
 
-	return inst + 1;
-}
+			case XR_FLOW_STORE_REG:
+				if ((known & XR_FLOW_BIT(ra)) && (known & XR_FLOW_BIT(rb))) {
+					inst->Func = form->Alternate;
+					inst->Imm32_1 = values[ra] + values[rb];
+				}
 
-static XrCachedInst *XrDecodeAdd(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+				break;
+		}
 
-	XR_INSERT_SHIFT();
+		if (folded) {
+			// ADR does nothing but load a constant into RD, so it's used for
+			// every folded instruction.
 
-	inst->Func = &XrExecuteAdd;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+			inst->Func = &XrExecuteAdr;
+			inst->Imm8_1 = rd;
+			inst->Imm32_1 = result;
+		}
 
-	return inst + 1;
-}
+		if (inst->Func == &XrExecuteMove && inst->Imm8_1 == inst->Imm8_2) {
+			// This does nothing at all.
 
-static XrCachedInst *XrDecodeRegShifts(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = XrRegShiftFunctionTable[(ir >> 26) & 3];
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+			needs[i] = 0;
+			provides[i] = 0;
+			inst->Func = 0;
+			removed++;
 
-	return inst + 1;
-}
+			continue;
+		}
 
-static XrCachedInst *XrDecodeStoreLongRegOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+		if (inst->Func != func) {
+			form = XrFindFlowForm(inst->Func);
 
-	XR_INSERT_SHIFT();
+#ifdef PROFCPU
+			proc->OptimizedFoldCount++;
+#endif
+		}
 
-	inst->Func = &XrExecuteStoreLongRegOffset;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+		// Update what's known about the registers written by the instruction.
 
-	return inst + 1;
-}
+		XrFlowOperandForm *operands = &XrFlowOperandForms[form->Kind];
+		uint64_t writes = XrFlowRegisters(inst, operands->Writes);
 
-static XrCachedInst *XrDecodeStoreIntRegOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+		if (operands->Exits) {
+			needs[i] = XR_FLOW_ALL;
+			provides[i] = 0;
+		} else {
+			needs[i] = XrFlowRegisters(inst, operands->Reads);
+			provides[i] = writes;
+		}
 
-	XR_INSERT_SHIFT();
+		known &= ~writes;
 
-	inst->Func = &XrExecuteStoreIntRegOffset;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+		switch (form->Kind) {
+			case XR_FLOW_CONST:
+				known |= XR_FLOW_BIT(inst->Imm8_1);
+				values[inst->Imm8_1] = inst->Imm32_1;
 
-	return inst + 1;
-}
+				break;
 
-static XrCachedInst *XrDecodeStoreByteRegOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+			case XR_FLOW_LOAD_ABSOLUTE:
+				// The base register is written before the destination, which
+				// might be the same register.
 
-	XR_INSERT_SHIFT();
+				if (inst->Imm8_1 != inst->Imm8_2) {
+					known |= XR_FLOW_BIT(inst->Imm8_2);
+					values[inst->Imm8_2] = XR_ABSOLUTE_UPPER(inst->Imm32_1);
+				}
 
-	inst->Func = &XrExecuteStoreByteRegOffset;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+				break;
 
-	return inst + 1;
-}
+			case XR_FLOW_STORE_ABSOLUTE:
+				known |= XR_FLOW_BIT(inst->Imm8_1);
+				values[inst->Imm8_1] = XR_ABSOLUTE_UPPER(inst->Imm32_1);
 
-static XrCachedInst *XrDecodeLoadLongRegOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+				break;
+		}
+	}
 
-	XR_INSERT_SHIFT();
+	// Walk backwards to find dead writes. Everything is live when the Iblock
+	// exits, which it always does via its last instruction.
 
-	inst->Func = &XrExecuteLoadLongRegOffset;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+	uint64_t live = XR_FLOW_ALL;
 
-	return inst + 1;
-}
+	for (int i = count - 1; i >= 0; i--) {
+		if (provides[i] && (provides[i] & live) == 0) {
+			insts[i].Func = 0;
+			removed++;
 
-static XrCachedInst *XrDecodeLoadIntRegOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+			continue;
+		}
 
-	XR_INSERT_SHIFT();
+		live = (live & ~provides[i]) | needs[i];
+	}
 
-	inst->Func = &XrExecuteLoadIntRegOffset;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+	if (!removed) {
+		return;
+	}
 
-	return inst + 1;
-}
+#ifdef PROFCPU
+	proc->OptimizedDeadCount += removed;
+#endif
 
-static XrCachedInst *XrDecodeLoadByteRegOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	int rb = XR_REDIRECT_ZERO_SRC((ir >> 16) & 31);
+	// Squeeze out the removed slots.
 
-	XR_INSERT_SHIFT();
+	int j = 0;
 
-	inst->Func = &XrExecuteLoadByteRegOffset;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = rb;
+	for (int i = 0; i < count; i++) {
+		if (insts[i].Func) {
+			insts[j++] = insts[i];
+		}
+	}
 
-	return inst + 1;
+	iblock->InstCount = j;
 }
 
-static XrDecodeInstructionF XrDecodeFunctions111001[16] = {
-	[0] = &XrDecodeNor,
-	[1] = &XrDecodeOr,
-	[2] = &XrDecodeXor,
-	[3] = &XrDecodeAnd,
-	[4] = &XrDecodeSltSigned,
-	[5] = &XrDecodeSlt,
-	[6] = &XrDecodeSub,
-	[7] = &XrDecodeAdd,
-	[8] = &XrDecodeRegShifts,
-	[9] = &XrDecodeStoreLongRegOffset,
-	[10] = &XrDecodeStoreIntRegOffset,
-	[11] = &XrDecodeStoreByteRegOffset,
-	[12] = &XrDecodeIllegalInstruction,
-	[13] = &XrDecodeLoadLongRegOffset,
-	[14] = &XrDecodeLoadIntRegOffset,
-	[15] = &XrDecodeLoadByteRegOffset,
-};
+#ifdef FASTMEMORY
 
-static XrCachedInst *XrDecodeLui(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteOri;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = (ir >> 16) << 16;
+static void XrAssignDtbSlots(XrIblock *iblock) {
+	// Hand out the Iblock's per-instruction DTB lookup cache entries to its
+	// loads and stores, in order. This is done once the slots have stopped
+	// moving around, and the slot numbers are the same for every processor
+	// that shares the instructions, since only the entries are private.
 
-	return inst + 1;
-}
+	uint32_t slot = 0;
 
-static XrCachedInst *XrDecodeBpo(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteBpo;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+	for (int i = 0; i < iblock->InstCount; i++) {
+		XrCachedInst *inst = &iblock->Insts[i];
+		XrFlowForm *form = XrFindFlowForm(inst->Func);
 
-	return 0;
+		if (!form || form->Kind < XR_FLOW_LOAD || form->Kind > XR_FLOW_STORE_ABSOLUTE) {
+			continue;
+		}
+
+		if (slot < XR_IBLOCK_INST_DTB_SLOTS) {
+			inst->Imm8_3 = slot++;
+		} else {
+			inst->Imm8_3 = XR_INST_DTB_NONE;
+		}
+	}
 }
 
-static XrCachedInst *XrDecodeStoreLongImmOffsetImm(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteStoreLongImmOffsetImm;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm8_2 = (ir >> 11) & 31;
-	inst->Imm32_1 = (ir >> 16) << 2;
+#endif
 
-	return inst + 1;
-}
+typedef struct _XrGuardForm {
+	XrInstImplF Branch;
+	uint8_t Condition;
+} XrGuardForm;
+
+static XrGuardForm XrGuardForms[8] = {
+	{ &XrExecuteBeq, XR_GUARD_EQ },
+	{ &XrExecuteBne, XR_GUARD_NE },
+	{ &XrExecuteBlt, XR_GUARD_LT },
+	{ &XrExecuteBgt, XR_GUARD_GT },
+	{ &XrExecuteBle, XR_GUARD_LE },
+	{ &XrExecuteBge, XR_GUARD_GE },
+	{ &XrExecuteBpe, XR_GUARD_PE },
+	{ &XrExecuteBpo, XR_GUARD_PO },
+};
 
-static XrCachedInst *XrDecodeOri(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteOri;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = ir >> 16;
+static int XrDetectSpinLoop(XrIblock *iblock, XrCachedInst *inst) {
+	// The instruction in the given slot ends the Iblock. If it's a branch that
+	// closes a spin loop, turn it into a spin branch and return 1. Traces
+	// aren't extended past these, since the loop has to stay one Iblock.
 
-	return inst + 1;
-}
+	if (inst->Imm32_1 != iblock->Cold->Pc) {
+		return 0;
+	}
 
-static XrCachedInst *XrDecodeBpe(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteBpe;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+	int condition = -1;
+	uint32_t reg = inst->Imm8_1;
 
-	return 0;
-}
+	if (inst->Func == &XrExecuteB) {
+		// Test the fake zero register for equality, which always succeeds.
 
-static XrCachedInst *XrDecodeStoreIntImmOffsetImm(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteStoreIntImmOffsetImm;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm8_2 = (ir >> 11) & 31;
-	inst->Imm32_1 = (ir >> 16) << 1;
+		condition = XR_GUARD_EQ;
+		reg = XR_FAKE_ZERO_REGISTER;
+	} else {
+		for (int i = 0; i < 8; i++) {
+			if (inst->Func == XrGuardForms[i].Branch) {
+				condition = XrGuardForms[i].Condition;
+				break;
+			}
+		}
+	}
 
-	return inst + 1;
-}
+	if (condition == -1) {
+		return 0;
+	}
 
-static XrCachedInst *XrDecodeXori(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteXori;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = ir >> 16;
+	// Look for registers that are written by the loop and read before being
+	// written, like a counter. Those carry state from one iteration to the
+	// next, so the iterations wouldn't all be alike.
 
-	return inst + 1;
-}
+	uint64_t written = 0;
+	uint64_t carried = 0;
 
-static XrCachedInst *XrDecodeBge(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteBge;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+	for (XrCachedInst *slot = &iblock->Insts[0]; slot < inst; slot++) {
+		if (slot->Func == &XrExecutePause) {
+			continue;
+		}
 
-	return 0;
-}
+		XrFlowForm *form = XrFindFlowForm(slot->Func);
 
-static XrCachedInst *XrDecodeStoreByteImmOffsetImm(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteStoreByteImmOffsetImm;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm8_2 = (ir >> 11) & 31;
-	inst->Imm32_1 = ir >> 16;
+		if (!form) {
+			return 0;
+		}
 
-	return inst + 1;
-}
+		switch (form->Kind) {
+			case XR_FLOW_REG:
+			case XR_FLOW_IMM:
+			case XR_FLOW_SHIFT:
+			case XR_FLOW_CONST:
+			case XR_FLOW_MOVE:
+			case XR_FLOW_LOAD:
+			case XR_FLOW_LOAD_REG:
+			case XR_FLOW_LOAD_ABSOLUTE:
+				break;
 
-static XrCachedInst *XrDecodeAndi(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteAndi;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = ir >> 16;
+			default:
+				return 0;
+		}
 
-	return inst + 1;
-}
+		XrFlowOperandForm *operands = &XrFlowOperandForms[form->Kind];
 
-static XrCachedInst *XrDecodeBle(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteBle;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+		carried |= XrFlowRegisters(slot, operands->Reads) & ~written;
+		written |= XrFlowRegisters(slot, operands->Writes);
+	}
 
-	return 0;
-}
+	if (carried & written) {
+		return 0;
+	}
 
-static XrCachedInst *XrDecodeSltiSigned(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteSltiSigned;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = SignExt16(ir >> 16);
+	inst->Func = &XrExecuteSpinBranch;
+	inst->Imm8_1 = reg;
+	inst->Imm8_3 = condition;
 
-	return inst + 1;
+	return 1;
 }
 
-static XrCachedInst *XrDecodeBgt(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteBgt;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+#if !XR_SIMULATE_CACHES
 
-	return 0;
-}
+enum XrTraceActions {
+	XR_TRACE_STOP,
+	XR_TRACE_LINEAR,
+	XR_TRACE_SEGMENT_KEEP,
+	XR_TRACE_SEGMENT_DROP,
+};
 
-static XrCachedInst *XrDecode101001(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	return XrDecodeFunctions101001[ir >> 28](proc, inst, ir, pc);
-}
+static uint32_t *XrBeginTraceSegment(XrProcessor *proc, XrIblock *iblock, uint32_t target, int *instcount) {
+	// Start a new run of guest code within the trace at the given target
+	// address. Returns a host pointer to the instructions there, or 0 if the
+	// trace can't be continued at that address for any reason. Nothing here
+	// may cause an exception, since the instructions might never execute.
 
-static XrCachedInst *XrDecodeStoreLongImmOffsetReg(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteStoreLongImmOffsetReg;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = (ir >> 16) << 2;
+	if (iblock->SegmentCount >= XR_TRACE_SEGMENTS) {
+		return 0;
+	}
 
-	return inst + 1;
-}
+	if (iblock->Cycles >= XR_IBLOCK_INSTS) {
+		return 0;
+	}
 
-static XrCachedInst *XrDecodeLoadLongImmOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteLoadLongImmOffset;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = (ir >> 16) << 2;
+	uint32_t phys = target;
+	int flags = 0;
 
-	return inst + 1;
-}
+	if (XrLikely((proc->Cr[RS] & RS_MMU) != 0)) {
+		if (!XrProbeIstream(proc, target, &phys, &flags)) {
+			return 0;
+		}
 
-static XrCachedInst *XrDecodeSlti(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteSlti;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = ir >> 16;
+		if ((flags & PTE_KERNEL) != (iblock->PteFlags & PTE_KERNEL)) {
+			return 0;
+		}
+	}
 
-	return inst + 1;
-}
+	uint32_t *ir = EBusTranslate(phys);
 
-static XrCachedInst *XrDecodeBlt(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteBlt;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+	if (!ir) {
+		return 0;
+	}
 
-	return 0;
-}
+	// Make sure the trace is invalidated along with every virtual page and
+	// page frame it contains. A page link pairs the two, so a new virtual page
+	// must not alias a page frame that is already linked, or the Iblock would
+	// appear twice on that frame's list.
 
-static XrCachedInst *XrDecode110001(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	return XrDecodeFunctions110001[ir >> 28](proc, inst, ir, pc);
-}
+	uint32_t vpn = target & ~0xFFF;
+	uint32_t pfn = phys & ~0xFFF;
+	int found = 0;
 
-static XrCachedInst *XrDecodeStoreIntImmOffsetReg(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteStoreIntImmOffsetReg;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = (ir >> 16) << 1;
+	XrIblockCold *cold = iblock->Cold;
 
-	return inst + 1;
-}
+	for (int i = 0; i < cold->PageCount; i++) {
+		XrIblockPageLink *link = &cold->PageLinks[i];
 
-static XrCachedInst *XrDecodeLoadIntImmOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteLoadIntImmOffset;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = (ir >> 16) << 1;
+		if (link->Vpage->Vpn == vpn) {
+			if (link->Ppage->Pfn != pfn) {
+				return 0;
+			}
 
-	return inst + 1;
-}
+			found = 1;
+			break;
+		}
 
-static XrCachedInst *XrDecodeSubi(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteSubi;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = ir >> 16;
+		if (link->Ppage->Pfn == pfn) {
+			return 0;
+		}
+	}
 
-	return inst + 1;
-}
+	if (!found) {
+		if (cold->PageCount >= XR_TRACE_PAGES) {
+			return 0;
+		}
 
-static XrCachedInst *XrDecodeBne(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteBne;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
+		XrLinkIblockPage(proc, iblock, target, phys);
+	}
 
-	return 0;
-}
+	// Bias the segment so that the index of each of its instructions within
+	// the Iblock can be used to recover its address.
 
-static XrCachedInst *XrDecodeJalr(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteJalr;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = (ir >> 16) << 2;
+	iblock->PcBias[iblock->SegmentCount++] = target - (iblock->Cycles << 2);
 
-	return 0;
-}
+	// Don't allow the segment to cross a page boundary, or the Iblock to grow
+	// past the maximum number of guest instructions.
 
-static XrCachedInst *XrDecodeAdr(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteAdr;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm32_1 = pc + (ir & 0xFFFF0000);
+	int count = (0x1000 - (target & 0xFFF)) >> 2;
 
-	return inst + 1;
-}
+	if (count > XR_IBLOCK_INSTS - iblock->Cycles) {
+		count = XR_IBLOCK_INSTS - iblock->Cycles;
+	}
 
-static XrCachedInst *XrDecode111001(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	return XrDecodeFunctions111001[ir >> 28](proc, inst, ir, pc);
+	*instcount = count;
+
+	return ir;
 }
 
-static XrCachedInst *XrDecodeStoreByteImmOffsetReg(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteStoreByteImmOffsetReg;
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = ir >> 16;
+static int XrExtendTrace(XrProcessor *proc, XrIblock *iblock, XrCachedInst *inst, uint32_t pc, uint32_t *nextpc, uint32_t **nextir, int *nextcount) {
+	// The instruction in the given slot would end the Iblock. If it's a jump,
+	// or a conditional branch that has been observed to be biased, try to
+	// keep going along the path it's expected to take.
 
-	return inst + 1;
-}
+	if (inst + 1 >= &iblock->Insts[XR_IBLOCK_INSTS]) {
+		return XR_TRACE_STOP;
+	}
 
-static XrCachedInst *XrDecodeLoadByteImmOffset(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteLoadByteImmOffset;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = ir >> 16;
+	if (inst->Func == &XrExecuteB || inst->Func == &XrExecuteJ || inst->Func == &XrExecuteJal) {
+		uint32_t target = inst->Imm32_1;
 
-	return inst + 1;
-}
+		*nextir = XrBeginTraceSegment(proc, iblock, target, nextcount);
 
-static XrCachedInst *XrDecodeAddi(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteAddi;
-	inst->Imm8_1 = (ir >> 6) & 31;
-	inst->Imm8_2 = XR_REDIRECT_ZERO_SRC((ir >> 11) & 31);
-	inst->Imm32_1 = ir >> 16;
+		if (!*nextir) {
+			return XR_TRACE_STOP;
+		}
 
-	return inst + 1;
-}
+		*nextpc = target;
 
-static XrCachedInst *XrDecodeBeq(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Imm32_1 = pc + SignExt23((ir >> 11) << 2);
-	inst->Imm8_1 = XR_REDIRECT_ZERO_SRC((ir >> 6) & 31);
+		if (inst->Func == &XrExecuteJal) {
+			// Turn the JAL into an ADR of the return address.
 
-	if (inst->Imm8_1 == XR_FAKE_ZERO_REGISTER) {
-		// This is a BEQ, ZERO, XXX instruction.
-		// This is the canonical unconditional branch, generated by the B
-		// pseudo-instruction. We can optimize this a bit.
+			inst->Func = &XrExecuteAdr;
+			inst->Imm8_1 = LR;
+			inst->Imm32_1 = pc + 4;
 
-		inst->Func = &XrExecuteB;
+			return XR_TRACE_SEGMENT_KEEP;
+		}
 
-		return 0;
+		return XR_TRACE_SEGMENT_DROP;
 	}
 
-	inst->Func = &XrExecuteBeq;
+	int condition = -1;
 
-	return 0;
-}
+	for (int i = 0; i < 8; i++) {
+		if (inst->Func == XrGuardForms[i].Branch) {
+			condition = XrGuardForms[i].Condition;
+			break;
+		}
+	}
 
-static XrDecodeInstructionF XrDecodeLowSix[64] = {
-	[0] = &XrDecodeIllegalInstruction,
-	[1] = &XrDecodeIllegalInstruction,
-	[2] = &XrDecodeIllegalInstruction,
-	[3] = &XrDecodeIllegalInstruction,
-	[4] = &XrDecodeLui,
-	[5] = &XrDecodeBpo,
-	[6] = &XrDecodeIllegalInstruction,
-	[7] = &XrDecodeIllegalInstruction,
-	[8] = &XrDecodeIllegalInstruction,
-	[9] = &XrDecodeIllegalInstruction,
-	[10] = &XrDecodeStoreLongImmOffsetImm,
-	[11] = &XrDecodeIllegalInstruction,
-	[12] = &XrDecodeOri,
-	[13] = &XrDecodeBpe,
-	[14] = &XrDecodeIllegalInstruction,
-	[15] = &XrDecodeIllegalInstruction,
-	[16] = &XrDecodeIllegalInstruction,
-	[17] = &XrDecodeIllegalInstruction,
-	[18] = &XrDecodeStoreIntImmOffsetImm,
-	[19] = &XrDecodeIllegalInstruction,
-	[20] = &XrDecodeXori,
-	[21] = &XrDecodeBge,
-	[22] = &XrDecodeIllegalInstruction,
-	[23] = &XrDecodeIllegalInstruction,
-	[24] = &XrDecodeIllegalInstruction,
-	[25] = &XrDecodeIllegalInstruction,
-	[26] = &XrDecodeStoreByteImmOffsetImm,
-	[27] = &XrDecodeIllegalInstruction,
-	[28] = &XrDecodeAndi,
-	[29] = &XrDecodeBle,
-	[30] = &XrDecodeIllegalInstruction,
-	[31] = &XrDecodeIllegalInstruction,
-	[32] = &XrDecodeIllegalInstruction,
-	[33] = &XrDecodeIllegalInstruction,
-	[34] = &XrDecodeIllegalInstruction,
-	[35] = &XrDecodeIllegalInstruction,
-	[36] = &XrDecodeSltiSigned,
-	[37] = &XrDecodeBgt,
-	[38] = &XrDecodeIllegalInstruction,
-	[39] = &XrDecodeIllegalInstruction,
-	[40] = &XrDecodeIllegalInstruction,
-	[41] = &XrDecode101001,
-	[42] = &XrDecodeStoreLongImmOffsetReg,
-	[43] = &XrDecodeLoadLongImmOffset,
-	[44] = &XrDecodeSlti,
-	[45] = &XrDecodeBlt,
-	[46] = &XrDecodeIllegalInstruction,
-	[47] = &XrDecodeIllegalInstruction,
-	[48] = &XrDecodeAdr,
-	[49] = &XrDecode110001,
-	[50] = &XrDecodeStoreIntImmOffsetReg,
-	[51] = &XrDecodeLoadIntImmOffset,
-	[52] = &XrDecodeSubi,
-	[53] = &XrDecodeBne,
-	[54] = &XrDecodeIllegalInstruction,
-	[55] = &XrDecodeIllegalInstruction,
-	[56] = &XrDecodeJalr,
-	[57] = &XrDecode111001,
-	[58] = &XrDecodeStoreByteImmOffsetReg,
-	[59] = &XrDecodeLoadByteImmOffset,
-	[60] = &XrDecodeAddi,
-	[61] = &XrDecodeBeq,
-	[62] = &XrDecodeIllegalInstruction,
-	[63] = &XrDecodeIllegalInstruction,
-};
+	if (condition == -1) {
+		return XR_TRACE_STOP;
+	}
 
-static XrCachedInst *XrDecodeJal(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteJal;
-	inst->Imm32_1 = (pc & 0x80000000) | ((ir >> 3) << 2);
+	XrBranchBias *bias = &proc->BranchBias[XR_BRANCH_BIAS_INDEX(pc)];
 
-	return 0;
-}
+	if (bias->Pc != pc) {
+		// We don't know which way this branch tends to go, so profile it.
 
-static XrCachedInst *XrDecodeJ(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	inst->Func = &XrExecuteJ;
-	inst->Imm32_1 = (pc & 0x80000000) | ((ir >> 3) << 2);
+		iblock->Extendable = 1;
 
-	return 0;
-}
+		return XR_TRACE_STOP;
+	}
 
-static XrCachedInst *XrDecodeMajor(XrProcessor* proc, XrCachedInst *inst, uint32_t ir, uint32_t pc) {
-	return XrDecodeLowSix[ir & 63](proc, inst, ir, pc);
-}
+	if (iblock->GuardCount >= XR_TRACE_GUARDS) {
+		return XR_TRACE_STOP;
+	}
 
-static XrDecodeInstructionF XrDecodeLowThree[8] = {
-	[0] = &XrDecodeMajor,
-	[1] = &XrDecodeMajor,
-	[2] = &XrDecodeMajor,
-	[3] = &XrDecodeMajor,
-	[4] = &XrDecodeMajor,
-	[5] = &XrDecodeMajor,
-	[6] = &XrDecodeJ,
-	[7] = &XrDecodeJal,
-};
+	uint32_t target = inst->Imm32_1;
+	int action;
 
-XR_PRESERVE_NONE
-static void XrSpecialLinkageInstruction(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
-	DBGPRINT("exec 0\n");
+	if (bias->Taken) {
+		// Continue at the branch target, and exit to the fall-through address
+		// if the condition is false.
 
-	// This instruction is placed at the end of a basic block that didn't
-	// terminate in a natural way (with a branch or illegal instruction).
-	// It just directs the outer loop to look up the next block.
+		*nextir = XrBeginTraceSegment(proc, iblock, target, nextcount);
 
-	XrIblock *iblock = block->CachedPaths[XR_TRUE_PATH];
+		if (!*nextir) {
+			return XR_TRACE_STOP;
+		}
 
-	if (XrUnlikely(!iblock)) {
-		iblock = XrDecodeInstructions(proc, block);
+		*nextpc = target;
 
-		if (XrUnlikely(!iblock)) {
-			XR_EARLY_EXIT();
-		}
+		inst->Imm32_1 = pc + 4;
+		inst->Imm8_3 = condition;
 
-		XrCreateCachedPointerToBlock(iblock, &block->CachedPaths[XR_TRUE_PATH]);
+		action = XR_TRACE_SEGMENT_KEEP;
+	} else {
+		// Continue at the fall-through address, and exit to the branch target
+		// if the condition is true.
+
+		inst->Imm8_3 = condition | XR_GUARD_EXIT_IF_TRUE;
+
+		action = XR_TRACE_LINEAR;
 	}
 
-	XR_DISPATCH(iblock);
+	inst->Func = &XrExecuteTraceGuard;
+	inst->Imm8_2 = iblock->GuardCount;
+
+	iblock->SideExits[iblock->GuardCount++] = 0;
+
+	return action;
 }
 
+#endif
+
+#ifdef XR_JIT
+
+#include "xrjit.inc.c"
+
+#endif
+
 static XrIblock *XrDecodeInstructions(XrProcessor *proc, XrIblock *hazard) {
 	// Decode some instructions starting at the current virtual PC.
 	// Return NULLPTR if we fail to fetch the first instruction. This implies
 	// that an exception occurred, such as an ITB miss, page fault, or bus
-	// error.
+	// error. Also return NULLPTR, without an exception, if there was no room
+	// for the decoded instructions; the caller leaves the chain either way.
 
 	uint32_t pc = proc->Pc;
 
 	uint32_t asid = XR_CURRENT_ASID();
 
-	XrIblock *iblock = XrLookupIblock(proc, pc, asid);
+	XrIblock *iblock = XrLookupIblock(proc, pc, asid, asid);
 
 	if (XrLikely(iblock != 0)) {
 		// Already cached.
@@ -2942,6 +5522,8 @@ static XrIblock *XrDecodeInstructions(XrProcessor *proc, XrIblock *hazard) {
 			return 0;
 		}
 
+		iblock->Asid = asid;
+
 		return iblock;
 	}
 
@@ -2977,6 +5559,27 @@ static XrIblock *XrDecodeInstructions(XrProcessor *proc, XrIblock *hazard) {
 		}
 	}
 
+	uint32_t phys = fetchpc;
+
+	uint32_t key = asid;
+
+	if (XrSharedIblocks && (proc->Cr[RS] & RS_MMU) != 0) {
+		// Look for an Iblock fetched from the same page frame with the same
+		// PTE flags, possibly decoded in another address space. The valid bit
+		// is always set in the flags, so these keys never collide with an
+		// ASID. If one is found, it's now known to be valid in this one.
+
+		key = (phys & 0xFFFFF000) | flags;
+
+		iblock = XrLookupIblock(proc, pc, asid, key);
+
+		if (iblock) {
+			iblock->Asid = asid;
+
+			return iblock;
+		}
+	}
+
 #if !XR_SIMULATE_CACHES
 	uint32_t *ir = EBusTranslate(fetchpc);
 
@@ -3005,45 +5608,103 @@ static XrIblock *XrDecodeInstructions(XrProcessor *proc, XrIblock *hazard) {
 	}
 #endif
 
+#ifdef FASTMEMORY
+	// Look for code that some processor already decoded from the same page
+	// frame with the same PTE flags.
+
+	uint32_t codekey = (phys & 0xFFFFF000) | flags;
+	uint32_t epoch = 0;
+	XrSharedCode *code = 0;
+
+	if (XrSharedCodeStore) {
+		code = XrLookupSharedCode(proc, pc, codekey, &epoch);
+	}
+#endif
+
 	// Allocate an Iblock.
 
 	iblock = XrAllocateIblock(proc, hazard);
 
-	iblock->Pc = pc;
+	XrIblockCold *cold = iblock->Cold;
+
+	cold->Pc = pc;
+	cold->Key = key;
+	cold->CachedByFifoIndex = 0;
+	cold->HasPtable = 0;
+	cold->PageCount = 0;
+	cold->CodeClass = XR_CODE_CLASS_NONE;
+
 	iblock->Asid = asid;
 	iblock->Cycles = 0;
-	iblock->CachedByFifoIndex = 0;
 	iblock->PteFlags = flags;
-	iblock->HasPtable = 0;
+
+#ifdef XR_JIT
+	iblock->Native = 0;
+	iblock->Heat = XR_JIT_THRESHOLD;
+#endif
 
 	for (int i = 0; i < XR_CACHED_PATH_MAX; i++) {
 		iblock->CachedPaths[i] = 0;
 	}
 
-	for (int i = 0; i < XR_IBLOCK_CACHEDBY_MAX; i++) {
-		iblock->CachedBy[i] = 0;
-	}
+	for (int i = 0; i < XR_IBLOCK_CACHEDBY_MAX; i++) {
+		cold->CachedBy[i] = 0;
+	}
+
+#ifdef FASTMEMORY
+	for (int i = 0; i < XR_IBLOCK_DTB_CACHE_SIZE; i++) {
+		iblock->DtbLoadCache[i].MatchingDtbe = TB_INVALID_MATCHING;
+		iblock->DtbStoreCache[i].MatchingDtbe = TB_INVALID_MATCHING;
+	}
+
+	for (int i = 0; i < XR_IBLOCK_INST_DTB_SLOTS; i++) {
+		iblock->InstDtbCache[i].MatchingDtbe = TB_INVALID_MATCHING;
+	}
+
+	iblock->SegmentCount = 1;
+	iblock->GuardCount = 0;
+	iblock->Extendable = 0;
+	iblock->ProfileCount = 0;
+	iblock->TakenCount = 0;
+	iblock->SideExitCount = 0;
+#endif
+
+	iblock->PcBias[0] = pc;
+
+	XrLinkIblockPage(proc, iblock, pc, phys);
 
 #ifdef FASTMEMORY
-	for (int i = 0; i < XR_IBLOCK_DTB_CACHE_SIZE; i++) {
-		iblock->DtbLoadCache[i].MatchingDtbe = TB_INVALID_MATCHING;
-		iblock->DtbStoreCache[i].MatchingDtbe = TB_INVALID_MATCHING;
+	cold->Shared = 0;
+
+	if (code) {
+		XrAttachSharedCode(iblock, code);
+
+		goto insert;
 	}
 #endif
 
-	InsertAtHeadList(&proc->IblockHashBuckets[XR_IBLOCK_HASH(pc)], &iblock->HashEntry);
-	InsertAtHeadList(&proc->IblockLruList, &iblock->LruEntry);
+	// Decode into the processor's decode buffer, since we don't know how many
+	// instruction slots will be needed yet.
 
-	XrInsertIblockInVpage(proc, iblock, pc);
+	iblock->Insts = &proc->DecodeBuffer.Insts[0];
 
 	// Decode instructions starting at the offset of the program counter within
 	// the fetched chunk, until we reach either a branch, an illegal
-	// instruction, or the end of the chunk.
+	// instruction, or the end of the chunk. When caches aren't simulated, the
+	// Iblock may be extended into a trace past jumps and biased branches, in
+	// which case decoding continues in a new segment at the target.
 
 	// printf("decode %x %x %x %x %x %p\n", instindex, pc, fetchpc, ir[instindex], ir[instindex+1], ir);
 
 	XrCachedInst *inst = &iblock->Insts[0];
 
+	// The slot of the previously decoded instruction, which is considered for
+	// fusion with the current one, or 0 if there's no such candidate.
+
+	XrCachedInst *previnst = 0;
+
+	int segment = 0;
+
 	for (;
 		instindex < instcount;
 		instindex++, pc += 4) {
@@ -3055,10 +5716,93 @@ static XrIblock *XrDecodeInstructions(XrProcessor *proc, XrIblock *hazard) {
 
 		XrCachedInst *nextinst = XrDecodeLowThree[ir[instindex] & 7](proc, inst, ir[instindex], pc);
 
+		// Find the slot holding the instruction itself. This may be preceded
+		// by a virtual shift slot.
+
+		XrCachedInst *thisinst = nextinst ? nextinst - 1 : inst;
+
+		// Record the guest offset in each slot that was just filled in,
+		// including any virtual shift slot, so that the program counter can be
+		// recovered from any of them.
+
+		for (XrCachedInst *slot = inst; slot <= thisinst; slot++) {
+			slot->PcOffset = XR_PC_OFFSET(segment, iblock->Cycles - 1);
+		}
+
+		if (nextinst == 0 && XrDetectSpinLoop(iblock, thisinst)) {
+			goto done_no_linkage;
+		}
+
+#if !XR_SIMULATE_CACHES
+		if (nextinst == 0) {
+			uint32_t nextpc;
+
+			switch (XrExtendTrace(proc, iblock, thisinst, pc, &nextpc, &ir, &instcount)) {
+				case XR_TRACE_LINEAR:
+					// Keep going in the current segment.
+
+					nextinst = thisinst + 1;
+					previnst = 0;
+
+					goto next;
+
+				case XR_TRACE_SEGMENT_KEEP:
+					// Keep the slot and continue at the target.
+
+					nextinst = thisinst + 1;
+
+					break;
+
+				case XR_TRACE_SEGMENT_DROP:
+					// The jump was absorbed entirely, so the next instruction
+					// reuses its slot.
+
+					nextinst = thisinst;
+
+					break;
+
+				default:
+					goto no_trace;
+			}
+
+			// Set up so that the loop increment lands on the first instruction
+			// of the new segment.
+
+			segment = iblock->SegmentCount - 1;
+			instindex = -1;
+			pc = nextpc - 4;
+			previnst = 0;
+
+			goto next;
+		}
+
+no_trace:
+#endif
+
+		if (previnst && XrFuseInstructions(previnst, thisinst)) {
+			// The instruction was absorbed into the previous one, so reuse its
+			// slot. None of the fusible second halves have a virtual shift.
+
+			if (nextinst == 0) {
+				inst = previnst;
+
+				goto done_no_linkage;
+			}
+
+			nextinst = previnst + 1;
+			thisinst = 0;
+		}
+
 		if (nextinst == 0) {
 			goto done_no_linkage;
 		}
 
+		previnst = thisinst;
+
+#if !XR_SIMULATE_CACHES
+next:
+#endif
+
 		inst = nextinst;
 
 		if (inst >= &iblock->Insts[XR_IBLOCK_INSTS]) {
@@ -3073,9 +5817,83 @@ static XrIblock *XrDecodeInstructions(XrProcessor *proc, XrIblock *hazard) {
 	// make sure there's room for this.
 
 	inst->Func = &XrSpecialLinkageInstruction;
+	inst->PcOffset = XR_PC_OFFSET(segment, iblock->Cycles);
 
 done_no_linkage:
 
+	iblock->InstCount = inst - &iblock->Insts[0] + 1;
+
+	// TB miss handlers use the zero register as scratch, which the dataflow
+	// pass doesn't account for, and they're short anyway.
+
+	if ((proc->Cr[RS] & RS_TBMISS) == 0) {
+		XrOptimizeIblock(proc, iblock);
+	}
+
+#ifdef FASTMEMORY
+	XrAssignDtbSlots(iblock);
+#endif
+
+	// A trace that spans more than one page can't be validated by translating
+	// its PC alone, so it's never shared.
+
+	if (cold->PageCount > 1) {
+		cold->Key = asid;
+	}
+
+#ifdef FASTMEMORY
+	// For the same reason, only code from a single page goes in the shared
+	// store. If the Iblock ends in an extendable branch, pc is still its
+	// address.
+
+	if (XrSharedCodeStore && cold->PageCount == 1 &&
+		XrPublishSharedCode(proc, iblock, codekey, epoch, pc)) {
+
+		goto insert;
+	}
+#endif
+
+	// Move the instructions to a private chunk of the right size. This is done
+	// before the Iblock is put on the LRU list, or it could be reclaimed to
+	// make room for its own instructions.
+
+	int class = XR_CODE_CLASS_NONE;
+
+	XrCachedInst *chunk = XrAllocateCode(proc, hazard, iblock->InstCount, &class);
+
+	if (XrUnlikely(!chunk)) {
+		// Reclaiming should always free a chunk that's big enough, but if it
+		// didn't, throw the Iblock away rather than leave it running from the
+		// decode buffer. It has to be put where XrFreeIblock expects it first.
+
+		InsertAtHeadList(&proc->IblockLruList, &cold->LruEntry);
+
+		XrInsertIblockInTable(proc, iblock);
+
+		XrFreeIblock(proc, iblock);
+
+		return 0;
+	}
+
+	memcpy(chunk, iblock->Insts, iblock->InstCount * sizeof(XrCachedInst));
+
+	iblock->Insts = chunk;
+	cold->CodeClass = class;
+
+#ifdef FASTMEMORY
+insert:
+#endif
+
+	InsertAtHeadList(&proc->IblockLruList, &cold->LruEntry);
+
+	XrInsertIblockInTable(proc, iblock);
+
+	XrIblockTableEntry *jump = &proc->JumpCache[XR_JUMP_CACHE_INDEX(cold->Pc)];
+
+	jump->Pc = cold->Pc;
+	jump->Key = asid;
+	jump->Iblock = iblock;
+
 	return iblock;
 }
 
@@ -3084,6 +5902,15 @@ int XrExecuteFast(XrProcessor *proc, uint32_t cycles, uint32_t dt) {
 		return cycles;
 	}
 
+#ifdef XR_JIT
+	if (XrUnlikely(proc->JitFlushPending)) {
+		// The native code arena filled up, so throw it out along with all of
+		// the Iblocks.
+
+		XrJitFlush(proc);
+	}
+#endif
+
 #ifdef PROFCPU
 	if (XrPrintCache) {
 		proc->TimeToNextPrint -= dt;
@@ -3094,8 +5921,15 @@ int XrExecuteFast(XrProcessor *proc, uint32_t cycles, uint32_t dt) {
 			int itotal = proc->IcHitCount + proc->IcMissCount;
 			int dtotal = proc->DcHitCount + proc->DcMissCount;
 
-			fDBGPRINT(stderr, "%d: icache misses: %d (%.2f%% miss rate)\n", proc->Id, proc->IcMissCount, (double)proc->IcMissCount/(double)itotal*100.0);
-			fDBGPRINT(stderr, "%d: dcache misses: %d (%.2f%% miss rate)\n", proc->Id, proc->DcMissCount, (double)proc->DcMissCount/(double)dtotal*100.0);
+			fprintf(stderr, "%d: icache misses: %d (%.2f%% miss rate)\n", proc->Id, proc->IcMissCount, (double)proc->IcMissCount/(double)itotal*100.0);
+			fprintf(stderr, "%d: dcache misses: %d (%.2f%% miss rate)\n", proc->Id, proc->DcMissCount, (double)proc->DcMissCount/(double)dtotal*100.0);
+			fprintf(stderr, "%d: fused sub+branch: %d, lui+ori/addi: %d, lui+load/store: %d\n", proc->Id, proc->FusedBranchCount, proc->FusedConstantCount, proc->FusedAbsoluteCount);
+			fprintf(stderr, "%d: trace guards: %d, side exits: %d\n", proc->Id, proc->TraceGuardCount, proc->TraceExitCount);
+			fprintf(stderr, "%d: slots folded: %d, slots removed: %d, direct load/store: %d\n", proc->Id, proc->OptimizedFoldCount, proc->OptimizedDeadCount, proc->DirectAccessCount);
+			fprintf(stderr, "%d: spin loops skipped: %d\n", proc->Id, proc->SpinSkipCount);
+			fprintf(stderr, "%d: dtb lookup cache misses: %d (%.2f%% miss rate)\n", proc->Id, proc->DtbCacheMissCount, (double)proc->DtbCacheMissCount/(double)(proc->DtbCacheHitCount + proc->DtbCacheMissCount)*100.0);
+			fprintf(stderr, "%d: soft tlb hits: %d, misses: %d\n", proc->Id, proc->SoftTlbHitCount, proc->SoftTlbMissCount);
+			fprintf(stderr, "%d: quantum: %d cycles\n", proc->Id, proc->QuantumCycles);
 
 			proc->IcMissCount = 0;
 			proc->IcHitCount = 0;
@@ -3103,6 +5937,22 @@ int XrExecuteFast(XrProcessor *proc, uint32_t cycles, uint32_t dt) {
 			proc->DcMissCount = 0;
 			proc->DcHitCount = 0;
 
+			proc->FusedBranchCount = 0;
+			proc->FusedConstantCount = 0;
+			proc->FusedAbsoluteCount = 0;
+
+			proc->TraceGuardCount = 0;
+			proc->TraceExitCount = 0;
+
+			proc->OptimizedFoldCount = 0;
+			proc->OptimizedDeadCount = 0;
+			proc->DirectAccessCount = 0;
+			proc->SpinSkipCount = 0;
+			proc->DtbCacheHitCount = 0;
+			proc->DtbCacheMissCount = 0;
+			proc->SoftTlbHitCount = 0;
+			proc->SoftTlbMissCount = 0;
+
 			proc->TimeToNextPrint = 2000;
 
 			/*
@@ -3160,6 +6010,7 @@ int XrExecuteFast(XrProcessor *proc, uint32_t cycles, uint32_t dt) {
 	}
 
 	proc->PauseCalls = 0;
+	proc->SpinCount = 0;
 	proc->NoMore = 0;
 
 	while (!proc->NoMore) {
@@ -3180,8 +6031,16 @@ void XrProcessorSchedule(XrSchedulable *schedulable) {
 
 	int timeslice = schedulable->Timeslice;
 
+	if (schedulable->Gang && timeslice > 0 && !proc->Halted) {
+		XrJoinGang(schedulable);
+	}
+
 	XrLockMutex(&proc->RunLock);
 
+	uint64_t starttime = XrHostTimeNs();
+
+	proc->Stats.MsExecuted += timeslice;
+
 	while (timeslice > 0) {
 		if (RTCIntervalMS && proc->TimerInterruptCounter >= RTCIntervalMS) {
 			// Interval timer ran down, send self the interrupt.
@@ -3197,14 +6056,44 @@ void XrProcessorSchedule(XrSchedulable *schedulable) {
 			// The zeroth thread also does the RTC intervals, once per
 			// millisecond of CPU time. 
 
-			RTCUpdateRealTime();
+			if (XrTurbo) {
+				RTCUpdateVirtualTime(timeslice);
+			} else {
+				RTCUpdateRealTime();
+			}
+		}
+
+		uint32_t quantum = proc->QuantumCycles;
+
+		if (proc->Halted || schedulable->GangMember) {
+			// A halted processor only checks for interrupts, and a gang
+			// runs in lockstep rounds of a millisecond.
+
+			quantum = cyclesperms;
+		}
+
+		// Don't run past the end of the timeslice, or past the point where
+		// the interval timer fires.
+
+		uint32_t limit = timeslice * cyclesperms - proc->CyclesThisRound;
+
+		if (quantum > limit) {
+			quantum = limit;
+		}
+
+		if (RTCIntervalMS) {
+			limit = (RTCIntervalMS - proc->TimerInterruptCounter) * cyclesperms - proc->CyclesThisRound;
+
+			if (quantum > limit) {
+				quantum = limit;
+			}
 		}
 
-		int realcycles = XrExecuteFast(proc, cyclesperms, 1);
+		int realcycles = XrExecuteFast(proc, quantum, (quantum + cyclesperms - 1) / cyclesperms);
 
 		proc->CyclesThisRound += realcycles;
 
-		if (proc->CyclesThisRound >= cyclesperms) {
+		while (proc->CyclesThisRound >= cyclesperms) {
 			// A millisecond worth of cycles has been executed, so
 			// decrement the timeslice and advance the timer interrupt
 			// counter.
@@ -3214,6 +6103,35 @@ void XrProcessorSchedule(XrSchedulable *schedulable) {
 			proc->TimerInterruptCounter += 1;
 		}
 
+		if (proc->PauseCalls >= XR_PAUSE_MAX) {
+			// Spinning on a pause loop means waiting on another processor.
+
+			proc->QuantumEvents++;
+		}
+
+		int disturbed = proc->QuantumEvents != 0;
+
+		if (!proc->Halted && !schedulable->GangMember) {
+			// Adapt the quantum. If this processor was disturbed by another
+			// one, with an IPI, a failed SC or a pause loop, it's likely
+			// interacting with it closely, so shorten the quantum to let
+			// them take turns more often. If it ran a whole quantum
+			// undisturbed, lengthen it, to spend less time on the checks
+			// between quanta.
+
+			if (disturbed) {
+				if (proc->QuantumCycles > (cyclesperms >> XR_QUANTUM_MIN_SHIFT)) {
+					proc->QuantumCycles >>= 1;
+				}
+			} else if (realcycles >= proc->QuantumCycles &&
+				proc->QuantumCycles < cyclesperms * XR_QUANTUM_MAX_MS) {
+
+				proc->QuantumCycles <<= 1;
+			}
+		}
+
+		proc->QuantumEvents = 0;
+
 		if (proc->PauseCalls >= XR_PAUSE_MAX || proc->Halted || proc->Progress <= 0) {
 			// Halted or paused. Advance to next CPU.
 
@@ -3221,13 +6139,57 @@ void XrProcessorSchedule(XrSchedulable *schedulable) {
 
 			break;
 		}
+
+		if (schedulable->GangMember) {
+			// Only run one quantum per round.
+
+			break;
+		}
+
+		if (disturbed && proc->QuantumCycles < cyclesperms && XrOtherWorkWaiting(schedulable)) {
+			// Give the other processors waiting for this thread a chance to
+			// run before the next quantum.
+
+			break;
+		}
 	}
 
 	schedulable->Timeslice = timeslice;
 
+	proc->Stats.MsExecuted -= timeslice;
+	proc->Stats.HostNs += XrHostTimeNs() - starttime;
+
 	XrUnlockMutex(&proc->RunLock);
 
-	if (timeslice == 0) {
+	if (schedulable->GangMember) {
+		if (timeslice > 0 && !proc->Halted) {
+			// Wait for the rest of the gang to finish this round.
+
+			XrArriveGang(schedulable);
+
+			return;
+		}
+
+		XrLeaveGang(schedulable);
+	}
+
+	if (proc->Halted && (timeslice == 0 || !RTCIntervalMS ||
+		proc->TimerInterruptCounter + timeslice < RTCIntervalMS)) {
+
+		// The processor is waiting for an interrupt, and its interval timer
+		// won't fire within the rest of the timeslice. Rather than running
+		// down the timeslice, park it until the next frame, when the rest of
+		// the timeslice is charged as halted time. An interrupt sent to it in
+		// the meantime will unpark it to run the rest right away. If there's
+		// none left, it's parked anyway so that virtual time can tell it's
+		// idle.
+
+		XrScheduleWorkParked(schedulable);
+
+		if (timeslice && LsicTable[proc->Id].InterruptPending && (proc->Cr[RS] & RS_INT)) {
+			XrUnparkWork(schedulable);
+		}
+	} else if (timeslice == 0) {
 		XrScheduleWorkForNextFrame(schedulable, 0);
 	} else if (proc->Halted) {
 		XrScheduleWorkForMe(schedulable, schedulable);
@@ -3243,7 +6205,17 @@ void XrProcessorStartTimeslice(XrSchedulable *schedulable, int dt) {
 	proc->PauseCalls = 0;
 	proc->CyclesThisRound = 0;
 
+	if (proc->Halted && schedulable->Timeslice > 0) {
+		// The processor was parked for the rest of its last timeslice, so
+		// charge that time to its interval timer.
+
+		proc->TimerInterruptCounter += schedulable->Timeslice;
+		proc->Stats.MsParked += schedulable->Timeslice;
+		schedulable->Timeslice = 0;
+	}
+
 	schedulable->Timeslice += dt;
+	proc->Stats.MsRequested += dt;
 
 	if (schedulable->Timeslice >= XR_STEP_MS * 50) {
 		// The CPU has too much pending time. The threads are running
@@ -3251,10 +6223,140 @@ void XrProcessorStartTimeslice(XrSchedulable *schedulable, int dt) {
 		// the timeslice to avoid the threads running infinitely and
 		// burning someone's lap.
 
+		proc->Stats.MsDropped += schedulable->Timeslice - XR_STEP_MS;
 		schedulable->Timeslice = XR_STEP_MS;
 	}
 }
 
+void XrPrintProcessorStats(void) {
+	// Print where each processor's simulated time went since the last time,
+	// and how much host time it took to execute. Time is missed when a
+	// processor is still running when the next frame starts, and dropped
+	// when it falls too far behind; either way, the host isn't keeping up
+	// with -cpuhz. The time that was requested but neither executed, parked
+	// nor dropped is still pending.
+
+	static XrProcessorStats Printed[XR_PROC_MAX];
+	static uint64_t PrintedElapsed;
+
+	uint64_t elapsed = atomic_load_explicit(&XrSchedulerElapsedMs, memory_order_relaxed);
+
+	fprintf(stderr, "ms elapsed: %llu\n", (unsigned long long)(elapsed - PrintedElapsed));
+
+	for (int id = 0; id < XR_PROC_MAX; id++) {
+		XrProcessor *proc = XrProcessorTable[id];
+
+		if (!proc) {
+			continue;
+		}
+
+		XrProcessorStats *last = &Printed[id];
+
+		uint64_t requested = proc->Stats.MsRequested;
+		uint64_t executed = proc->Stats.MsExecuted;
+		uint64_t parked = proc->Stats.MsParked;
+		uint64_t dropped = proc->Stats.MsDropped;
+		uint64_t hostns = proc->Stats.HostNs;
+
+		fprintf(stderr, "%d: ms missed: %lld, requested: %llu, executed: %llu, parked in HLT: %llu, dropped: %llu\n", id,
+			(long long)((elapsed - PrintedElapsed) - (requested - last->MsRequested)),
+			(unsigned long long)(requested - last->MsRequested),
+			(unsigned long long)(executed - last->MsExecuted),
+			(unsigned long long)(parked - last->MsParked),
+			(unsigned long long)(dropped - last->MsDropped));
+
+		if (executed != last->MsExecuted) {
+			fprintf(stderr, "%d: host ns per ms: %llu, quantum: %d cycles\n", id,
+				(unsigned long long)((hostns - last->HostNs) / (executed - last->MsExecuted)),
+				proc->QuantumCycles);
+		}
+
+		last->MsRequested = requested;
+		last->MsExecuted = executed;
+		last->MsParked = parked;
+		last->MsDropped = dropped;
+		last->HostNs = hostns;
+	}
+
+	PrintedElapsed = elapsed;
+
+	XrPrintSchedulerStats();
+}
+
+void XrSkipIdleTime(void) {
+	// Called by the scheduler when nothing is running or waiting to run. If
+	// every processor is parked waiting for an interrupt, nothing can happen
+	// until an interval timer fires or a device finishes an operation, so
+	// start the next timeslice early, with exactly enough time to get there,
+	// rather than waiting for the frames to go by. In turbo mode, there are no
+	// frames, so the next timeslice is always started here.
+
+	int skip = XR_VIRTUAL_SKIP_MAX;
+	int event = 0;
+
+	for (int id = 0; id < XR_PROC_MAX; id++) {
+		XrProcessor *proc = XrProcessorTable[id];
+
+		if (!proc) {
+			continue;
+		}
+
+		if (!proc->Schedulable.Parked) {
+			if (!XrTurbo) {
+				return;
+			}
+
+			// The processor is waiting for the next timeslice.
+
+			if (skip > XR_TURBO_STEP_MS) {
+				skip = XR_TURBO_STEP_MS;
+			}
+
+			event = 1;
+
+			continue;
+		}
+
+		if (RTCIntervalMS) {
+			// The rest of the timeslice will be charged to the interval timer
+			// when the next one starts, so count it as already elapsed. The
+			// timer is only checked while there's timeslice left, so leave a
+			// millisecond to run after it fires.
+
+			int64_t remaining = (int64_t)RTCIntervalMS -
+				proc->TimerInterruptCounter - proc->Schedulable.Timeslice + 1;
+
+			if (remaining < 1) {
+				remaining = 1;
+			}
+
+			if (remaining < skip) {
+				skip = remaining;
+			}
+
+			event = 1;
+		}
+	}
+
+	if (XrNextFrameWorkPending()) {
+		// A device is in the middle of an operation. We don't know when it
+		// will complete, so only advance by a frame at a time, as in real
+		// time.
+
+		int step = XrTurbo ? XR_TURBO_STEP_MS : XR_STEP_MS;
+
+		if (skip > step) {
+			skip = step;
+		}
+
+		event = 1;
+	}
+
+	if (event) {
+		XrScheduleSkippedFrameWork(skip);
+	}
+}
+
 void XrInitializeProcessor(int id) {
 	XrProcessor *proc = malloc(sizeof(XrProcessor));
 
@@ -3265,61 +6367,150 @@ void XrInitializeProcessor(int id) {
 
 	XrInitializeSchedulable(&proc->Schedulable, &XrProcessorSchedule, &XrProcessorStartTimeslice, proc);
 
+	proc->Schedulable.Node = id / XR_PROC_PER_NODE_MAX;
+
+	if (XrGangScheduling == XR_GANG_SYSTEM) {
+		proc->Schedulable.Gang = &XrProcessorGangs[0];
+	} else if (XrGangScheduling == XR_GANG_NODE) {
+		proc->Schedulable.Gang = &XrProcessorGangs[proc->Schedulable.Node];
+	}
+
 	XrProcessorTable[id] = proc;
 	proc->Id = id;
 	proc->TimerInterruptCounter = 0;
 	proc->CyclesThisRound = 0;
+	proc->QuantumCycles = (XrProcessorFrequency+999)/1000;
+	proc->QuantumEvents = 0;
+	proc->Stats.MsRequested = 0;
+	proc->Stats.MsExecuted = 0;
+	proc->Stats.MsParked = 0;
+	proc->Stats.MsDropped = 0;
+	proc->Stats.HostNs = 0;
+
+#ifdef XR_JIT
+	XrJitInitialize(proc);
+#endif
 
 	proc->IblockFreeList = 0;
 	proc->PtableFreeList = 0;
 	proc->VpageFreeList = 0;
+	proc->PpageFreeList = 0;
 
 	InitializeList(&proc->IblockLruList);
 
-	for (int i = 0; i < XR_IBLOCK_HASH_BUCKETS; i++) {
-		InitializeList(&proc->IblockHashBuckets[i]);
+	// Size the lookup table to the next power of two that is at least twice
+	// the number of Iblocks.
+
+	uint32_t tablelog = 1;
+
+	while ((1u << tablelog) < XrIblockCount * 2) {
+		tablelog++;
+	}
+
+	proc->IblockTable = calloc(1u << tablelog, sizeof(XrIblockTableEntry));
+
+	if (!proc->IblockTable) {
+		fprintf(stderr, "failed to allocate iblock table for cpu %d\n", id);
+		exit(1);
+	}
+
+	proc->IblockTableMask = (1u << tablelog) - 1;
+	proc->IblockTableShift = 32 - tablelog;
+
+	for (int i = 0; i < XR_JUMP_CACHE_ENTRIES; i++) {
+		proc->JumpCache[i].Iblock = 0;
 	}
 
 	for (int i = 0; i < XR_VPN_BUCKETS; i++) {
 		InitializeList(&proc->VpageHashBuckets[i]);
 	}
 
-	XrIblock *iblocks = malloc(sizeof(XrIblock) * XR_IBLOCK_COUNT);
+	for (int i = 0; i < XR_PFN_BUCKETS; i++) {
+		InitializeList(&proc->PpageHashBuckets[i]);
+	}
+
+	XrIblock *iblocks = malloc(sizeof(XrIblock) * XrIblockCount);
 
 	if (!iblocks) {
 		fprintf(stderr, "failed to allocate iblocks for cpu %d\n", id);
 		exit(1);
 	}
 
-	for (int i = 0; i < XR_IBLOCK_COUNT; i++) {
-		iblocks->HashEntry.Next = (void *)proc->IblockFreeList;
+	XrIblockCold *cold = malloc(sizeof(XrIblockCold) * XrIblockCount);
+
+	if (!cold) {
+		fprintf(stderr, "failed to allocate iblock bookkeeping for cpu %d\n", id);
+		exit(1);
+	}
+
+	for (int i = 0; i < XrIblockCount; i++) {
+		iblocks->Cold = cold;
+		cold->Iblock = iblocks;
+
+		cold->NextFree = proc->IblockFreeList;
 		proc->IblockFreeList = iblocks;
 
 		iblocks++;
+		cold++;
+	}
+
+	// Carve out a slab of instruction chunks for each size class. Fewer are
+	// needed if the shared code store is in use, since most Iblocks won't
+	// need private instructions then.
+
+	uint32_t divisor = 16;
+
+#ifdef FASTMEMORY
+	if (XrSharedCodeStore) {
+		divisor *= XR_PRIVATE_CODE_DIVISOR;
+	}
+#endif
+
+	for (int class = 0; class < XR_CODE_CLASSES; class++) {
+		uint32_t count = XrIblockCount * XrCodeClassShare[class] / divisor;
+
+		if (count < 2) {
+			count = 2;
+		}
+
+		XrCachedInst *chunk = malloc(sizeof(XrCachedInst) * XrCodeClassSlots[class] * count);
+
+		if (!chunk) {
+			fprintf(stderr, "failed to allocate instruction slab for cpu %d\n", id);
+			exit(1);
+		}
+
+		proc->CodeFreeLists[class] = 0;
+
+		for (int i = 0; i < count; i++) {
+			XrFreeCode(proc, chunk, class);
+
+			chunk += XrCodeClassSlots[class];
+		}
 	}
 
-	XrJalrPredictionTable *ptable = malloc(sizeof(XrJalrPredictionTable) * XR_IBLOCK_COUNT);
+	XrJalrPredictionTable *ptable = malloc(sizeof(XrJalrPredictionTable) * XrIblockCount);
 
 	if (!ptable) {
 		fprintf(stderr, "failed to allocate ptables for cpu %d\n", id);
 		exit(1);
 	}
 
-	for (int i = 0; i < XR_IBLOCK_COUNT; i++) {
+	for (int i = 0; i < XrIblockCount; i++) {
 		ptable->Iblocks[0] = (void *)proc->PtableFreeList;
 		proc->PtableFreeList = ptable;
 
 		ptable++;
 	}
 
-	XrVirtualPage *vpage = malloc(sizeof(XrVirtualPage) * XR_IBLOCK_COUNT);
+	XrVirtualPage *vpage = malloc(sizeof(XrVirtualPage) * XrIblockCount * XR_TRACE_PAGES);
 
 	if (!vpage) {
 		fprintf(stderr, "failed to allocate virtual page trackers for cpu %d\n", id);
 		exit(1);
 	}
 
-	for (int i = 0; i < XR_IBLOCK_COUNT; i++) {
+	for (int i = 0; i < XrIblockCount * XR_TRACE_PAGES; i++) {
 		vpage->VpnHashEntry.Next = (void *)proc->VpageFreeList;
 		proc->VpageFreeList = vpage;
 
@@ -3328,6 +6519,22 @@ void XrInitializeProcessor(int id) {
 		vpage++;
 	}
 
+	XrPhysicalPage *ppage = malloc(sizeof(XrPhysicalPage) * XrIblockCount * XR_TRACE_PAGES);
+
+	if (!ppage) {
+		fprintf(stderr, "failed to allocate physical page trackers for cpu %d\n", id);
+		exit(1);
+	}
+
+	for (int i = 0; i < XrIblockCount * XR_TRACE_PAGES; i++) {
+		ppage->PfnHashEntry.Next = (void *)proc->PpageFreeList;
+		proc->PpageFreeList = ppage;
+
+		InitializeList(&ppage->IblockPfnList);
+
+		ppage++;
+	}
+
 	XrReset(proc);
 
 #ifndef SINGLE_THREAD_MP
@@ -3349,6 +6556,10 @@ void XrInitializeProcessor(int id) {
 #endif
 		proc->L1ClaimTable[i].OtherEntry = 0;
 	}
+
+	for (int i = 0; i < XR_BRANCH_BIAS_ENTRIES; i++) {
+		proc->BranchBias[i].Pc = 0xFFFFFFFF;
+	}
 #endif
 
 	XrScheduleWorkForNextFrame(&proc->Schedulable, 0);
@@ -3367,6 +6578,54 @@ void XrInitializeProcessors(void) {
 	}
 #endif
 
+	for (int i = 0; i < XR_NODE_MAX; i++) {
+		XrInitializeGang(&XrProcessorGangs[i]);
+	}
+
+	XrInitializeFlowForms();
+
+#ifdef FASTMEMORY
+	if (XrSharedCodeStore) {
+		// Size the store's table to the next power of two that is at least
+		// twice the number of entries, like the per-processor lookup tables.
+
+		uint32_t codecount = XrIblockCount * XR_SHARED_CODE_FACTOR;
+		uint32_t tablelog = 1;
+
+		while ((1u << tablelog) < codecount * 2) {
+			tablelog++;
+		}
+
+		XrSharedCodeTable = calloc(1u << tablelog, sizeof(XrSharedCodeEntry));
+
+		if (!XrSharedCodeTable) {
+			fprintf(stderr, "failed to allocate shared code table\n");
+			exit(1);
+		}
+
+		XrSharedCodeTableMask = (1u << tablelog) - 1;
+		XrSharedCodeTableShift = 32 - tablelog;
+		XrSharedCodeSweepIndex = 0;
+		XrSharedCodeEpoch = 0;
+		XrSharedCodeFreeList = 0;
+
+		XrSharedCode *code = malloc(sizeof(XrSharedCode) * codecount);
+
+		if (!code) {
+			fprintf(stderr, "failed to allocate shared code\n");
+			exit(1);
+		}
+
+		for (int i = 0; i < codecount; i++) {
+			XrFreeSharedCode(code);
+
+			code++;
+		}
+
+		XrInitializeMutex(&XrSharedCodeLock);
+	}
+#endif
+
 	for (int nodeid = 0; nodeid < XR_NODE_MAX; nodeid++) {
 		for (int i = 0; i < XrNumaNodes[nodeid].ProcessorCount; i++) {
 			XrInitializeProcessor(nodeid * XR_PROC_PER_NODE_MAX + i);
@@ -1,5 +1,3 @@
-uint8_t XrPrintCache = 0;
-
 uint32_t XrScacheTags[XR_SC_LINE_COUNT];
 uint32_t XrScacheReplacementIndex;
 uint8_t XrScacheFlags[XR_SC_LINE_COUNT];
@@ -25,16 +23,12 @@ static inline uint8_t XrLookupItb(XrProcessor *proc, uint32_t virtual, uint64_t
 	uint32_t vpn = virtual >> 12;
 	uint32_t matching = (proc->Cr[ITBTAG] & 0xFFF00000) | vpn;
 
-	for (int i = 0; i < XR_ITB_SIZE; i++) {
-		uint64_t tmp = proc->Itb[i];
-
-		uint32_t mask = (tmp & PTE_GLOBAL) ? 0xFFFFF : 0xFFFFFFFF;
+	int i = XrSearchTb(&proc->Itb[0], XR_ITB_SIZE, matching);
 
-		if (((tmp >> 32) & mask) == (matching & mask)) {
-			*tbe = tmp;
+	if (XrLikely(i >= 0)) {
+		*tbe = proc->Itb[i];
 
-			return 1;
-		}
+		return 1;
 	}
 
 	// ITB miss!
@@ -59,16 +53,12 @@ static inline uint8_t XrLookupDtb(XrProcessor *proc, uint32_t virtual, uint64_t
 	uint32_t vpn = virtual >> 12;
 	uint32_t matching = (proc->Cr[DTBTAG] & 0xFFF00000) | vpn;
 
-	for (int i = 0; i < XR_DTB_SIZE; i++) {
-		uint64_t tmp = proc->Dtb[i];
+	int i = XrSearchTb(&proc->Dtb[0], XR_DTB_SIZE, matching);
 
-		uint32_t mask = (tmp & PTE_GLOBAL) ? 0xFFFFF : 0xFFFFFFFF;
+	if (XrLikely(i >= 0)) {
+		*tbe = proc->Dtb[i];
 
-		if (((tmp >> 32) & mask) == (matching & mask)) {
-			*tbe = tmp;
-
-			return 1;
-		}
+		return 1;
 	}
 
 	// DTB miss!
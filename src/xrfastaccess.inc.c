@@ -145,16 +145,12 @@ static XR_ALWAYS_INLINE int XrLookupItb(XrProcessor *proc, uint32_t virtual, uin
 	uint32_t vpn = virtual >> 12;
 	uint32_t matching = (proc->Cr[ITBTAG] & 0xFFF00000) | vpn;
 
-	for (int i = 0; i < XR_ITB_SIZE; i++) {
-		uint64_t tmp = proc->Itb[i];
+	int i = XrSearchTb(&proc->Itb[0], XR_ITB_SIZE, matching);
 
-		uint32_t mask = (tmp & PTE_GLOBAL) ? 0xFFFFF : 0xFFFFFFFF;
+	if (XrLikely(i >= 0)) {
+		*tbe = proc->Itb[i];
 
-		if (((tmp >> 32) & mask) == (matching & mask)) {
-			*tbe = tmp;
-
-			return 1;
-		}
+		return 1;
 	}
 
 	// ITB miss!
@@ -179,16 +175,12 @@ static XR_ALWAYS_INLINE uint64_t *XrLookupDtb(XrProcessor *proc, uint32_t virtua
 	uint32_t vpn = virtual >> 12;
 	uint32_t matching = (proc->Cr[DTBTAG] & 0xFFF00000) | vpn;
 
-	for (int i = 0; i < XR_DTB_SIZE; i++) {
-		uint64_t tmp = proc->Dtb[i];
+	int i = XrSearchTb(&proc->Dtb[0], XR_DTB_SIZE, matching);
 
-		uint32_t mask = (tmp & PTE_GLOBAL) ? 0xFFFFF : 0xFFFFFFFF;
+	if (XrLikely(i >= 0)) {
+		*tbe = proc->Dtb[i];
 
-		if (((tmp >> 32) & mask) == (matching & mask)) {
-			*tbe = tmp;
-
-			return &proc->Dtb[i];
-		}
+		return &proc->Dtb[i];
 	}
 
 	// DTB miss!
@@ -271,9 +263,60 @@ static XR_ALWAYS_INLINE int XrTranslateIstream(XrProcessor *proc, uint32_t virtu
 	return 1;
 }
 
+static int XrProbeIstream(XrProcessor *proc, uint32_t virtual, uint32_t *phys, int *flags) {
+	// Like XrTranslateIstream, but has no side effects. This is used when
+	// extending an Iblock into a trace, where a failed translation should just
+	// stop the trace rather than causing an exception.
+
+	uint32_t vpn = virtual >> 12;
+	uint32_t matching = (proc->Cr[ITBTAG] & 0xFFF00000) | vpn;
+
+	int i = XrSearchTb(&proc->Itb[0], XR_ITB_SIZE, matching);
+
+	if (i < 0) {
+		return 0;
+	}
+
+	uint64_t tbe = proc->Itb[i];
+
+	if ((tbe & PTE_VALID) == 0) {
+		return 0;
+	}
+
+	if ((tbe & PTE_KERNEL) && (proc->Cr[RS] & RS_USER)) {
+		return 0;
+	}
+
+	*flags = tbe & 31;
+	*phys = ((tbe & 0x1FFFFE0) << 7) + (virtual & 0xFFF);
+
+	return 1;
+}
+
 static int XrTranslateDstream(XrProcessor *proc, uint32_t virtual, XrIblockDtbEntry *entry, int writing) {
 	uint32_t vpn = virtual >> 12;
 
+	// Check the soft TLB first. The tag includes everything that the checks
+	// below depend on, so a hit can be used as is.
+
+	uint64_t tag = ((uint64_t)(proc->Cr[RS] & RS_USER) << 32) | (proc->Cr[DTBTAG] & 0xFFF00000) | vpn;
+
+	XrSoftTlbEntry *softtlb = &proc->SoftTlb[XR_SOFT_TLB_INDEX(vpn)];
+
+	if (XrLikely((writing ? softtlb->WriteTag : softtlb->ReadTag) == tag)) {
+#ifdef PROFCPU
+		proc->SoftTlbHitCount++;
+#endif
+
+		*entry = softtlb->Entry;
+
+		return 1;
+	}
+
+#ifdef PROFCPU
+	proc->SoftTlbMissCount++;
+#endif
+
 	uint64_t tbe;
 	uint64_t *tbeptr;
 
@@ -329,6 +372,10 @@ static int XrTranslateDstream(XrProcessor *proc, uint32_t virtual, XrIblockDtbEn
 
 	}
 
+	softtlb->ReadTag = tag;
+	softtlb->WriteTag = (tbe & PTE_WRITABLE) ? tag : XR_SOFT_TLB_INVALID;
+	softtlb->Entry = *entry;
+
 	//DBGPRINT("virt=%x phys=%x\n", virt, *phys);
 
 	return 1;
@@ -356,7 +403,62 @@ static XR_ALWAYS_INLINE int XrDirectEBusRead(XrProcessor *proc, uint32_t address
 	return status;
 }
 
-static XR_ALWAYS_INLINE int XrAccessWrite(XrProcessor *proc, XrIblock *iblock, uint32_t address, uint32_t srcvalue, uint32_t length, int sc) {
+static XR_ALWAYS_INLINE int XrDtbCacheValid(XrIblockDtbEntry *entry, uint32_t matching, int writing) {
+	return ((entry->MatchingDtbe >> 32) == matching) &&
+		(entry->DtbePointer[0] == entry->MatchingDtbe) &&
+		(!writing || (entry->MatchingDtbe & PTE_WRITABLE));
+}
+
+static XR_ALWAYS_INLINE XrIblockDtbEntry *XrLookupDtbCache(XrProcessor *proc, XrIblock *iblock, uint32_t slot, uint32_t address, int writing) {
+	// Find a valid DTB lookup cache entry for the access. If the instruction
+	// has an entry of its own, that's checked first, and then the Iblock-wide
+	// entry for the page, so that neighbouring accesses to the same page
+	// still only translate it once. A translation is stored in both. Returns
+	// 0 if an exception was caused.
+
+	uint32_t matching = (proc->Cr[DTBTAG] & 0xFFF00000) | (address >> 12);
+
+	XrIblockDtbEntry *own = 0;
+
+	if (XrLikely(slot < XR_IBLOCK_INST_DTB_SLOTS)) {
+		own = &iblock->InstDtbCache[slot];
+
+		if (XrLikely(XrDtbCacheValid(own, matching, writing))) {
+#ifdef PROFCPU
+			proc->DtbCacheHitCount++;
+#endif
+
+			return own;
+		}
+	}
+
+	int index = XR_IBLOCK_DTB_CACHE_INDEX(address);
+	XrIblockDtbEntry *entry = writing ? &iblock->DtbStoreCache[index] : &iblock->DtbLoadCache[index];
+
+	if (XrLikely(XrDtbCacheValid(entry, matching, writing))) {
+#ifdef PROFCPU
+		proc->DtbCacheHitCount++;
+#endif
+
+		return entry;
+	}
+
+#ifdef PROFCPU
+	proc->DtbCacheMissCount++;
+#endif
+
+	if (!XrTranslateDstream(proc, address, entry, writing)) {
+		return 0;
+	}
+
+	if (own) {
+		*own = *entry;
+	}
+
+	return entry;
+}
+
+static XR_ALWAYS_INLINE int XrAccessWrite(XrProcessor *proc, XrIblock *iblock, uint32_t slot, uint32_t address, uint32_t srcvalue, uint32_t length, int sc) {
 	if (XrUnlikely((address & (length - 1)) != 0)) {
 		// Unaligned access.
 
@@ -367,19 +469,10 @@ static XR_ALWAYS_INLINE int XrAccessWrite(XrProcessor *proc, XrIblock *iblock, u
 	}
 
 	if (XrLikely((proc->Cr[RS] & RS_MMU) != 0)) {
-		// Look up the DTB lookup cache in the Iblock.
-
-		uint32_t matching = (proc->Cr[DTBTAG] & 0xFFF00000) | (address >> 12);
+		XrIblockDtbEntry *entry = XrLookupDtbCache(proc, iblock, slot, address, 1);
 
-		XrIblockDtbEntry *entry = &iblock->DtbStoreCache[XR_IBLOCK_DTB_CACHE_INDEX(address)];
-
-		if (XrUnlikely(((entry->MatchingDtbe >> 32) != matching) ||
-			(entry->DtbePointer[0] != entry->MatchingDtbe) ||
-			!(entry->MatchingDtbe & PTE_WRITABLE))) {
-
-			if (!XrTranslateDstream(proc, address, entry, 1)) {
-				return 0;
-			}
+		if (XrUnlikely(!entry)) {
+			return 0;
 		}
 
 		if (XrLikely(entry->HostPointer != 0)) {
@@ -413,7 +506,7 @@ static XR_ALWAYS_INLINE int XrAccessWrite(XrProcessor *proc, XrIblock *iblock, u
 	return status;
 }
 
-static XR_ALWAYS_INLINE int XrAccessRead(XrProcessor *proc, XrIblock *iblock, uint32_t address, uint32_t *dest, uint32_t length, int ll) {
+static XR_ALWAYS_INLINE int XrAccessRead(XrProcessor *proc, XrIblock *iblock, uint32_t slot, uint32_t address, uint32_t *dest, uint32_t length, int ll) {
 	if (XrUnlikely((address & (length - 1)) != 0)) {
 		// Unaligned access.
 
@@ -424,19 +517,10 @@ static XR_ALWAYS_INLINE int XrAccessRead(XrProcessor *proc, XrIblock *iblock, ui
 	}
 
 	if (XrLikely((proc->Cr[RS] & RS_MMU) != 0)) {
-		// Look up the DTB lookup cache in the Iblock.
-
-		uint32_t matching = (proc->Cr[DTBTAG] & 0xFFF00000) | (address >> 12);
+		XrIblockDtbEntry *entry = XrLookupDtbCache(proc, iblock, slot, address, 0);
 
-		int index = XR_IBLOCK_DTB_CACHE_INDEX(address);
-		XrIblockDtbEntry *entry = &iblock->DtbLoadCache[index];
-
-		if (XrUnlikely(((entry->MatchingDtbe >> 32) != matching) ||
-			(entry->DtbePointer[0] != entry->MatchingDtbe))) {
-
-			if (!XrTranslateDstream(proc, address, entry, 0)) {
-				return 0;
-			}
+		if (XrUnlikely(!entry)) {
+			return 0;
 		}
 
 		if (XrLikely(entry->HostPointer != 0)) {
@@ -466,12 +550,12 @@ static XR_ALWAYS_INLINE int XrAccessRead(XrProcessor *proc, XrIblock *iblock, ui
 	return status;
 }
 
-#define XrReadByte(_proc, _address, _value) XrAccessRead(_proc, block, _address, _value, 1, 0)
-#define XrReadInt(_proc, _address, _value) XrAccessRead(_proc, block, _address, _value, 2, 0)
-#define XrReadLong(_proc, _address, _value) XrAccessRead(_proc, block, _address, _value, 4, 0)
-#define XrReadLongLl(_proc, _address, _value) XrAccessRead(_proc, block, _address, _value, 4, 1)
+#define XrReadByte(_proc, _address, _value) XrAccessRead(_proc, block, inst->Imm8_3, _address, _value, 1, 0)
+#define XrReadInt(_proc, _address, _value) XrAccessRead(_proc, block, inst->Imm8_3, _address, _value, 2, 0)
+#define XrReadLong(_proc, _address, _value) XrAccessRead(_proc, block, inst->Imm8_3, _address, _value, 4, 0)
+#define XrReadLongLl(_proc, _address, _value) XrAccessRead(_proc, block, XR_INST_DTB_NONE, _address, _value, 4, 1)
 
-#define XrWriteByte(_proc, _address, _value) XrAccessWrite(_proc, block, _address, _value, 1, 0)
-#define XrWriteInt(_proc, _address, _value) XrAccessWrite(_proc, block, _address, _value, 2, 0)
-#define XrWriteLong(_proc, _address, _value) XrAccessWrite(_proc, block, _address, _value, 4, 0)
-#define XrWriteLongSc(_proc, _address, _value) XrAccessWrite(_proc, block, _address,  _value, 4, 1)
\ No newline at end of file
+#define XrWriteByte(_proc, _address, _value) XrAccessWrite(_proc, block, inst->Imm8_3, _address, _value, 1, 0)
+#define XrWriteInt(_proc, _address, _value) XrAccessWrite(_proc, block, inst->Imm8_3, _address, _value, 2, 0)
+#define XrWriteLong(_proc, _address, _value) XrAccessWrite(_proc, block, inst->Imm8_3, _address, _value, 4, 0)
+#define XrWriteLongSc(_proc, _address, _value) XrAccessWrite(_proc, block, XR_INST_DTB_NONE, _address,  _value, 4, 1)
\ No newline at end of file
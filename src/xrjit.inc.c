@@ -0,0 +1,1404 @@
+//
+// Native code tier for the cached interpreter core.
+//
+// Once an Iblock has been dispatched XR_JIT_THRESHOLD times, it's translated
+// into a single x86-64 function, from its first translatable instruction to
+// its terminator. The guest registers it uses most are held in host registers
+// for the whole Iblock, loaded once on entry and written back once on exit.
+// Loads and stores call into the same access routines the interpreter uses,
+// with the program counter they'd have synced, and the terminating branch or
+// jump is evaluated natively.
+//
+// The native function returns an exit code telling XrExecuteNative how it
+// left: through one of the Iblock's CachedPaths, which is chained to exactly
+// as the terminator would have been (including decoding the target and
+// profiling the branch of an extendable Iblock), after an exception, or at an
+// instruction it couldn't translate, where the interpreter picks up.
+//
+
+// Host register numbers as encoded in ModRM and REX.
+
+#define XR_HOST_EAX 0
+#define XR_HOST_ECX 1
+#define XR_HOST_EDX 2
+#define XR_HOST_EBX 3
+#define XR_HOST_EBP 5
+#define XR_HOST_ESI 6
+#define XR_HOST_EDI 7
+#define XR_HOST_R8 8
+#define XR_HOST_R12 12
+#define XR_HOST_R13 13
+#define XR_HOST_R14 14
+#define XR_HOST_R15 15
+
+// An operand that's in proc->Reg instead of a host register.
+
+#define XR_JIT_MEMORY -1
+
+#define XR_JIT_REG_OFFSET(guest) (offsetof(XrProcessor, Reg) + (guest) * 4)
+
+// The processor pointer is kept in RBX. EAX, ECX, and the argument registers
+// are scratch within a single guest instruction. The callee-saved registers
+// are handed out to guest registers, so that they survive the calls to the
+// access routines.
+
+#define XR_JIT_HOST_REGS 5
+
+static const uint8_t XrJitHostRegs[XR_JIT_HOST_REGS] = {
+	XR_HOST_EBP,
+	XR_HOST_R12,
+	XR_HOST_R13,
+	XR_HOST_R14,
+	XR_HOST_R15,
+};
+
+// Worst case number of bytes emitted for a single guest instruction including
+// its exit stub, and for the prologue and epilogue.
+
+#define XR_JIT_MAX_INST_BYTES 128
+#define XR_JIT_MAX_FRAME_BYTES 128
+#define XR_JIT_MAX_BYTES (((XR_IBLOCK_INSTS + 2) * XR_JIT_MAX_INST_BYTES) + XR_JIT_MAX_FRAME_BYTES)
+
+// Iblocks with fewer translatable instructions than this in a row aren't
+// worth the call into native code.
+
+#define XR_JIT_MIN_RUN 2
+
+// Exit codes returned by the native code. The low half is the slot to resume
+// interpreting at, the number of cycles to charge for an exception, or the
+// index of the CachedPaths entry to chain through.
+
+#define XR_JIT_EXIT_SLOT 0x00000
+#define XR_JIT_EXIT_FAULT 0x10000
+#define XR_JIT_EXIT_JUMP 0x20000
+#define XR_JIT_EXIT_BRANCH 0x30000
+
+#define XR_JIT_EXIT_KIND(exit) ((exit) & 0xFFFF0000)
+#define XR_JIT_EXIT_VALUE(exit) ((exit) & 0xFFFF)
+
+typedef uint32_t (*XrJitNativeF)(XrProcessor *proc);
+
+static uintptr_t XrJitPageSize;
+
+// Maximum number of forward jumps to the exit and to the stubs after it.
+
+#define XR_JIT_MAX_PATCHES ((XR_IBLOCK_INSTS + 2) * 2)
+
+typedef struct _XrJitEmitter {
+	uint8_t *Code;
+	uint32_t Length;
+
+	// Map from guest register to the host register holding it, or
+	// XR_JIT_MEMORY.
+
+	int8_t Host[XR_REG_MAX];
+
+	// Bitmap of guest registers that are written, and so must be stored back
+	// on exit if they're held in host registers.
+
+	uint64_t Written;
+
+	// Jumps to the common exit sequence.
+
+	uint32_t ExitJumps[XR_JIT_MAX_PATCHES];
+	int ExitJumpCount;
+
+	// Conditional jumps to out of line exit stubs, and the exit code each of
+	// the stubs returns.
+
+	uint32_t StubJumps[XR_JIT_MAX_PATCHES];
+	uint32_t StubExits[XR_JIT_MAX_PATCHES];
+	int StubCount;
+} XrJitEmitter;
+
+enum XrJitOps {
+	XR_JIT_NONE,
+
+	XR_JIT_REG,
+	XR_JIT_IMM,
+	XR_JIT_INC,
+	XR_JIT_SHIFT_REG,
+	XR_JIT_SHIFT_IMM,
+	XR_JIT_CONST,
+	XR_JIT_LOAD,
+	XR_JIT_STORE,
+	XR_JIT_GUARD,
+
+	// Everything from here on ends the Iblock.
+
+	XR_JIT_BRANCH,
+	XR_JIT_SUB_BRANCH,
+	XR_JIT_JUMP,
+	XR_JIT_JAL,
+	XR_JIT_LINKAGE,
+};
+
+// Addressing modes of the loads and stores.
+
+enum XrJitAddressModes {
+	XR_JIT_ADDR_REG,
+	XR_JIT_ADDR_IMM,
+	XR_JIT_ADDR_DIRECT,
+	XR_JIT_ADDR_ABSOLUTE,
+};
+
+typedef struct _XrJitInstDesc {
+	uint8_t Kind;
+
+	// The ALU or shift opcode, the XR_GUARD condition of a branch or guard, or
+	// the DTB slot of a load or store.
+
+	uint16_t Op;
+	uint8_t Rd;
+	uint8_t Ra;
+	uint8_t Rb;
+
+	// For loads and stores: the addressing mode, the access length, and
+	// whether the value stored is Value instead of RD.
+
+	uint8_t Mode;
+	uint8_t Length;
+	uint8_t ValueImm;
+
+	uint32_t Imm;
+	uint32_t Value;
+} XrJitInstDesc;
+
+// ALU opcodes for the "OP r32, r/m32" and "OP r/m32, imm32" forms. The low
+// byte is the register form opcode, the high byte is the /digit of the
+// immediate form.
+
+#define XR_JIT_ADD 0x0003
+#define XR_JIT_OR  0x010B
+#define XR_JIT_AND 0x0423
+#define XR_JIT_SUB 0x052B
+#define XR_JIT_XOR 0x0633
+#define XR_JIT_CMP 0x073B
+
+// Pseudo-opcodes that need a little more than one ALU instruction.
+
+#define XR_JIT_NOR  0x1000
+#define XR_JIT_MUL  0x1001
+#define XR_JIT_SLT  0x1002
+#define XR_JIT_SLTS 0x1003
+
+// Shift opcodes, which are the /digit of the D3 and C1 group.
+
+#define XR_JIT_ROR 1
+#define XR_JIT_SHL 4
+#define XR_JIT_SHR 5
+#define XR_JIT_SAR 7
+
+// The x86 condition code under which each XR_GUARD condition holds. EQ through
+// GE are tested by comparing the register against zero, and PE and PO by
+// testing its low bit.
+
+static const uint8_t XrJitConditionCodes[8] = {
+	[XR_GUARD_EQ] = 0x4,
+	[XR_GUARD_NE] = 0x5,
+	[XR_GUARD_LT] = 0xC,
+	[XR_GUARD_GT] = 0xF,
+	[XR_GUARD_LE] = 0xE,
+	[XR_GUARD_GE] = 0xD,
+	[XR_GUARD_PE] = 0x4,
+	[XR_GUARD_PO] = 0x5,
+};
+
+// The loads and stores, along with their addressing mode and access length.
+
+typedef struct _XrJitAccessForm {
+	XrInstImplF Func;
+	uint8_t Mode;
+	uint8_t Length;
+	uint8_t IsStore;
+	uint8_t ValueImm;
+} XrJitAccessForm;
+
+static XrJitAccessForm XrJitAccessForms[27] = {
+	{ &XrExecuteLoadLongRegOffset, XR_JIT_ADDR_REG, 4, 0, 0 },
+	{ &XrExecuteLoadIntRegOffset, XR_JIT_ADDR_REG, 2, 0, 0 },
+	{ &XrExecuteLoadByteRegOffset, XR_JIT_ADDR_REG, 1, 0, 0 },
+	{ &XrExecuteStoreLongRegOffset, XR_JIT_ADDR_REG, 4, 1, 0 },
+	{ &XrExecuteStoreIntRegOffset, XR_JIT_ADDR_REG, 2, 1, 0 },
+	{ &XrExecuteStoreByteRegOffset, XR_JIT_ADDR_REG, 1, 1, 0 },
+	{ &XrExecuteLoadLongImmOffset, XR_JIT_ADDR_IMM, 4, 0, 0 },
+	{ &XrExecuteLoadIntImmOffset, XR_JIT_ADDR_IMM, 2, 0, 0 },
+	{ &XrExecuteLoadByteImmOffset, XR_JIT_ADDR_IMM, 1, 0, 0 },
+	{ &XrExecuteStoreLongImmOffsetReg, XR_JIT_ADDR_IMM, 4, 1, 0 },
+	{ &XrExecuteStoreIntImmOffsetReg, XR_JIT_ADDR_IMM, 2, 1, 0 },
+	{ &XrExecuteStoreByteImmOffsetReg, XR_JIT_ADDR_IMM, 1, 1, 0 },
+	{ &XrExecuteStoreLongImmOffsetImm, XR_JIT_ADDR_IMM, 4, 1, 1 },
+	{ &XrExecuteStoreIntImmOffsetImm, XR_JIT_ADDR_IMM, 2, 1, 1 },
+	{ &XrExecuteStoreByteImmOffsetImm, XR_JIT_ADDR_IMM, 1, 1, 1 },
+	{ &XrExecuteLoadLongDirect, XR_JIT_ADDR_DIRECT, 4, 0, 0 },
+	{ &XrExecuteLoadIntDirect, XR_JIT_ADDR_DIRECT, 2, 0, 0 },
+	{ &XrExecuteLoadByteDirect, XR_JIT_ADDR_DIRECT, 1, 0, 0 },
+	{ &XrExecuteStoreLongDirect, XR_JIT_ADDR_DIRECT, 4, 1, 0 },
+	{ &XrExecuteStoreIntDirect, XR_JIT_ADDR_DIRECT, 2, 1, 0 },
+	{ &XrExecuteStoreByteDirect, XR_JIT_ADDR_DIRECT, 1, 1, 0 },
+	{ &XrExecuteLoadLongAbsolute, XR_JIT_ADDR_ABSOLUTE, 4, 0, 0 },
+	{ &XrExecuteLoadIntAbsolute, XR_JIT_ADDR_ABSOLUTE, 2, 0, 0 },
+	{ &XrExecuteLoadByteAbsolute, XR_JIT_ADDR_ABSOLUTE, 1, 0, 0 },
+	{ &XrExecuteStoreLongAbsolute, XR_JIT_ADDR_ABSOLUTE, 4, 1, 0 },
+	{ &XrExecuteStoreIntAbsolute, XR_JIT_ADDR_ABSOLUTE, 2, 1, 0 },
+	{ &XrExecuteStoreByteAbsolute, XR_JIT_ADDR_ABSOLUTE, 1, 1, 0 },
+};
+
+static int XrJitDescribeAccess(XrCachedInst *inst, XrJitInstDesc *desc) {
+	// Describe a load or store. Rd is the destination or the source of the
+	// value, and the address is Ra + Rb, Ra + Imm, or Imm, depending on the
+	// mode. The absolute forms first set Ra to the upper half loaded by their
+	// LUI, which is in Value.
+
+	XrJitAccessForm *form = 0;
+
+	for (int i = 0; i < 27; i++) {
+		if (inst->Func == XrJitAccessForms[i].Func) {
+			form = &XrJitAccessForms[i];
+			break;
+		}
+	}
+
+	if (!form) {
+		return 0;
+	}
+
+	desc->Kind = form->IsStore ? XR_JIT_STORE : XR_JIT_LOAD;
+	desc->Mode = form->Mode;
+	desc->Length = form->Length;
+	desc->ValueImm = form->ValueImm;
+	desc->Op = inst->Imm8_3;
+
+	switch (form->Mode) {
+		case XR_JIT_ADDR_REG:
+			desc->Rd = inst->Imm8_1;
+			desc->Ra = inst->Imm8_2;
+			desc->Rb = inst->Imm32_1;
+
+			break;
+
+		case XR_JIT_ADDR_IMM:
+			// The immediate offset forms of the stores have the base in
+			// Imm8_1 and the value in Imm8_2, and the loads the other way
+			// around.
+
+			if (form->IsStore) {
+				desc->Rd = inst->Imm8_2;
+				desc->Ra = inst->Imm8_1;
+				desc->Value = SignExt5(inst->Imm8_2);
+			} else {
+				desc->Rd = inst->Imm8_1;
+				desc->Ra = inst->Imm8_2;
+			}
+
+			desc->Imm = inst->Imm32_1;
+
+			break;
+
+		case XR_JIT_ADDR_DIRECT:
+			desc->Rd = inst->Imm8_1;
+			desc->Imm = inst->Imm32_1;
+
+			break;
+
+		case XR_JIT_ADDR_ABSOLUTE: {
+			int shift = form->Length == 4 ? 2 : form->Length - 1;
+
+			if (form->IsStore) {
+				desc->Rd = inst->Imm8_2;
+				desc->Ra = inst->Imm8_1;
+			} else {
+				desc->Rd = inst->Imm8_1;
+				desc->Ra = inst->Imm8_2;
+			}
+
+			desc->Imm = XR_ABSOLUTE_ADDRESS(inst->Imm32_1, shift);
+			desc->Value = XR_ABSOLUTE_UPPER(inst->Imm32_1);
+
+			break;
+		}
+	}
+
+	return 1;
+}
+
+static int XrJitDescribe(XrCachedInst *inst, XrJitInstDesc *desc) {
+	// Determine whether the cached instruction can be translated, and if so,
+	// describe it in a uniform way.
+
+	XrInstImplF func = inst->Func;
+
+	desc->Rd = inst->Imm8_1;
+	desc->Ra = inst->Imm8_2;
+	desc->Rb = inst->Imm32_1;
+	desc->Imm = inst->Imm32_1;
+
+	desc->Kind = XR_JIT_REG;
+
+	if (func == &XrExecuteAdd) {
+		desc->Op = XR_JIT_ADD;
+	} else if (func == &XrExecuteSub) {
+		desc->Op = XR_JIT_SUB;
+	} else if (func == &XrExecuteOr) {
+		desc->Op = XR_JIT_OR;
+	} else if (func == &XrExecuteAnd) {
+		desc->Op = XR_JIT_AND;
+	} else if (func == &XrExecuteXor) {
+		desc->Op = XR_JIT_XOR;
+	} else if (func == &XrExecuteNor) {
+		desc->Op = XR_JIT_NOR;
+	} else if (func == &XrExecuteMul) {
+		desc->Op = XR_JIT_MUL;
+	} else if (func == &XrExecuteSlt) {
+		desc->Op = XR_JIT_SLT;
+	} else if (func == &XrExecuteSltSigned) {
+		desc->Op = XR_JIT_SLTS;
+	} else {
+		goto notreg;
+	}
+
+	return 1;
+
+notreg:
+
+	desc->Kind = XR_JIT_IMM;
+
+	if (func == &XrExecuteAddi) {
+		desc->Op = XR_JIT_ADD;
+	} else if (func == &XrExecuteSubi) {
+		desc->Op = XR_JIT_SUB;
+	} else if (func == &XrExecuteOri) {
+		desc->Op = XR_JIT_OR;
+	} else if (func == &XrExecuteAndi) {
+		desc->Op = XR_JIT_AND;
+	} else if (func == &XrExecuteXori) {
+		desc->Op = XR_JIT_XOR;
+	} else if (func == &XrExecuteSlti) {
+		desc->Op = XR_JIT_SLT;
+	} else if (func == &XrExecuteSltiSigned) {
+		desc->Op = XR_JIT_SLTS;
+	} else if (func == &XrExecuteMove) {
+		desc->Op = XR_JIT_ADD;
+		desc->Imm = 0;
+	} else if (func == &XrExecuteAddiInPlace) {
+		desc->Kind = XR_JIT_INC;
+	} else {
+		goto notimm;
+	}
+
+	return 1;
+
+notimm:
+
+	// The register shifts take the amount from RA and the value from RB.
+
+	desc->Kind = XR_JIT_SHIFT_REG;
+
+	if (func == &XrExecuteLsh) {
+		desc->Op = XR_JIT_SHL;
+	} else if (func == &XrExecuteRsh) {
+		desc->Op = XR_JIT_SHR;
+	} else if (func == &XrExecuteAsh) {
+		desc->Op = XR_JIT_SAR;
+	} else if (func == &XrExecuteRor) {
+		desc->Op = XR_JIT_ROR;
+	} else {
+		goto notshiftreg;
+	}
+
+	return 1;
+
+notshiftreg:
+
+	// The virtual inline shifts write the fake shift sink register.
+
+	desc->Kind = XR_JIT_SHIFT_IMM;
+	desc->Rd = XR_FAKE_SHIFT_SINK;
+	desc->Ra = inst->Imm8_1;
+	desc->Imm = inst->Imm8_2;
+
+	if (func == &XrExecuteVirtualLsh) {
+		desc->Op = XR_JIT_SHL;
+	} else if (func == &XrExecuteVirtualRsh) {
+		desc->Op = XR_JIT_SHR;
+	} else if (func == &XrExecuteVirtualAsh) {
+		desc->Op = XR_JIT_SAR;
+	} else if (func == &XrExecuteVirtualRor) {
+		desc->Op = XR_JIT_ROR;
+	} else {
+		goto notshiftimm;
+	}
+
+	return 1;
+
+notshiftimm:
+
+	desc->Rd = inst->Imm8_1;
+	desc->Ra = inst->Imm8_2;
+	desc->Imm = inst->Imm32_1;
+
+	if (func == &XrExecuteAdr || func == &XrExecuteLoadConstant) {
+		// LoadConstant is a fused LUI and ORI/ADDI pair.
+
+		desc->Kind = XR_JIT_CONST;
+
+		return 1;
+	}
+
+	if (XrJitDescribeAccess(inst, desc)) {
+		return 1;
+	}
+
+#if !XR_SIMULATE_CACHES
+	if (func == &XrExecuteTraceGuard) {
+		desc->Kind = XR_JIT_GUARD;
+		desc->Op = inst->Imm8_3;
+
+		return 1;
+	}
+#endif
+
+	for (int i = 0; i < 8; i++) {
+		if (func == XrGuardForms[i].Branch) {
+			desc->Kind = XR_JIT_BRANCH;
+			desc->Op = XrGuardForms[i].Condition;
+
+			return 1;
+		}
+	}
+
+	if (func == &XrExecuteSubBeq || func == &XrExecuteSubBne) {
+		// The subtrahend is in Imm8_3.
+
+		desc->Kind = XR_JIT_SUB_BRANCH;
+		desc->Op = func == &XrExecuteSubBeq ? XR_GUARD_EQ : XR_GUARD_NE;
+		desc->Rb = inst->Imm8_3;
+
+		return 1;
+	}
+
+	if (func == &XrExecuteB || func == &XrExecuteJ) {
+		desc->Kind = XR_JIT_JUMP;
+
+		return 1;
+	}
+
+	if (func == &XrExecuteJal) {
+		desc->Kind = XR_JIT_JAL;
+		desc->Rd = LR;
+
+		return 1;
+	}
+
+	if (func == &XrSpecialLinkageInstruction) {
+		desc->Kind = XR_JIT_LINKAGE;
+
+		return 1;
+	}
+
+	desc->Kind = XR_JIT_NONE;
+
+	return 0;
+}
+
+static void XrJitCountUses(XrJitInstDesc *desc, uint32_t *uses, uint64_t *written) {
+	// Count the guest registers read and written by an instruction, for the
+	// register allocator.
+
+	switch (desc->Kind) {
+		case XR_JIT_REG:
+		case XR_JIT_SHIFT_REG:
+			uses[desc->Rb]++;
+
+			// Fall through.
+
+		case XR_JIT_IMM:
+		case XR_JIT_INC:
+		case XR_JIT_SHIFT_IMM:
+			uses[desc->Ra]++;
+
+			// Fall through.
+
+		case XR_JIT_CONST:
+		case XR_JIT_JAL:
+			uses[desc->Rd]++;
+			*written |= 1ull << desc->Rd;
+
+			break;
+
+		case XR_JIT_LOAD:
+		case XR_JIT_STORE:
+			if (desc->Mode == XR_JIT_ADDR_REG) {
+				uses[desc->Rb]++;
+			}
+
+			if (desc->Mode == XR_JIT_ADDR_ABSOLUTE) {
+				*written |= 1ull << desc->Ra;
+			}
+
+			if (desc->Mode != XR_JIT_ADDR_DIRECT) {
+				uses[desc->Ra]++;
+			}
+
+			if (desc->Kind == XR_JIT_LOAD) {
+				*written |= 1ull << desc->Rd;
+			}
+
+			if (!desc->ValueImm) {
+				uses[desc->Rd]++;
+			}
+
+			break;
+
+		case XR_JIT_SUB_BRANCH:
+			uses[desc->Ra]++;
+			uses[desc->Rb]++;
+			*written |= 1ull << desc->Rd;
+
+			// Fall through.
+
+		case XR_JIT_GUARD:
+		case XR_JIT_BRANCH:
+			uses[desc->Rd]++;
+
+			break;
+	}
+}
+
+static inline void XrJitByte(XrJitEmitter *emit, uint8_t byte) {
+	emit->Code[emit->Length++] = byte;
+}
+
+static inline void XrJitLong(XrJitEmitter *emit, uint32_t value) {
+	memcpy(&emit->Code[emit->Length], &value, 4);
+	emit->Length += 4;
+}
+
+static inline void XrJitQuad(XrJitEmitter *emit, uint64_t value) {
+	memcpy(&emit->Code[emit->Length], &value, 8);
+	emit->Length += 8;
+}
+
+static void XrJitOp(XrJitEmitter *emit, uint32_t opcode, int reg, int rm, uint32_t disp) {
+	// Emit an instruction with a ModRM operand, which is either the host
+	// register rm, or [RBX + disp] if rm is XR_JIT_MEMORY. Two byte opcodes
+	// have the 0x0F escape in the high byte.
+
+	int base = (rm == XR_JIT_MEMORY) ? XR_HOST_EBX : rm;
+
+	if (reg >= 8 || base >= 8) {
+		XrJitByte(emit, 0x40 | ((reg >> 3) << 2) | (base >> 3));
+	}
+
+	if (opcode > 0xFF) {
+		XrJitByte(emit, opcode >> 8);
+	}
+
+	XrJitByte(emit, opcode);
+
+	if (rm == XR_JIT_MEMORY) {
+		XrJitByte(emit, 0x80 | ((reg & 7) << 3) | XR_HOST_EBX);
+		XrJitLong(emit, disp);
+	} else {
+		XrJitByte(emit, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+	}
+}
+
+static inline void XrJitGuestOp(XrJitEmitter *emit, uint32_t opcode, int reg, int guest) {
+	// Emit an instruction whose ModRM operand is a guest register, wherever
+	// it's being held.
+
+	XrJitOp(emit, opcode, reg, emit->Host[guest], XR_JIT_REG_OFFSET(guest));
+}
+
+static void XrJitMovImm(XrJitEmitter *emit, int dst, uint32_t imm) {
+	// MOV dst, imm32
+
+	if (dst >= 8) {
+		XrJitByte(emit, 0x41);
+	}
+
+	XrJitByte(emit, 0xB8 + (dst & 7));
+	XrJitLong(emit, imm);
+}
+
+static void XrJitGuestMovImm(XrJitEmitter *emit, int guest, uint32_t imm) {
+	// Set a guest register to a constant.
+
+	if (emit->Host[guest] == XR_JIT_MEMORY) {
+		XrJitOp(emit, 0xC7, 0, XR_JIT_MEMORY, XR_JIT_REG_OFFSET(guest));
+		XrJitLong(emit, imm);
+	} else {
+		XrJitMovImm(emit, emit->Host[guest], imm);
+	}
+}
+
+static void XrJitSetPc(XrJitEmitter *emit, uint32_t pc) {
+	// MOV DWORD [RBX + Pc], imm32
+
+	XrJitOp(emit, 0xC7, 0, XR_JIT_MEMORY, offsetof(XrProcessor, Pc));
+	XrJitLong(emit, pc);
+}
+
+#ifdef PROFCPU
+#define XR_JIT_COUNT_FUSED(emit, counter) \
+	XrJitOp(emit, 0xFF, 0, XR_JIT_MEMORY, offsetof(XrProcessor, counter));
+#else
+#define XR_JIT_COUNT_FUSED(emit, counter)
+#endif
+
+static uint32_t XrJitJump(XrJitEmitter *emit, int condition) {
+	// Emit a jump with a 32-bit displacement to be patched later, which is
+	// conditional unless condition is -1. Returns the offset of the
+	// displacement.
+
+	if (condition == -1) {
+		XrJitByte(emit, 0xE9);
+	} else {
+		XrJitByte(emit, 0x0F);
+		XrJitByte(emit, 0x80 | condition);
+	}
+
+	XrJitLong(emit, 0);
+
+	return emit->Length - 4;
+}
+
+static void XrJitPatch(XrJitEmitter *emit, uint32_t at, uint32_t target) {
+	uint32_t displacement = target - (at + 4);
+
+	memcpy(&emit->Code[at], &displacement, 4);
+}
+
+static void XrJitExit(XrJitEmitter *emit, uint32_t exit) {
+	// Leave the native code with the given exit code.
+
+	XrJitMovImm(emit, XR_HOST_EAX, exit);
+
+	emit->ExitJumps[emit->ExitJumpCount++] = XrJitJump(emit, -1);
+}
+
+static void XrJitExitIf(XrJitEmitter *emit, int condition, uint32_t exit) {
+	// Leave the native code with the given exit code if the condition holds,
+	// through a stub placed after the main line.
+
+	emit->StubExits[emit->StubCount] = exit;
+	emit->StubJumps[emit->StubCount++] = XrJitJump(emit, condition);
+}
+
+static int XrJitTestGuest(XrJitEmitter *emit, int guest, int condition) {
+	// Set the host flags from a guest register for the given XR_GUARD
+	// condition, and return the x86 condition code under which it holds.
+
+	if (condition == XR_GUARD_PE || condition == XR_GUARD_PO) {
+		// TEST reg, 1
+
+		XrJitGuestOp(emit, 0xF7, 0, guest);
+		XrJitLong(emit, 1);
+	} else {
+		// CMP reg, 0
+
+		XrJitGuestOp(emit, 0x83, 7, guest);
+		XrJitByte(emit, 0);
+	}
+
+	return XrJitConditionCodes[condition];
+}
+
+// The access routines called by the native code. The reads return the value
+// in the low half and 1 in bit 32 on success, or 0 if there was an
+// exception.
+
+static XR_ALWAYS_INLINE uint64_t XrJitRead(XrProcessor *proc, XrIblock *block, uint32_t slot, uint32_t address, uint32_t length) {
+	uint32_t value = 0;
+
+#ifdef FASTMEMORY
+	int status = XrAccessRead(proc, block, slot, address, &value, length, 0);
+#else
+	int status = XrAccess(proc, address, &value, 0, length, 0);
+#endif
+
+	if (XrUnlikely(!status)) {
+		return 0;
+	}
+
+	return (1ull << 32) | value;
+}
+
+static XR_ALWAYS_INLINE int XrJitWrite(XrProcessor *proc, XrIblock *block, uint32_t slot, uint32_t address, uint32_t value, uint32_t length) {
+#ifdef FASTMEMORY
+	return XrAccessWrite(proc, block, slot, address, value, length, 0);
+#else
+	return XrAccess(proc, address, 0, value, length, 0);
+#endif
+}
+
+static uint64_t XrJitReadLong(XrProcessor *proc, XrIblock *block, uint32_t slot, uint32_t address) {
+	return XrJitRead(proc, block, slot, address, 4);
+}
+
+static uint64_t XrJitReadInt(XrProcessor *proc, XrIblock *block, uint32_t slot, uint32_t address) {
+	return XrJitRead(proc, block, slot, address, 2);
+}
+
+static uint64_t XrJitReadByte(XrProcessor *proc, XrIblock *block, uint32_t slot, uint32_t address) {
+	return XrJitRead(proc, block, slot, address, 1);
+}
+
+static int XrJitWriteLong(XrProcessor *proc, XrIblock *block, uint32_t slot, uint32_t address, uint32_t value) {
+	return XrJitWrite(proc, block, slot, address, value, 4);
+}
+
+static int XrJitWriteInt(XrProcessor *proc, XrIblock *block, uint32_t slot, uint32_t address, uint32_t value) {
+	return XrJitWrite(proc, block, slot, address, value, 2);
+}
+
+static int XrJitWriteByte(XrProcessor *proc, XrIblock *block, uint32_t slot, uint32_t address, uint32_t value) {
+	return XrJitWrite(proc, block, slot, address, value, 1);
+}
+
+static void XrJitEmitAccess(XrJitEmitter *emit, XrIblock *block, XrJitInstDesc *desc, uint32_t pc, uint32_t charge) {
+	// Emit a call to the access routine for a load or store, passing the
+	// processor in RDI, the Iblock in RSI, the DTB slot in EDX, the address in
+	// ECX, and the value to store in R8D.
+
+	if (desc->Mode == XR_JIT_ADDR_ABSOLUTE) {
+		// The LUI retires first.
+
+		XrJitGuestMovImm(emit, desc->Ra, desc->Value);
+	}
+
+	switch (desc->Mode) {
+		case XR_JIT_ADDR_REG:
+			XrJitGuestOp(emit, 0x8B, XR_HOST_ECX, desc->Ra);
+			XrJitGuestOp(emit, XR_JIT_ADD, XR_HOST_ECX, desc->Rb);
+
+			break;
+
+		case XR_JIT_ADDR_IMM:
+			XrJitGuestOp(emit, 0x8B, XR_HOST_ECX, desc->Ra);
+
+			if (desc->Imm) {
+				XrJitOp(emit, 0x81, XR_JIT_ADD >> 8, XR_HOST_ECX, 0);
+				XrJitLong(emit, desc->Imm);
+			}
+
+			break;
+
+		default:
+			XrJitMovImm(emit, XR_HOST_ECX, desc->Imm);
+
+			break;
+	}
+
+	if (desc->Kind == XR_JIT_STORE) {
+		if (desc->ValueImm) {
+			XrJitMovImm(emit, XR_HOST_R8, desc->Value);
+		} else {
+			XrJitGuestOp(emit, 0x8B, XR_HOST_R8, desc->Rd);
+		}
+	}
+
+	XrJitSetPc(emit, pc);
+
+	// MOV RDI, RBX; MOV RSI, imm64; MOV EDX, imm32
+
+	XrJitByte(emit, 0x48);
+	XrJitByte(emit, 0x89);
+	XrJitByte(emit, 0xDF);
+
+	XrJitByte(emit, 0x48);
+	XrJitByte(emit, 0xBE);
+	XrJitQuad(emit, (uintptr_t)block);
+
+	XrJitMovImm(emit, XR_HOST_EDX, desc->Op);
+
+	void *routine;
+
+	if (desc->Kind == XR_JIT_LOAD) {
+		routine = desc->Length == 4 ? (void *)&XrJitReadLong :
+			desc->Length == 2 ? (void *)&XrJitReadInt : (void *)&XrJitReadByte;
+	} else {
+		routine = desc->Length == 4 ? (void *)&XrJitWriteLong :
+			desc->Length == 2 ? (void *)&XrJitWriteInt : (void *)&XrJitWriteByte;
+	}
+
+	// MOV RAX, imm64; CALL RAX
+
+	XrJitByte(emit, 0x48);
+	XrJitByte(emit, 0xB8);
+	XrJitQuad(emit, (uintptr_t)routine);
+
+	XrJitByte(emit, 0xFF);
+	XrJitByte(emit, 0xD0);
+
+	if (desc->Kind == XR_JIT_LOAD) {
+		// BT RAX, 32; JNC fault; MOV RD, EAX
+
+		XrJitByte(emit, 0x48);
+		XrJitByte(emit, 0x0F);
+		XrJitByte(emit, 0xBA);
+		XrJitByte(emit, 0xE0);
+		XrJitByte(emit, 32);
+
+		XrJitExitIf(emit, 0x3, XR_JIT_EXIT_FAULT + charge);
+
+		XrJitGuestOp(emit, 0x89, XR_HOST_EAX, desc->Rd);
+	} else {
+		// TEST EAX, EAX; JZ fault
+
+		XrJitByte(emit, 0x85);
+		XrJitByte(emit, 0xC0);
+
+		XrJitExitIf(emit, 0x4, XR_JIT_EXIT_FAULT + charge);
+	}
+}
+
+static void XrJitEmitInst(XrJitEmitter *emit, XrIblock *block, XrCachedInst *inst, XrJitInstDesc *desc) {
+	// Emit the host code for a single guest instruction. Results are computed
+	// into EAX and then moved to wherever the destination is held.
+
+	uint32_t pc = block->PcBias[XR_PC_OFFSET_SEGMENT(inst->PcOffset)] + ((uint32_t)XR_PC_OFFSET_INDEX(inst->PcOffset) << 2);
+	uint32_t index = XR_PC_OFFSET_INDEX(inst->PcOffset);
+	int condition;
+
+	switch (desc->Kind) {
+		case XR_JIT_CONST:
+			XrJitGuestMovImm(emit, desc->Rd, desc->Imm);
+
+			return;
+
+		case XR_JIT_INC:
+			// ADD RD, imm32
+
+			XrJitGuestOp(emit, 0x81, XR_JIT_ADD >> 8, desc->Rd);
+			XrJitLong(emit, desc->Imm);
+
+			return;
+
+		case XR_JIT_REG:
+			XrJitGuestOp(emit, 0x8B, XR_HOST_EAX, desc->Ra);
+
+			if (desc->Op == XR_JIT_SLT || desc->Op == XR_JIT_SLTS) {
+				XrJitGuestOp(emit, XR_JIT_CMP & 0xFF, XR_HOST_EAX, desc->Rb);
+				goto setcc;
+			}
+
+			if (desc->Op == XR_JIT_NOR) {
+				XrJitGuestOp(emit, XR_JIT_OR & 0xFF, XR_HOST_EAX, desc->Rb);
+
+				// NOT EAX
+
+				XrJitOp(emit, 0xF7, 2, XR_HOST_EAX, 0);
+			} else if (desc->Op == XR_JIT_MUL) {
+				// IMUL EAX, RB
+
+				XrJitGuestOp(emit, 0x0FAF, XR_HOST_EAX, desc->Rb);
+			} else {
+				XrJitGuestOp(emit, desc->Op & 0xFF, XR_HOST_EAX, desc->Rb);
+			}
+
+			break;
+
+		case XR_JIT_IMM:
+			XrJitGuestOp(emit, 0x8B, XR_HOST_EAX, desc->Ra);
+
+			if (desc->Op == XR_JIT_SLT || desc->Op == XR_JIT_SLTS) {
+				XrJitOp(emit, 0x81, XR_JIT_CMP >> 8, XR_HOST_EAX, 0);
+				XrJitLong(emit, desc->Imm);
+				goto setcc;
+			}
+
+			if (desc->Imm || desc->Op == XR_JIT_AND) {
+				XrJitOp(emit, 0x81, desc->Op >> 8, XR_HOST_EAX, 0);
+				XrJitLong(emit, desc->Imm);
+			}
+
+			break;
+
+		case XR_JIT_SHIFT_REG:
+			// MOV ECX, RA; MOV EAX, RB; OP EAX, CL
+			// The host masks the shift count to 5 bits just like we do.
+
+			XrJitGuestOp(emit, 0x8B, XR_HOST_ECX, desc->Ra);
+			XrJitGuestOp(emit, 0x8B, XR_HOST_EAX, desc->Rb);
+			XrJitOp(emit, 0xD3, desc->Op, XR_HOST_EAX, 0);
+
+			break;
+
+		case XR_JIT_SHIFT_IMM:
+			XrJitGuestOp(emit, 0x8B, XR_HOST_EAX, desc->Ra);
+			XrJitOp(emit, 0xC1, desc->Op, XR_HOST_EAX, 0);
+			XrJitByte(emit, desc->Imm);
+
+			break;
+
+		case XR_JIT_LOAD:
+		case XR_JIT_STORE:
+			if (desc->Mode == XR_JIT_ADDR_ABSOLUTE) {
+				// The access is made by the second instruction of the fused
+				// pair.
+
+				XR_JIT_COUNT_FUSED(emit, FusedAbsoluteCount);
+
+				XrJitEmitAccess(emit, block, desc, pc + 4, index + 1);
+			} else {
+				if (desc->Mode == XR_JIT_ADDR_DIRECT) {
+					XR_JIT_COUNT_FUSED(emit, DirectAccessCount);
+				}
+
+				XrJitEmitAccess(emit, block, desc, pc, index);
+			}
+
+			return;
+
+		case XR_JIT_GUARD:
+			// Leave through the guard itself if it would take its side exit,
+			// so that the interpreter does the bookkeeping.
+
+			XR_JIT_COUNT_FUSED(emit, TraceGuardCount);
+
+			condition = XrJitTestGuest(emit, desc->Rd, desc->Op & ~XR_GUARD_EXIT_IF_TRUE);
+
+			if ((desc->Op & XR_GUARD_EXIT_IF_TRUE) == 0) {
+				condition ^= 1;
+			}
+
+			XrJitExitIf(emit, condition, XR_JIT_EXIT_SLOT + (inst - &block->Insts[0]));
+
+			return;
+
+		case XR_JIT_BRANCH:
+			condition = XrJitTestGuest(emit, desc->Rd, desc->Op);
+
+			goto branch;
+
+		case XR_JIT_SUB_BRANCH:
+			// SUB RD, RA, RB; then test the result in EAX. The branch is the
+			// second instruction of the pair.
+
+			XR_JIT_COUNT_FUSED(emit, FusedBranchCount);
+
+			XrJitGuestOp(emit, 0x8B, XR_HOST_EAX, desc->Ra);
+			XrJitGuestOp(emit, XR_JIT_SUB & 0xFF, XR_HOST_EAX, desc->Rb);
+			XrJitGuestOp(emit, 0x89, XR_HOST_EAX, desc->Rd);
+
+			XrJitOp(emit, 0x83, 7, XR_HOST_EAX, 0);
+			XrJitByte(emit, 0);
+
+			condition = XrJitConditionCodes[desc->Op];
+			pc += 4;
+
+			goto branch;
+
+		case XR_JIT_JAL:
+			XrJitGuestMovImm(emit, LR, pc + 4);
+
+			// Fall through.
+
+		case XR_JIT_JUMP:
+			XrJitSetPc(emit, desc->Imm);
+			XrJitExit(emit, XR_JIT_EXIT_JUMP + XR_TRUE_PATH);
+
+			return;
+
+		case XR_JIT_LINKAGE:
+			XrJitSetPc(emit, pc);
+			XrJitExit(emit, XR_JIT_EXIT_JUMP + XR_TRUE_PATH);
+
+			return;
+	}
+
+	XrJitGuestOp(emit, 0x89, XR_HOST_EAX, desc->Rd);
+
+	return;
+
+setcc:
+
+	// SETB AL or SETL AL, then MOVZX EAX, AL.
+
+	XrJitOp(emit, desc->Op == XR_JIT_SLT ? 0x0F92 : 0x0F9C, 0, XR_HOST_EAX, 0);
+	XrJitOp(emit, 0x0FB6, XR_HOST_EAX, XR_HOST_EAX, 0);
+	XrJitGuestOp(emit, 0x89, XR_HOST_EAX, desc->Rd);
+
+	return;
+
+branch: {
+	// Jump over the taken path if the condition doesn't hold.
+
+	uint32_t skip = XrJitJump(emit, condition ^ 1);
+
+	XrJitSetPc(emit, desc->Imm);
+	XrJitExit(emit, XR_JIT_EXIT_BRANCH + XR_TRUE_PATH);
+
+	XrJitPatch(emit, skip, emit->Length);
+
+	XrJitSetPc(emit, pc + 4);
+	XrJitExit(emit, XR_JIT_EXIT_BRANCH + XR_FALSE_PATH);
+}
+}
+
+static uint32_t XrJitTranslate(XrIblock *iblock, uint8_t *code, int start, int end) {
+	// Translate the instructions in slots [start, end) of the Iblock into
+	// native code in the given buffer, and return its length. If the last of
+	// them doesn't end the Iblock, the native code resumes interpreting at
+	// slot end.
+
+	XrJitEmitter emit;
+	XrJitInstDesc descs[XR_IBLOCK_INSTS + 2];
+	uint32_t uses[XR_REG_MAX];
+
+	emit.Code = code;
+	emit.Length = 0;
+	emit.Written = 0;
+	emit.ExitJumpCount = 0;
+	emit.StubCount = 0;
+
+	for (int i = 0; i < XR_REG_MAX; i++) {
+		uses[i] = 0;
+		emit.Host[i] = XR_JIT_MEMORY;
+	}
+
+	for (int i = start; i < end; i++) {
+		XrJitDescribe(&iblock->Insts[i], &descs[i]);
+		XrJitCountUses(&descs[i], uses, &emit.Written);
+	}
+
+	// Give the host registers to the most used guest registers. One that's
+	// only used once is just as well off in memory.
+
+	int hostcount = 0;
+
+	while (hostcount < XR_JIT_HOST_REGS) {
+		int best = -1;
+
+		for (int i = 0; i < XR_REG_MAX; i++) {
+			if (emit.Host[i] == XR_JIT_MEMORY && uses[i] >= 2 &&
+				(best == -1 || uses[i] > uses[best])) {
+
+				best = i;
+			}
+		}
+
+		if (best == -1) {
+			break;
+		}
+
+		emit.Host[best] = XrJitHostRegs[hostcount++];
+	}
+
+	// Prologue: save RBX and the host registers we use, keeping the stack
+	// aligned for the calls to the access routines, put the processor pointer
+	// in RBX, and load the guest registers held in host registers.
+
+	XrJitByte(&emit, 0x53);
+
+	for (int i = 0; i < hostcount; i++) {
+		if (XrJitHostRegs[i] >= 8) {
+			XrJitByte(&emit, 0x41);
+		}
+
+		XrJitByte(&emit, 0x50 + (XrJitHostRegs[i] & 7));
+	}
+
+	int padded = (hostcount & 1) != 0;
+
+	if (padded) {
+		// SUB RSP, 8
+
+		XrJitByte(&emit, 0x48);
+		XrJitByte(&emit, 0x83);
+		XrJitByte(&emit, 0xEC);
+		XrJitByte(&emit, 8);
+	}
+
+	// MOV RBX, RDI
+
+	XrJitByte(&emit, 0x48);
+	XrJitByte(&emit, 0x89);
+	XrJitByte(&emit, 0xFB);
+
+	for (int i = 0; i < XR_REG_MAX; i++) {
+		if (emit.Host[i] != XR_JIT_MEMORY) {
+			XrJitOp(&emit, 0x8B, emit.Host[i], XR_JIT_MEMORY, XR_JIT_REG_OFFSET(i));
+		}
+	}
+
+	for (int i = start; i < end; i++) {
+		XrJitEmitInst(&emit, iblock, &iblock->Insts[i], &descs[i]);
+	}
+
+	if (descs[end - 1].Kind < XR_JIT_BRANCH) {
+		// Continue with the instruction we couldn't translate.
+
+		XrJitMovImm(&emit, XR_HOST_EAX, XR_JIT_EXIT_SLOT + end);
+	}
+
+	// The common exit: write back the guest registers that were changed in
+	// host registers and restore the ones we saved. The exit code is in EAX.
+
+	uint32_t exit = emit.Length;
+
+	for (int i = 0; i < XR_REG_MAX; i++) {
+		if (emit.Host[i] != XR_JIT_MEMORY && (emit.Written & (1ull << i))) {
+			XrJitOp(&emit, 0x89, emit.Host[i], XR_JIT_MEMORY, XR_JIT_REG_OFFSET(i));
+		}
+	}
+
+	if (padded) {
+		// ADD RSP, 8
+
+		XrJitByte(&emit, 0x48);
+		XrJitByte(&emit, 0x83);
+		XrJitByte(&emit, 0xC4);
+		XrJitByte(&emit, 8);
+	}
+
+	for (int i = hostcount - 1; i >= 0; i--) {
+		if (XrJitHostRegs[i] >= 8) {
+			XrJitByte(&emit, 0x41);
+		}
+
+		XrJitByte(&emit, 0x58 + (XrJitHostRegs[i] & 7));
+	}
+
+	XrJitByte(&emit, 0x5B);
+	XrJitByte(&emit, 0xC3);
+
+	// The stubs for the exits taken on exceptions and guards.
+
+	for (int i = 0; i < emit.StubCount; i++) {
+		XrJitPatch(&emit, emit.StubJumps[i], emit.Length);
+		XrJitMovImm(&emit, XR_HOST_EAX, emit.StubExits[i]);
+		XrJitPatch(&emit, XrJitJump(&emit, -1), exit);
+	}
+
+	for (int i = 0; i < emit.ExitJumpCount; i++) {
+		XrJitPatch(&emit, emit.ExitJumps[i], exit);
+	}
+
+	return emit.Length;
+}
+
+XR_PRESERVE_NONE
+static void XrExecuteNative(XrProcessor *proc, XrIblock *block, XrCachedInst *inst) {
+	DBGPRINT("exec 105\n");
+
+	// Call the native code for the rest of the Iblock. Imm32_1 is the offset
+	// of the code within the arena, Imm8_1 is the last slot it covers, which
+	// holds the terminator if it has one, and Imm8_2 is 1 if that's a fused
+	// pair whose second instruction is the branch.
+
+	uint32_t exit = ((XrJitNativeF)(proc->JitArena + inst->Imm32_1))(proc);
+	uint32_t value = XR_JIT_EXIT_VALUE(exit);
+
+	if (XR_JIT_EXIT_KIND(exit) == XR_JIT_EXIT_SLOT) {
+		inst = &block->Insts[value];
+
+		XR_TAIL return inst->Func(proc, block, inst);
+	}
+
+	if (XR_JIT_EXIT_KIND(exit) == XR_JIT_EXIT_FAULT) {
+		XR_EARLY_EXIT_AT(value);
+	}
+
+	// Leave the Iblock the same way the terminator would have. proc->Pc has
+	// already been set.
+
+	uint32_t index = XR_PC_OFFSET_INDEX(block->Insts[inst->Imm8_1].PcOffset) + inst->Imm8_2;
+	XrIblock **referrent = &block->CachedPaths[value];
+
+	if (XR_JIT_EXIT_KIND(exit) == XR_JIT_EXIT_BRANCH) {
+		XR_PROFILE_BRANCH(value == XR_TRUE_PATH,
+			block->PcBias[XR_PC_OFFSET_SEGMENT(block->Insts[inst->Imm8_1].PcOffset)] + (index << 2));
+	}
+
+	XrIblock *iblock = *referrent;
+
+	if (XrUnlikely(!iblock)) {
+		iblock = XrDecodeInstructions(proc, block);
+
+		if (XrUnlikely(!iblock)) {
+			XR_EARLY_EXIT_AT(index);
+		}
+
+		XrCreateCachedPointerToBlock(iblock, referrent);
+	}
+
+	XR_DISPATCH(iblock);
+}
+
+static int XrJitProtect(XrProcessor *proc, uint32_t offset, uint32_t length, int prot) {
+	// Change the protection of the pages covering part of the arena. Returns
+	// nonzero on failure.
+
+	uintptr_t start = (uintptr_t)(proc->JitArena + offset) & ~(XrJitPageSize - 1);
+	uintptr_t end = ((uintptr_t)(proc->JitArena + offset + length) + XrJitPageSize - 1) & ~(XrJitPageSize - 1);
+
+	return mprotect((void *)start, end - start, prot);
+}
+
+static void XrJitPromoteIblock(XrProcessor *proc, XrIblock *iblock) {
+	// The Iblock has become hot. Translate the longest run of translatable
+	// instructions in it, which is normally everything from the first one
+	// through the terminator.
+
+	if (iblock->Native || !proc->JitArena) {
+		// Already did this one, or there's no native code tier.
+
+		return;
+	}
+
+	if (XrUnlikely(proc->JitArenaUsed + XR_JIT_MAX_BYTES > XR_JIT_ARENA_SIZE)) {
+		// No room. The arena will be reclaimed along with the Iblock cache the
+		// next time the processor is entered.
+
+		proc->JitFlushPending = 1;
+
+		return;
+	}
+
+	iblock->Native = 1;
+
+	int count = iblock->InstCount;
+	int beststart = 0;
+	int bestend = 0;
+	int index = 0;
+
+	XrJitInstDesc desc;
+
+	while (index < count) {
+		// Find the extent of the next run. A guard can't start one, since the
+		// native code leaves through the guard's own slot to take its side
+		// exit.
+
+		while (index < count &&
+			(!XrJitDescribe(&iblock->Insts[index], &desc) || desc.Kind == XR_JIT_GUARD)) {
+
+			index++;
+		}
+
+		int start = index;
+
+		while (index < count && XrJitDescribe(&iblock->Insts[index], &desc)) {
+			index++;
+
+			if (desc.Kind >= XR_JIT_BRANCH) {
+				break;
+			}
+		}
+
+		if (index == count && index > start && desc.Kind < XR_JIT_BRANCH) {
+			// The Iblock doesn't end in a terminator we know, so leave its
+			// last instruction to the interpreter.
+
+			index--;
+		}
+
+		if (index - start >= bestend - beststart) {
+			beststart = start;
+			bestend = index;
+		}
+
+		if (index == start) {
+			index++;
+		}
+	}
+
+	if (bestend - beststart < XR_JIT_MIN_RUN) {
+		return;
+	}
+
+#ifdef FASTMEMORY
+	if (iblock->Cold->Shared && !XrPrivatizeIblock(proc, iblock)) {
+		// The native code is specific to this processor, so it can't be
+		// patched into shared code, and there's no private buffer to copy it
+		// to. Try again later.
+
+		iblock->Native = 0;
+		iblock->Heat = XR_JIT_THRESHOLD;
+
+		return;
+	}
+#endif
+
+	// Translate into a scratch buffer first, since we can't write to the
+	// arena while any of it is executable.
+
+	uint8_t code[XR_JIT_MAX_BYTES];
+
+	uint32_t length = XrJitTranslate(iblock, &code[0], beststart, bestend);
+	uint32_t offset = proc->JitArenaUsed;
+
+	// Make the end of the arena writable. The page the last translation ended
+	// on is executable, but none of the code on it can run until we're done.
+
+	if (XrUnlikely(XrJitProtect(proc, offset, length, PROT_READ | PROT_WRITE))) {
+		// Leave this one to the interpreter.
+
+		return;
+	}
+
+	memcpy(proc->JitArena + offset, &code[0], length);
+
+	// Make it executable again, along with whatever we just wrote. The host
+	// already let us do this once in XrJitInitialize, and there's no going
+	// back now that other code on these pages might be run.
+
+	if (XrUnlikely(XrJitProtect(proc, offset, length, PROT_READ | PROT_EXEC))) {
+		fprintf(stderr, "failed to protect native code arena for cpu %d\n", proc->Id);
+		exit(1);
+	}
+
+	proc->JitArenaUsed += (length + 15) & ~15;
+
+	// The native code now stands in for the first instruction of the run. The
+	// rest of the run stays as it was, for the interpreter to use if the
+	// native code leaves early.
+
+	XrCachedInst *first = &iblock->Insts[beststart];
+
+	XrJitDescribe(&iblock->Insts[bestend - 1], &desc);
+
+	first->Func = &XrExecuteNative;
+	first->Imm32_1 = offset;
+	first->Imm8_1 = bestend - 1;
+	first->Imm8_2 = desc.Kind == XR_JIT_SUB_BRANCH;
+}
+
+static void XrJitFlush(XrProcessor *proc) {
+	// Reclaim the whole native code arena. Every Iblock that might refer to it
+	// must be destroyed along with it.
+
+	XrInvalidateIblockCache(proc);
+
+	proc->JitArenaUsed = 0;
+	proc->JitFlushPending = 0;
+}
+
+static void XrJitInitialize(XrProcessor *proc) {
+	// The arena is never writable and executable at the same time. It starts
+	// out writable, and the pages holding each batch of new code are made
+	// executable once it's been written. If the host won't let us do either,
+	// the processor runs without the native code tier.
+
+	XrJitPageSize = sysconf(_SC_PAGESIZE);
+
+	proc->JitArenaUsed = 0;
+	proc->JitFlushPending = 0;
+
+	proc->JitArena = mmap(0, XR_JIT_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (proc->JitArena == MAP_FAILED) {
+		proc->JitArena = 0;
+	} else if (XrJitProtect(proc, 0, XR_JIT_ARENA_SIZE, PROT_READ | PROT_EXEC) ||
+		XrJitProtect(proc, 0, XR_JIT_ARENA_SIZE, PROT_READ | PROT_WRITE)) {
+
+		munmap(proc->JitArena, XR_JIT_ARENA_SIZE);
+		proc->JitArena = 0;
+	}
+
+	if (!proc->JitArena) {
+		fprintf(stderr, "native code tier unavailable for cpu %d, interpreting only\n", proc->Id);
+	}
+}